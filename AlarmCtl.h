@@ -0,0 +1,72 @@
+// The file AlarmCtl.h is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "stdafx.h"
+
+// Binary protocol of the local control socket (CTL_SOCKET in alarm_config), for automation
+// running on the same host.  The socket is a SOCK_SEQPACKET unix socket, so every request,
+// response and event is exactly one t_CtlMsg datagram, in host byte order.
+//
+// The client fills in cmd, seq, arg and part.  The response echoes cmd, seq and part, sets
+// status and carries the current state of partition part.  After CTL_CMD_SUBSCRIBE the client
+// is also sent a CTL_EVENT message each time that partition's state version changes.  part 0
+// is the first partition, the whole house if alarm_config has no PARTITION lines.
+//
+// Any local user may query and subscribe.  Arming and disarming need the peer (checked with
+// SO_PEERCRED) to be root, the alarm daemon's user or a uid listed in CTL_UIDS.
+
+static const char    CTL_SOCKET_FILE[] = "/run/alarm.sock";  // default socket path
+
+static const uint8_t CTL_CMD_STATE     = 1;     // query alarm state
+static const uint8_t CTL_CMD_ZONE      = 2;     // query zone arg (0 based), name in text
+static const uint8_t CTL_CMD_ARM_AWAY  = 3;
+static const uint8_t CTL_CMD_ARM_STAY  = 4;
+static const uint8_t CTL_CMD_DISARM    = 5;
+static const uint8_t CTL_CMD_SUBSCRIBE = 6;     // receive CTL_EVENT on every state change
+static const uint8_t CTL_EVENT         = 0x80;  // unsolicited state change (seq is 0)
+
+static const uint8_t CTL_OK            = 0;
+static const uint8_t CTL_ERR_CMD       = 1;     // unknown command
+static const uint8_t CTL_ERR_PERM      = 2;     // peer may not change the alarm state
+static const uint8_t CTL_ERR_ARG       = 3;     // zone or partition out of range
+static const uint8_t CTL_ERR_STATE     = 4;     // can't arm, already armed or a zone is open
+
+struct t_CtlMsg {
+    uint8_t  cmd;            // CTL_CMD_*, or CTL_EVENT
+    uint8_t  status;         // response status, CTL_OK or CTL_ERR_*
+    uint16_t seq;            // request sequence, echoed in the response
+    uint32_t arg;            // request argument (zone for CTL_CMD_ZONE)
+    uint32_t epoch;          // identifies the alarm daemon run
+    uint32_t version;        // alarm state version (restarts each run)
+    uint32_t loopMask;       // open zones of the partition, bit per zone
+    uint8_t  armed;          // DISARMED, ARMED_STAY, ARMED_AWAY, ARMED_BYPASS
+    uint8_t  ready;          // all zones closed
+    uint8_t  alarm;          // alarm sounding
+    uint8_t  chime;
+    uint8_t  power;          // AC power present
+    uint8_t  tone;           // keypad tone
+    uint8_t  zoneCount;      // number of configured zones
+    uint8_t  zoneOpen;       // CTL_CMD_ZONE: zone arg is open (whichever partitions it is in)
+    char     text[34];       // keypad lines 1 and 2 ("line1\0line2\0"), or zone name
+    uint8_t  part;           // partition the request is for and the state is of
+    uint8_t  partCount;      // number of partitions
+};
+
+static_assert(sizeof(t_CtlMsg) == 64, "t_CtlMsg is part of the control socket ABI");
+
+// end of AlarmCtl.h
@@ -19,22 +19,45 @@
 #include <unistd.h>
 #include "sendEmail.h"
 #include "logMsg.h"
+#include "Stats.h"
+#include "InputTrace.h"
+#include "Clock.h"
 #include <wiringPi.h>
 
-// returns a timestamp (number of milliseconds since power-on)
-uint32_t AlarmManager::getTimestamp(void)
+AlarmManager * AlarmManager::keypadOwner[MAX_KEYPADS];
+int            AlarmManager::sirenOnCount = 0;
+
+// offsets of the F7 fields from the end of the message prefix (t_F7Frame base)
+enum {
+    F7_TONE      = 3,
+    F7_CHIME     = 7,
+    F7_READY     = 11,
+    F7_ARMED     = 15,
+    F7_BACKLIGHT = 19,
+    F7_LINE1     = 23,
+    F7_HOUR      = 34,
+    F7_MIN       = 37,
+    F7_LINE2     = 42,
+    F7_END       = 59   // newline included
+};
+
+static_assert(DEFAULT_TIMEOUT_MS / 1000 < 100, "countdown is patched into line2 as two digits");
+
+// copy src into a fixed width field of dst, padding with spaces (sprintf %-N.Ns)
+static void patchField(char * dst, const char * src, int width)
 {
-    struct timespec spec;
-    clock_gettime(CLOCK_MONOTONIC, &spec);
-    return spec.tv_sec * 1000 + spec.tv_nsec/1000000;
+    int i = 0;
+    for (; i < width && src[i] != '\0'; i++)
+        dst[i] = src[i];
+    for (; i < width; i++)
+        dst[i] = ' ';
 }
 
 // return pointer to struct containing time since start
 t_ElapsedTime * AlarmManager::elapsedTime(time_t start)
 {
     static t_ElapsedTime etime;
-    time_t now;
-    time(&now);
+    time_t now = Clock::wall();
     int diffSecs = (int)difftime(now, start);
     etime.mins = (diffSecs / 60) % 60;
     etime.hours = (diffSecs / (60*60)) % 24;
@@ -45,28 +68,38 @@ t_ElapsedTime * AlarmManager::elapsedTime(time_t start)
 
 // initialize the alarm manager class.  
 void AlarmManager::init(
-    Config * pConfig)    // pointer to config class
+    Config * pConfig,         // pointer to config class
+    int      partIdx,         // index of the partition this instance runs
+    EventJournal * pJournal,  // journal shared by all partitions
+    ArmStore * pStore)        // armed state saved by the previous run, shared by all partitions
 {
     zone = 0;
     ready = false;
     power = false;
     timeoutRemain = 0;
     timeoutStart = 0;
-    lastMsgTime = getTimestamp();
+    lastMsgTime = Clock::ms();
     lastPinRecv = 0;
     chimeMsgTime = 0;
     tmpMsgTime = 0;
     loopMask = 0;
-
-    setDisarm();
+    loopsShown = false;
+    shownLoop = -1;
+    shownLoopTime = 0;
+    sirenOn = false;
+    sirenGpioPin = -1;
+    dirty = 0;
+    renderedState = ST_NONE;
+    renderedDigits = 0;
+
+    state = ST_DISARMED;  // initial state, nothing to exit or journal
+    mode  = ZMODE_DISARMED;
+    armed = DISARMED;
+    setTone(TONE_NONE);
 
     sprintf(line1, "Power on        ");
     sprintf(line2, "Alarm init done ");
 
-    altLine1[0] = '\0';
-    altLine2[0] = '\0';
-    altTextActive = false;   // enables F7A msg when true
-
     tempLine1[0] = '\0';
     tempLine2[0] = '\0';
     tmpTextActive = false;
@@ -80,37 +113,171 @@ void AlarmManager::init(
         }
     }
 
-    this->pConfig = pConfig;
+    this->partIdx  = partIdx;
+    this->pJournal = pJournal;
+    this->pStore   = pStore;
+    loadPartition(pConfig);
 
     chime     = pConfig->getChimeDefault(); // initial state of chime mode
-    pLoop     = pConfig->getLoop();         // pointer to array of sense loops
-    loopCount = pConfig->getLoopCount();    // number of sense loops in array
-    pPin      = pConfig->getPin();          // pointer to array of user pin entries
-    userCount = pConfig->getPinCount();     // number of user pin entries
-
-    sirenGpioPin = pConfig->getOutput("SIREN");   // gpio pin for siren output
 
-    time(&startTime);
+    startTime = Clock::wall();
 
     lastAlertMsg[0] = '\0';
     lastAlertTime = 0;
 
     turnOnBacklight();
+
+    t_ArmPart saved;
+    uint64_t  downMs;
+    if (pStore != NULL && pStore->get(partIdx, layoutHash, &saved, &downMs))  // restarted while armed, carry on
+        resume(&saved, downMs);
+
+    updateState();
+
+    stateVersion = 0;
+    memset(stateHistory, 0, sizeof(stateHistory));
+    publishState();
+}
+
+void AlarmManager::fini(void)
+{
+    for (int kp=0; kp < MAX_KEYPADS; kp++)
+    {
+        if (keypadOwner[kp] == this)
+            keypadOwner[kp] = NULL;
+    }
+}
+
+// take the partition's loops, users, keypads and outputs from pConfig
+void AlarmManager::loadPartition(Config * pConfig)
+{
+    Partition * pPart = pConfig->getPartition();
+
+    this->pConfig = pConfig;
+    f7Frame.valid = false;  // keypad address may change
+    pLoop        = pConfig->getLoop();           // pointer to sense loop table
+    pPin         = pConfig->getPin();            // pointer to user pin table
+    pUser        = pPart->userIdx + pPart->userStart[partIdx];
+    userCount    = pPart->userCount[partIdx];
+    partName     = pPart->name[partIdx];
+    partLoopMask = pPart->loopMask[partIdx];
+    keypadMask   = pPart->keypadMask[partIdx];
+
+    journalMask = partLoopMask;  // a loop shared by partitions is journaled once, by the first
+    for (int i=0; i < partIdx; i++)
+        journalMask &= ~pPart->loopMask[i];
+
+    layoutHash = ArmStore::checksum(partName, strlen(partName) + 1);
+    for (int i=0; i < pConfig->getLoopCount(); i++)  // a saved loop mask only fits the same loops at the same index
+        if ((partLoopMask >> i) & 0x1)
+            layoutHash = ArmStore::checksum(pLoop->name[i], strlen(pLoop->name[i]) + 1, ArmStore::checksum(&i, sizeof(i), layoutHash));
+
+    for (int i=0; i < pConfig->getLoopCount(); i++)  // compile the zone table for each loop
+        for (int m=0; m < ZMODE_COUNT; m++)
+            for (int e=0; e < ZEVENT_COUNT; e++)
+                zoneAction[i][m][e] = compileZone(pLoop->zoneType[i], m, e, pLoop->bypassAllowed[i]);
+
+    for (int kp=0; kp < MAX_KEYPADS; kp++)
+    {
+        if ((keypadMask >> kp) & 0x1)
+            keypadOwner[kp] = this;
+        else if (keypadOwner[kp] == this)
+            keypadOwner[kp] = NULL;
+    }
+
+    int newSiren = pConfig->getOutput("SIREN");  // gpio pin for siren output
+    if (sirenGpioPin >= 0 && sirenGpioPin != newSiren)
+    {
+        digitalWrite(sirenGpioPin, 0);  // siren moved or removed, silence the old pin
+    }
+    sirenGpioPin = newSiren;
+}
+
+// journal an event of this partition
+void AlarmManager::logEvent(uint8_t type, uint8_t zone, uint8_t user)
+{
+    pJournal->logEvent(type, zone, user, armed, partIdx);
+}
+
+// save the state of this partition for a restart to resume (see ArmStore)
+void AlarmManager::saveState(void)
+{
+    if (pStore == NULL)
+        return;
+
+    t_ArmPart s;
+    memset(&s, 0, sizeof(s));
+    s.layoutHash = layoutHash;
+    s.state      = state;
+    s.mode       = mode;
+    s.chime      = chime;
+    s.loopMask   = loopMask;
+    s.timerMs    = STATE_INFO[state].timer ? min(Clock::ms() - timeoutStart, (uint64_t)DEFAULT_TIMEOUT_MS) : 0;
+    pStore->save(partIdx, &s);
+}
+
+// continue in the state saved by the previous run, which went down downMs ago.  An exit or entry
+//   delay goes on with what remained of it and loops that changed while down react at the first
+//   checkLoops.  Nothing is journaled or alerted again, that was done when the state was entered
+void AlarmManager::resume(const t_ArmPart * pSaved, uint64_t downMs)
+{
+    inputTrace.resume(partIdx, pSaved, downMs);
+    chime = pSaved->chime != 0;
+
+    if (pSaved->state > ST_DISARMED && pSaved->state < ST_COUNT && pSaved->mode < ZMODE_COUNT)
+    {
+        const t_StateInfo * info = &STATE_INFO[pSaved->state];
+
+        state    = pSaved->state;
+        mode     = (info->mode != ZMODE_KEEP) ? info->mode : pSaved->mode;  // alarm keeps the mode it tripped in
+        armed    = (mode == ZMODE_EXIT) ? (uint8_t)ARMED_AWAY : mode;
+        loopMask = pSaved->loopMask & partLoopMask;
+        shownLoop = nextOpenLoop(-1);
+        if (info->tone != TONE_KEEP)
+            setTone(info->tone);  // siren sounds again
+        INFO_MSG(LOG_CAT_ALARM, "resumed %s after %llu ms down\n", info->name, (unsigned long long)downMs);
+        if (info->timer)
+        {
+            uint64_t ms = Clock::ms();
+            timeoutStart  = ms - min(pSaved->timerMs + downMs, (uint64_t)DEFAULT_TIMEOUT_MS);
+            timeoutRemain = 0xFF;  // countdown tone is set now, a delay that ran out while down ends now
+            processTimeouts(ms);
+        }
+    }
+    updateState();
+}
+
+// pass a keys message to the partition of the keypad that sent it.  Returns: that partition, NULL if
+//   the keypad is in no partition
+AlarmManager * AlarmManager::dispatchKeyMsg(const char * buf, int bufLen)
+{
+    inputTrace.keys(buf, bufLen);  // every source comes through here
+
+    int keypad = (bufLen > 7) ? atoi(buf+5) - 16 : 0;
+    AlarmManager * pOwner = (keypad >= 0 && keypad < MAX_KEYPADS) ? keypadOwner[keypad] : NULL;
+
+    if (pOwner == NULL)
+    {
+        ERR_MSG(LOG_CAT_SERIAL, "keys from keypad %d, which is in no partition\n", keypad + 16);
+        return NULL;
+    }
+    pOwner->processKeyMsg(buf, bufLen);
+    return pOwner;
 }
 
 void AlarmManager::turnOnBacklight(void)
 {
     backlight = true;
-    backlightOnTime = getTimestamp();
+    backlightOnTime = Clock::ms();
 }
 
 void AlarmManager::setLastMsgTime(void)
 {
-    lastMsgTime = getTimestamp();
+    lastMsgTime = Clock::ms();
 }
 
 // add a digit to the received pin code from keypad. Return: true if pin digit received
-bool AlarmManager::setPinDigit(int keypad, uint8_t digit, uint32_t ms)
+bool AlarmManager::setPinDigit(int keypad, uint8_t digit, uint64_t ms)
 {
     lastPinRecv = ms;   // set timestamp of last pin received
 
@@ -128,7 +295,7 @@ bool AlarmManager::setPinDigit(int keypad, uint8_t digit, uint32_t ms)
 }
 
 // check to see if it is time to timeout pin code.  Return: true if pin is timed out
-bool AlarmManager::checkPinTimeout(uint32_t ms)
+bool AlarmManager::checkPinTimeout(uint64_t ms)
 {
     if (getPinDigits() > 0 && ms - lastPinRecv > PIN_TIMEOUT)  // if no pin entered for N secs, timeout pin
     {
@@ -165,9 +332,9 @@ bool AlarmManager::pinPrompt(void)
 
     if (dig == 0)
     {
-        if (armTimeoutActive)
+        if (state == ST_EXIT_DELAY)
             sprintf(line2, "Leave now %02d sec", timeoutRemain);
-        else if (disarmTimeoutActive)
+        else if (state == ST_ENTRY_DELAY)
             sprintf(line2, "Enter pin %02d sec", timeoutRemain);
         else
             sprintf(line2, "Enter pin       ");
@@ -175,7 +342,7 @@ bool AlarmManager::pinPrompt(void)
 
     if (dig > 0)
     {
-        if (armTimeoutActive || disarmTimeoutActive)
+        if (STATE_INFO[state].timer)
             sprintf(line2, "          %02d sec", timeoutRemain);
         else
             sprintf(line2, "                ");
@@ -189,128 +356,215 @@ bool AlarmManager::pinPrompt(void)
     return false;
 }
 
-// set alarm condition
-void AlarmManager::setAlarm(void)
+// apply event to the state machine (see AlarmStates.h): one table lookup, then the exit action of
+//   the current state and the entry action of the next.  zone/user identify what caused an alarm,
+//   if known.  Returns: false if the event is ignored in the current state
+bool AlarmManager::fire(uint8_t event, uint8_t zone, uint8_t user)
 {
-    alarm = true;
-    ready = false;
-    setTone(TONE_ALARM);
-    sprintf(line1, "Alarm!          ");
-    if (!pinPrompt())
-        sprintf(line2, "Enter pin       ");
+    uint8_t next = STATE_TABLE[state][event];
+
+    if (next == ST_SAME)
+        return false;
+
+    if (STATE_INFO[state].quietExit)  // delay countdown or siren
+        setTone(TONE_NONE);
+    DEBUG_MSG(LOG_CAT_ALARM, "state %s -> %s\n", STATE_INFO[state].name, STATE_INFO[next].name);
+    state = next;
+    enterState(zone, user);
+    saveState();  // synced before the keypad or anyone else sees the new state
+    return true;
 }
 
-// set disarmed condition
-void AlarmManager::setDisarm(void)
+// entry action of the state just entered
+void AlarmManager::enterState(uint8_t zone, uint8_t user)
 {
-    alarm = false;
-    armed = DISARMED;
-    armTimeoutActive = false;
-    disarmTimeoutActive = false;
-    setTone(TONE_NONE);
+    const t_StateInfo * info = &STATE_INFO[state];
+
+    if (info->mode != ZMODE_KEEP)
+    {
+        mode  = info->mode;
+        armed = (mode == ZMODE_EXIT) ? (uint8_t)ARMED_AWAY : mode;  // ZMODE_* match the armed values
+    }
+    if (info->tone != TONE_KEEP)
+        setTone(info->tone);
+    if (info->timer)
+    {
+        timeoutStart = Clock::ms();
+        timeoutRemain = DEFAULT_TIMEOUT_MS / 1000;
+    }
+
+    switch (info->action)
+    {
+        case SA_ALARM:
+            logEvent(EVENT_ALARM, zone, user);
+            break;
+
+        case SA_CHECK_ZONES:  // exit delay over, an entry zone still open starts the entry delay
+            dispatchZones(loopMask, mode, ZEVENT_OPEN);
+            break;
+
+        default:
+            break;
+    }
 }
 
-// convert loop bitmask value into integer loop index
+// convert loop bitmask value into integer loop index (of the lowest set bit)
 int AlarmManager::loopIndex(uint32_t mask)
 {
-    if (mask != 0)
+    return (mask != 0) ? __builtin_ctz(mask) : 0;
+}
+
+// apply the compiled zone action for event in mode to each loop in mask, as state machine events.
+//   Entry delays start first, so a follower zone that changed in the same sample as an entry zone
+//   follows it
+void AlarmManager::dispatchZones(uint32_t mask, uint8_t mode, uint8_t event)
+{
+    static const char * modeName[ZMODE_COUNT] = { "disarmed", "armed-stay set", "armed-away set", "armed-bypass set", "arming" };
+    char msg[ALERT_MSG_SIZE];
+
+    for (uint32_t m = mask; m != 0; m &= m - 1)
     {
-        for (int i=0; i < loopCount; i++)
+        if (zoneAction[loopIndex(m)][mode][event] == ZA_ENTRY_DELAY)
+            fire(EV_ENTRY);
+    }
+    for (uint32_t m = mask; m != 0; m &= m - 1)
+    {
+        int i = loopIndex(m);
+        uint8_t action = zoneAction[i][mode][event];
+
+        if (action == ZA_FOLLOW || action == ZA_ALARM || action == ZA_PANIC)
         {
-            if ((mask >> i) & 0x1)
+            // an ignored event (follower inside the entry delay, alarm already sounding) sends no alert
+            if (fire(action == ZA_FOLLOW ? EV_FOLLOW : EV_TRIP, i))
             {
-                return i;
+                if (action == ZA_PANIC)
+                    snprintf(msg, sizeof(msg), "Panic! %s", pLoop->name[i]);
+                else
+                    snprintf(msg, sizeof(msg), "Alarm! %s opened while %s", pLoop->name[i], modeName[mode]);
+                sendAlertMsg(msg);
             }
         }
+        else if (action == ZA_BYPASSED)
+        {
+            INFO_MSG(LOG_CAT_ALARM, "Bypass loop %s opened while alarm set\n", pLoop->name[i]);
+        }
     }
-    return 0;
 }
 
 // send alert message to email/sms address about alarm state
 void AlarmManager::sendAlertMsg(const char * msg)
 {
-    uint32_t ms = getTimestamp();
+    uint64_t ms = Clock::ms();
 
     // only send alert mesg if it is unique or timeout has passed since last repeat of message
     if (strcmp(lastAlertMsg, msg) != 0 || ms - lastAlertTime > ALERT_MSG_REPEAT_TIMEOUT)
     {
-        sendEmail(pConfig->getSendEmailAccnt(), pConfig->getAlertEmail(), pConfig->getSendEmailPasswd(),
-            "Alarm update", msg);
+        char text[ALERT_MSG_SIZE];
+        snprintf(text, sizeof(text), "%s%s%s", partName, partName[0] != '\0' ? ": " : "", msg);  // say which partition
+        if (sendEmail(pConfig->getSendEmailAccnt(), pConfig->getAlertEmail(), pConfig->getSendEmailPasswd(),
+            "Alarm update", text))
+            alarmStats.alertsSent++;
+        else
+            alarmStats.alertFailures++;
         strcpy(lastAlertMsg, msg);
         lastAlertTime = ms;
     }
 }
 
-// update keypad display with message about open loops
+// update keypad display with message about open loops.  One open loop is shown at a time,
+//   scrollOpenLoops steps through them when several are open
 void AlarmManager::displayOpenLoops(void)
 {
-    int firstLoop  = -1;
-    int secondLoop = -1;
-
-    for (int i=0; i < loopCount; i++)
+    if (shownLoop > -1)
     {
-        if (loopMask & (1 << i))
-        {
-            if (firstLoop == -1)   // first loop not set, set it
-            {
-                firstLoop = i;
-            }
-            else  // first loop set, set second loop and break
-            {
-                secondLoop = i;
-                break;
-            }
-        }
+        strcpy(line2, pLoop->faultText[shownLoop]);
+        loopsShown = true;
     }
-    if (firstLoop > -1)  // first open loop set
+}
+
+// show the next open loop once the shown one has been up for ZONE_SCROLL_MS.  Called each main
+//   loop pass, the keypad gets the new line2 as a normal F7 msg.  Returns: true if line2 changed
+bool AlarmManager::scrollOpenLoops(uint64_t ms)
+{
+    if (!loopsShown || state != ST_DISARMED || tmpTextActive || getPinDigits() > 0 || (loopMask & (loopMask - 1)) == 0)
     {
-        sprintf(line2, "x %-14s", (pLoop+firstLoop)->name);
+        return false;  // not showing several open loops
     }
-    if (secondLoop > -1) // two or more open loops
+    if (ms - shownLoopTime < (uint64_t)pConfig->getZoneScrollMs())
     {
-        strcpy(altLine1, line1);
-        sprintf(altLine2, "x %-14s", (pLoop+secondLoop)->name);
-        altTextActive = true;
+        return false;
     }
+    shownLoop = nextOpenLoop(shownLoop);
+    shownLoopTime = ms;
+    dirty |= DIRTY_LINES;  // no updateState, scrolling leaves the backlight alone
+    return true;
 }
 
-// update the alarm state
-void AlarmManager::updateState(void)
+// index of the first open loop after idx, wrapping round to the lowest.  Returns: -1 if no loop is open
+int AlarmManager::nextOpenLoop(int idx)
 {
-    char msg[ALERT_MSG_SIZE];
-    altTextActive = false;     // default alternate F7 msg to off
-    int openLoop = loopIndex(loopMask);
+    uint32_t after = (idx < 0) ? loopMask : loopMask & (0xFFFFFFFEu << idx);
 
-    ready = (loopMask == 0); // all loops are closed, ready for arming
+    if (after == 0)
+        after = loopMask;
+    return (after != 0) ? loopIndex(after) : -1;
+}
 
-    if (alarm)                                 // alarm is going off!
-    {
-        setAlarm();  // set alarm state 
-    }
-    else if (armed == ARMED_STAY && loopMask)
+// mark display fields as changed, the lines are rendered when next read (see render)
+void AlarmManager::updateState(uint8_t fields)
+{
+    dirty |= fields;
+    turnOnBacklight();   // updating F7 message, turn on LCD backlight
+}
+
+// bring the lines up to date with the fields changed since the last render.  A countdown tick or
+//   another pin digit is patched into line2, anything else renders the lines from scratch
+void AlarmManager::render(void)
+{
+    if (dirty == 0)
+        return;
+
+    uint8_t dig = min(getPinDigits(), 9);
+    if ((dirty & DIRTY_LINES) || state != renderedState || (dig == 0) != (renderedDigits == 0))
     {
-        // alarm should be going off, loop opened while in ARMED_STAY
-        sprintf(msg, "Alarm! %s opened while armed-stay set", (pLoop+openLoop)->name);
-        sendAlertMsg(msg);
-        setAlarm();  // set alarm state 
+        renderLines();
     }
-    else if (armed == ARMED_BYPASS && loopMask)
+    else  // line2 was laid out by pinPrompt or the countdown, see there
     {
-        if ((pLoop+openLoop)->bypassAllowed == false)
+        if (dig > 0)
         {
-            // alarm should be going off, non-bypass loop opened while in ARMED_BYPASS
-            sprintf(msg, "Alarm! %s opened while armed-bypass set", (pLoop+openLoop)->name);
-            sendAlertMsg(msg);
-            setAlarm();  // set alarm state 
+            for (int i=0; i < 9; i++)
+                line2[i] = i < dig ? '*' : ' ';
         }
-        else
+        if (STATE_INFO[state].timer && (dig > 0 || state == ST_EXIT_DELAY))  // countdown shown, see renderLines
         {
-             logMsg(LOG_DEFAULT, "Bypass loop %s opened while alarm set\n", (pLoop+openLoop)->name);
+            line2[10] = '0' + timeoutRemain / 10;
+            line2[11] = '0' + timeoutRemain % 10;
         }
     }
+    renderedState = state;
+    renderedDigits = dig;
+    dirty = 0;
+}
+
+// render the keypad lines for the current state
+void AlarmManager::renderLines(void)
+{
+    bool wasShown = loopsShown;
+    loopsShown = false;
+
+    ready = (loopMask == 0); // all loops are closed, ready for arming
+
+    if (state == ST_ALARM)                     // alarm is going off!
+    {
+        ready = false;
+        sprintf(line1, "Alarm!          ");
+        if (!pinPrompt())
+            sprintf(line2, "Enter pin       ");
+    }
     else if (armed != DISARMED) // system is armed (or arm delay)
     {
-        if (armTimeoutActive)   // system is in arm delay mode
+        if (state == ST_EXIT_DELAY)   // system is in arm delay mode
         {
             sprintf(line1, "Arming          ");
             if (!pinPrompt())
@@ -319,25 +573,6 @@ void AlarmManager::updateState(void)
         else // armed, not in leave delay 
         {
             sprintf(line1, "Armed %s      ", armed == ARMED_STAY ? "Stay" : armed == ARMED_AWAY ? "Away" : "Byps");
-
-            if (loopMask && armed == ARMED_AWAY && !disarmTimeoutActive)
-            {
-                // a loop opened while in armedAway mode and disarmTimeout not yet active
-                int openLoop = loopIndex(loopMask);
-
-                if ((pLoop+openLoop)->entryAllowed)  // this zone permitted for delayed alarm entry
-                {
-                    disarmTimeoutActive = true;
-                    timeoutRemain = DEFAULT_TIMEOUT_MS / 1000;
-                    timeoutStart = getTimestamp();
-                }
-                else  // a zone unauthorized for entry opened, immediate alarm
-                {
-                    sprintf(msg, "Alarm! %s opened while armed-away set", (pLoop+openLoop)->name);
-                    sendAlertMsg(msg);
-                    setAlarm();
-                }
-            }
             if (!pinPrompt())
                 sprintf(line2, "Enter pin       ");
         }
@@ -366,116 +601,107 @@ void AlarmManager::updateState(void)
             }
         }
     }
-    turnOnBacklight();   // updating F7 message, turn on LCD backlight
+    if (loopsShown && !wasShown)  // display came back to the open loops, show this one a full period
+        shownLoopTime = Clock::ms();
 }
 
-// read the sense loops.  Returns: 32-bit loop mask 
-uint32_t AlarmManager::readLoops(void)
+// pick the partition's loops out of the sampled loop mask (see SenseLoops) and update the alarm state
+//   if one of them changed.  Only the partition's own loops are looked at.  Returns: true if message
+//   should be pushed to keypad
+bool AlarmManager::checkLoops(uint32_t loops, uint32_t noise)
 {
-    uint32_t loops = 0;
+    if (noise & journalMask)
+        logEvent(EVENT_LOOP_NOISE, loopIndex(noise & journalMask), JOURNAL_NONE);
 
-    // read the sense loop state by doing a digital read of associated GPIO pin (high => open loop)
-    for (int i=0; i < loopCount; i++)
-    {
-        if (digitalRead((pLoop+i)->gpio))
-        {
-            loops |= (1 << i);
-        }
-    }
-    return loops;
-}
+    uint32_t diffMask = (loops & partLoopMask) ^ loopMask;  // use exclusive or to determine which bits have changed state
 
-// check the sense loops and update alarm state if needed.  Returns: true if message should be pushed to keypad
-bool AlarmManager::checkLoops(uint32_t * prevLoopMask)
-{
-    uint32_t sampleLoop = readLoops();        // sample loops
-
-    if ((sampleLoop ^ *prevLoopMask) != 0)  // if a bit in the loop mask changed
+    if (diffMask != 0)  // at least one of the loops changed state
     {
-        bool loopNoise = false;
-        uint32_t loopVal;
-
-        uint32_t start = getTimestamp();
-        uint32_t now;
-        uint32_t count = 0;
-
-        // start a tight loop for 400 ms to make sure this is a real loop change and not noise
-        while (((now = getTimestamp()) - start) < 400)
+        loopMask ^= diffMask;
+        for (uint32_t m = diffMask & journalMask; m != 0; m &= m - 1)  // journal every loop that changed, not just the first
         {
-            if (sampleLoop != (loopVal = readLoops()))
-            {
-                loopNoise = true; // loop state is not stable, ignore for now
-                break;
-            }
-            count++;
+            int i = loopIndex(m);
+            logEvent(((loopMask >> i) & 0x1) ? EVENT_LOOP_OPEN : EVENT_LOOP_CLOSE, i, JOURNAL_NONE);
         }
-
-        if (loopNoise)
+        if (shownLoop < 0 || ((loopMask >> shownLoop) & 0x1) == 0)  // shown loop closed, show the next open one
         {
-            int idx = loopIndex(sampleLoop ^ *prevLoopMask);
-            logMsg(LOG_DEBUG_1, "noise: loop %s %s only %ums, count %u\n", (pLoop+idx)->name, 
-                ((sampleLoop >> idx) & 0x1) ? "opened" : "closed", now - start, count);
-            return false;
+            shownLoop = nextOpenLoop(shownLoop);
+            shownLoopTime = Clock::ms();
         }
-        else
+        uint8_t m = mode;  // zones react in the mode of the sample, not of a state they trigger
+        dispatchZones(diffMask & loopMask, m, ZEVENT_OPEN);    // every changed zone reacts, not just the first
+        dispatchZones(diffMask & ~loopMask, m, ZEVENT_CLOSE);
+
+        int idx = loopIndex(diffMask);
+        if ((loopMask >> idx) & 0x1)             // loop that changed was opened
         {
-            loopMask = sampleLoop;
+            // only chime if no alarm tone currently sounding (don't override timeout or alarm tones)
+            if (chime && tone == TONE_NONE)
+            {
+                setTone(pLoop->chimeTone[idx]); // set chime for opened loop
+                chimeMsgTime = Clock::ms();   // store time of setting chime
+            }
         }
-    }
-
-    uint32_t diffMask = loopMask ^ *prevLoopMask;  // use exclusive or to determine which bits have changed state
-
-    if (diffMask != 0)  // at least one of the loops changed state
-    {
-         int idx = loopIndex(diffMask);
-         if ((loopMask >> idx) & 0x1)             // loop that changed was opened
-         {
-             // only chime if no alarm tone currently sounding (don't override timeout or alarm tones)
-             if (chime && tone == TONE_NONE)
-             {
-                 setTone((pLoop+idx)->chimeTone); // set chime for opened loop
-                 chimeMsgTime = getTimestamp();   // store time of setting chime
-             }
-             logMsg(LOG_DEFAULT, "Loop %s opened\n", (pLoop+idx)->name);
-         }
-         else
-             logMsg(LOG_DEFAULT, "Loop %s closed\n", (pLoop+idx)->name);
 
+        if (state != ST_DISARMED)
+            saveState();  // a loop that changes back while down must not go unnoticed
         updateState(); // update alarm state
-        *prevLoopMask = loopMask;
         return true;   // send update to keypad
     }
     return false;
 }
 
+// switch to a reloaded config, keeping the armed/alarm state.  loops is the sampled loop mask,
+//   already carried over to the new loop numbering (see SenseLoops::setConfig)
+void AlarmManager::setConfig(Config * pConfig, uint32_t loops)
+{
+    loadPartition(pConfig);
+    loopMask = loops & partLoopMask;
+    shownLoop = nextOpenLoop(-1);  // loops may be renumbered
+    shownLoopTime = Clock::ms();
+
+    setTone(tone);  // drive the new siren pin if the alarm is sounding
+    clearPin();     // a pin being entered may now belong to a different user index
+    saveState();    // loops may be renumbered
+    updateState();
+    INFO_MSG(LOG_CAT_ALARM, "config reloaded, partition '%s' %d loops, %d users\n", partName,
+        __builtin_popcount(partLoopMask), userCount);
+}
+
 void AlarmManager::setTone(uint8_t toneVal)
 {
     tone = toneVal;
 
+    bool on = (tone == TONE_ALARM);
+    if (on != sirenOn)  // siren is shared, it sounds while any partition has it on
+    {
+        sirenOn = on;
+        sirenOnCount += on ? 1 : -1;
+    }
     if (sirenGpioPin >= 0)
     {
-        digitalWrite(sirenGpioPin, tone == TONE_ALARM ? 1 : 0);
+        digitalWrite(sirenGpioPin, sirenOnCount > 0 ? 1 : 0);
     }
 }
 
 // check all the timeout conditions.  Returns: true if message should be pushed to keypad
 bool AlarmManager::checkTimeouts(void)
 {
-    uint32_t ms = getTimestamp();
+    uint64_t ms = Clock::ms();
     bool updateKeypad = false;
 
-    if (armTimeoutActive || disarmTimeoutActive) // arm or disarm timeout is active
+    if (STATE_INFO[state].timer) // exit or entry delay is running
     {
         if (processTimeouts(ms))
         {
-            updateState();
+            updateState(DIRTY_SECS);  // a delay that ran out changed state, see render
             updateKeypad = true;
         }
     }
     else if (backlight && ms - backlightOnTime > BACKLIGHT_ON_TIME)  // time to turn off backlight
     {
-        //logMsg(LOG_DEFAULT, "backlight turned off: curr ms %u, backlightOnTime %u, diff %u\n", ms, 
-        //    backlightOnTime, ms - backlightOnTime);
+        TRACE_MSG(LOG_CAT_ALARM, "backlight turned off: curr ms %llu, backlightOnTime %llu, diff %llu\n",
+            (unsigned long long)ms, (unsigned long long)backlightOnTime, (unsigned long long)(ms - backlightOnTime));
         backlight = false;
         updateKeypad = true;
     }
@@ -496,17 +722,22 @@ bool AlarmManager::checkTimeouts(void)
         updateKeypad = true;
     }
 
+    if (scrollOpenLoops(ms)) // several loops open, time to show the next one
+    {
+        updateKeypad = true;
+    }
+
     if (checkPinTimeout(ms)) // check if it is time to time-out partial pin code
     {
         //printf("pincode timed out\n");
-        updateState(); // update F7 msg
+        updateState(DIRTY_PIN); // update F7 msg
         updateKeypad = true;
     }
     return updateKeypad;
 }
 
 // process arm/disarm timeouts.  Returns: true if message should be pushed to keypad
-bool AlarmManager::processTimeouts(const uint32_t ms)
+bool AlarmManager::processTimeouts(const uint64_t ms)
 {
     int tRemain;
     if (ms - timeoutStart >= DEFAULT_TIMEOUT_MS)  // timeout expired
@@ -515,7 +746,7 @@ bool AlarmManager::processTimeouts(const uint32_t ms)
     }
     else
     {
-        tRemain = (DEFAULT_TIMEOUT_MS - (ms - timeoutStart)) / 1000;  // secs that remain
+        tRemain = (int)(DEFAULT_TIMEOUT_MS - (ms - timeoutStart)) / 1000;  // secs that remain
     }
 
     if (tRemain != timeoutRemain)  // number of seconds remaining has changed
@@ -528,32 +759,15 @@ bool AlarmManager::processTimeouts(const uint32_t ms)
         {
             setTone(TONE_FAST_RATE);
         }
-        else // tRemain is zero
+        timeoutRemain = tRemain;
+        if (tRemain == 0)
         {
-            if (armTimeoutActive)
-            {
-                armTimeoutActive = false;
-                if (loopMask != 0)  // a loop was open when the arm timeout expired, this is an alarm
-                {
-                    char msg[ALERT_MSG_SIZE];
-                    int openLoop = loopIndex(loopMask);
-                    sprintf(msg, "Alarm! %s open when arm timeout expired", (pLoop+openLoop)->name);
-                    sendAlertMsg(msg);
-                    alarm = true;  // disarm timeout expired without disarm
-                }
-                else
-                {
-                    setTone(TONE_NONE);
-                }
-            }
-            else  // disarmTimeout
-            {
+            // exit delay: armed away.  Entry delay: pin not entered in time, alarm
+            bool entry = (state == ST_ENTRY_DELAY);
+            fire(EV_TIMEOUT, loopIndex(loopMask));
+            if (entry)
                 sendAlertMsg("Alarm! pin not entered before disarm timeout");
-                disarmTimeoutActive = false;
-                alarm = true;  // disarm timeout expired without disarm
-            }
         }
-        timeoutRemain = tRemain;
         return true;
     }
     return false;
@@ -573,7 +787,8 @@ void AlarmManager::clearPin(void)
 // set an temporary keypad LCD message that expires after TEMP_MSG_TIMEOUT ms
 void AlarmManager::setTempMsg(const char * s1, const char * s2)
 {
-    tmpMsgTime = getTimestamp();
+    render();  // lines re-used below must be current
+    tmpMsgTime = Clock::ms();
 
     if (s1 != NULL)
         sprintf(tempLine1, "%-16.16s", s1);
@@ -586,6 +801,7 @@ void AlarmManager::setTempMsg(const char * s1, const char * s2)
         strcpy(tempLine2, line2);  // re-use existing line2
 
     tmpTextActive = true;
+    dirty |= DIRTY_LINES;
 }
 
 // attempt to validate a provided pin.  If pin verifies, provide index of validated user and desired function
@@ -596,15 +812,16 @@ int AlarmManager::validatePin(uint8_t * func)
         // must receive MIN_PIN_DIGITS + FUNC key before we consider entered pin
         if (pinDigits[kp] > MIN_PIN_DIGITS)
         {
-            for (int user=0; user < userCount; user++)
+            for (int u=0; u < userCount; u++)
             {
+                int user = pUser[u];  // only the partition's users
                 // check if length of pin (minus func key at end) matches
-                if ((int)strlen((pPin+user)->pin) == pinDigits[kp]-1)
+                if ((int)strlen(pPin->pin[user]) == pinDigits[kp]-1)
                 {
                     bool match = true;  // compare digits up until a mismatch
                     for (int d=0; match && d < pinDigits[kp]-1; d++)
                     {
-                        if (pinCode[kp][d] > 9 || pinCode[kp][d] != *((pPin+user)->pin + d) - '0')
+                        if (pinCode[kp][d] > 9 || pinCode[kp][d] != *(pPin->pin[user] + d) - '0')
                             match = false;  // a digit in the pin failed to match
                     }
                     if (match)  // all tested digits match
@@ -622,15 +839,68 @@ int AlarmManager::validatePin(uint8_t * func)
     return -1;  // pin does not validate
 }
 
+// arm the alarm in mode (ARMED_*) on behalf of who (user is the pin index, JOURNAL_NONE if not a keypad user).
+//   Returns: false if already armed or a sense loop is open
+bool AlarmManager::arm(uint8_t mode, const char * who, uint8_t user)
+{
+    char msg[ALERT_MSG_SIZE];
+
+    uint8_t event = (mode == ARMED_AWAY) ? EV_ARM_AWAY : (mode == ARMED_STAY) ? EV_ARM_STAY : EV_ARM_BYPASS;
+
+    if (STATE_TABLE[state][event] == ST_SAME)  // already armed
+    {
+        return false;
+    }
+    if (loopMask != 0)  // all loops must be closed for arming
+    {
+        INFO_MSG(LOG_CAT_ALARM, "attempt to arm failed. Sense loop fault.  loopmask = 0x%08x\n", loopMask);
+        return false;
+    }
+
+    if (mode == ARMED_AWAY)
+    {
+        snprintf(msg, sizeof(msg), "Alarm armed-away by %s", who);
+    }
+    else if (mode == ARMED_STAY)
+    {
+        snprintf(msg, sizeof(msg), "Alarm armed-stay by %s", who);
+    }
+    else  // mode == ARMED_BYPASS
+    {
+        snprintf(msg, sizeof(msg), "Alarm armed-bypass by %s", who);
+        mode = ARMED_BYPASS;
+    }
+    fire(event);
+    logEvent(mode == ARMED_AWAY ? EVENT_ARM_AWAY : mode == ARMED_STAY ? EVENT_ARM_STAY : EVENT_ARM_BYPASS,
+        JOURNAL_NONE, user);
+    sendAlertMsg(msg);
+    updateState();
+    return true;
+}
+
+// disarm the alarm (and silence it) on behalf of who (user is the pin index, JOURNAL_NONE if not a keypad user)
+void AlarmManager::disarm(const char * who, uint8_t user)
+{
+    char msg[ALERT_MSG_SIZE];
+
+    fire(EV_DISARM);  // from any state, see StateDisarms
+    logEvent(EVENT_DISARM, JOURNAL_NONE, user);
+    snprintf(msg, sizeof(msg), "Alarm disarmed by %s", who);
+    sendAlertMsg(msg);
+    INFO_MSG(LOG_CAT_ALARM, "%s\n", msg);
+    updateState();
+}
+
 // process a keys message from keypad
 void AlarmManager::processKeyMsg(const char * buf, int bufLen)
 {
-    uint32_t ms = getTimestamp();
+    uint64_t ms = Clock::ms();
     if (bufLen < 12)
     {
-        logMsg(LOG_DEFAULT, "processKeyMsg received short command\n");
+        ERR_MSG(LOG_CAT_SERIAL, "processKeyMsg received short command\n");
         return;
     }
+    alarmStats.keyMsgs++;
 
     // grab the key data from the message string
     // format of msg is: KEYS_XX[N] key0 key1 ... keyN-1, where XX is keypad number, N is key count
@@ -640,7 +910,7 @@ void AlarmManager::processKeyMsg(const char * buf, int bufLen)
     int keyCount = min(atoi(buf+8), MAX_PIN_DIGITS);
     int offset = 12;  // offset to first key value
 
-    //logMsg(LOG_DEFAULT, "processing KEYS msg from keypad %d with %d keys\n", keypad, keyCount);
+    TRACE_MSG(LOG_CAT_SERIAL, "processing KEYS msg from keypad %d with %d keys\n", keypad, keyCount);
 
     for (int i=0; i < keyCount && offset < bufLen && *(buf+offset) == '0'; i++)  // parse pressed keys
     {
@@ -653,52 +923,25 @@ void AlarmManager::processKeyMsg(const char * buf, int bufLen)
 
     uint8_t func;
     int user = validatePin(&func);
+    uint8_t journalUser = user < JOURNAL_NONE ? user : JOURNAL_NONE;  // journal records users as a byte
 
     if (user >= 0)  // valid pin recv from user
     {
         char msg[ALERT_MSG_SIZE];
         if (func == PIN_FUNC_DISARM)
         {
-            setDisarm();
-            sprintf(msg, "Alarm disarmed by %s", (pPin+user)->name);
-            sendAlertMsg(msg);
-            logMsg(LOG_DEFAULT, "%s\n", msg);
+            disarm(pPin->name[user], journalUser);
         }
-        else if ((func == PIN_FUNC_AWAY || func == PIN_FUNC_STAY || func == PIN_FUNC_BYPASS) && armed == DISARMED)  // not already armed
+        else if (func == PIN_FUNC_AWAY || func == PIN_FUNC_STAY || func == PIN_FUNC_BYPASS)
         {
-            if (loopMask == 0)  // all loops are closed, ready for arming
-            {
-                if (func == PIN_FUNC_AWAY)
-                {
-                    sprintf(msg, "Alarm armed-away by %s", (pPin+user)->name);
-                    armed = ARMED_AWAY;
-                    armTimeoutActive = true;
-                    timeoutStart = getTimestamp();
-                    timeoutRemain = DEFAULT_TIMEOUT_MS / 1000;
-                }
-                else if (func == PIN_FUNC_STAY)
-                {
-                    sprintf(msg, "Alarm armed-stay by %s", (pPin+user)->name);
-                    armed = ARMED_STAY;
-                }
-                else  // func == PIN_FUNC_BYPASS
-                {
-                    sprintf(msg, "Alarm armed-bypass by %s", (pPin+user)->name);
-                    armed = ARMED_BYPASS;
-                }
-                sendAlertMsg(msg);
-            }
-            else
-            {
-                logMsg(LOG_DEFAULT, "attempt to arm failed. Sense loop fault.  loopmask = 0x%08x\n", loopMask);
-                //fprintf(stderr, "Can't arm, sense loop fault\n");
-            }
+            arm(func == PIN_FUNC_AWAY ? ARMED_AWAY : func == PIN_FUNC_STAY ? ARMED_STAY : ARMED_BYPASS, pPin->name[user], journalUser);
         }
         else if (func == PIN_FUNC_CHIME)
         {
             chime = !chime;  // toggle chime mode
+            saveState();
             setTempMsg(NULL, chime ? "Chime enabled" : "Chime disabled");
-            logMsg(LOG_DEFAULT, "%s\n", chime ? "Chime enabled" : "Chime disabled");
+            INFO_MSG(LOG_CAT_ALARM, "%s\n", chime ? "Chime enabled" : "Chime disabled");
         }
         else if (func == PIN_FUNC_TEST)  // display alarm uptime
         {
@@ -718,61 +961,134 @@ void AlarmManager::processKeyMsg(const char * buf, int bufLen)
         }
         else if (func == PIN_FUNC_INSTANT)  // immediately trigger an alarm!
         {
-            setAlarm();
-            sprintf(msg, "Instant Alarm triggered by %s", (pPin+user)->name);
+            fire(EV_TRIP, JOURNAL_NONE, journalUser);
+            snprintf(msg, sizeof(msg), "Instant Alarm triggered by %s", pPin->name[user]);
             sendAlertMsg(msg);
-            logMsg(LOG_DEFAULT, "%s\n", msg);
+            INFO_MSG(LOG_CAT_ALARM, "%s\n", msg);
         }
         else  // unsupported func NONE, MAX
         {
             setTempMsg(NULL, "Not supported");
-            logMsg(LOG_DEFAULT, "unsupported pin func %d entered by %s\n", func, (pPin+user)->name);
+            INFO_MSG(LOG_CAT_ALARM, "unsupported pin func %d entered by %s\n", func, pPin->name[user]);
         }
     }
-    updateState();  // update alarm state based on received keypad message
+    updateState(DIRTY_PIN);  // update alarm state based on received keypad message, anything besides the pin marked itself
 }
 
-// create an F7 message for the keypad (via Arduino) and store it in buf. Returns: none
-void AlarmManager::makeF7msg(char * buf, int hour, int min, bool altText)
+// create an F7 message for the keypad (via Arduino) and store it in buf.  The message is patched
+//   into the previous one, only built from scratch when the layout changes. Returns: none
+void AlarmManager::makeF7msg(char * buf, int hour, int min)
 {
-    if (altText)
+    t_F7Frame * f = &f7Frame;
+
+    render();
+    if (f->valid && tone <= 9 && hour >= 0 && hour <= 99 && min >= 0 && min <= 99)  // fields fit the template
     {
-#if 0
-        // send full parameter F7A msg
-        sprintf(buf, "F7A z=%02x t=%d c=%c r=%c a=%c s=%c p=%c b=%c 1=%-11.11s%2d:%02d 2=%-16.16s\n",
-            zone, tone, chime ? '1' : '0', ready ? '1' : '0', armed == ARMED_AWAY ? '1' : '0',
-            armed == ARMED_STAY ? '1' : '0', power ? '1' : '0', backlight ? '1' : '0',
-            altLine1, hour, tm_min, altLine2);
-#else
-        // send abbreviated F7A msg (tone always zero for alt msg)
-        sprintf(buf, "F7A t=0 c=%c r=%c a=%c b=%c 1=%-11.11s%2d:%02d 2=%-16.16s\n",
-            chime ? '1' : '0', ready ? '1' : '0', armed == DISARMED ? '0' : '1',
-            backlight ? '1' : '0', altLine1, hour, min, altLine2);
-#endif
+        char * p = f->text + f->base;
+        p[F7_TONE]      = '0' + tone;
+        p[F7_CHIME]     = chime ? '1' : '0';
+        p[F7_READY]     = ready ? '1' : '0';
+        p[F7_ARMED]     = armed == DISARMED ? '0' : '1';
+        p[F7_BACKLIGHT] = backlight ? '1' : '0';
+        patchField(p + F7_LINE1, line1, 11);
+        p[F7_HOUR]      = hour < 10 ? ' ' : '0' + hour / 10;
+        p[F7_HOUR+1]    = '0' + hour % 10;
+        p[F7_MIN]       = '0' + min / 10;
+        p[F7_MIN+1]     = '0' + min % 10;
+        patchField(p + F7_LINE2, line2, 16);
     }
     else
     {
-#if 0
-        // send full parameter F7 msg
-        sprintf(buf, "F7 z=%02x t=%d c=%c r=%c a=%c s=%c p=%c b=%c 1=%-11.11s%2d:%02d 2=%-16.16s\n",
-            zone, s->tone, 
-            chime ? '1' : '0', ready ? '1' : '0', armed == ARMED_AWAY ? '1' : '0',
-            armed == ARMED_STAY ? '1' : '0', power ? '1' : '0', backlight ? '1' : '0',
-            line1, hour, min, line2);
-#else
-        // send abbreviated F7 msg
-        sprintf(buf, "F7 t=%d c=%c r=%c a=%c b=%c 1=%-11.11s%2d:%02d 2=%-16.16s\n",
+        char kp[8] = "";
+
+        if (keypadMask != 0xFF)  // partition doesn't have every keypad, address its keypads
+            sprintf(kp, " k=%02x", keypadMask);
+
+        // abbreviated F7 msg
+        f->base = sprintf(f->text, "F7%s", kp);
+        f->len = f->base + sprintf(f->text + f->base, " t=%d c=%c r=%c a=%c b=%c 1=%-11.11s%2d:%02d 2=%-16.16s\n",
             tone, chime ? '1' : '0', ready ? '1' : '0', armed == DISARMED ? '0' : '1',
             backlight ? '1' : '0', line1, hour, min, line2);
-#endif
+        f->valid = (f->len == f->base + F7_END);
     }
+    memcpy(buf, f->text, f->len + 1);
 }
 
 const char * AlarmManager::getSockMsg(int hour, int min)
 {
     static char buf[64];
-    sprintf(buf, "%c%c%-11.11s%2d:%02d~%-16.16s", ready ? 'R' : 'r', armed == DISARMED ? 'a' : 'A', 
+    render();
+    sprintf(buf, "%c%c%-11.11s%2d:%02d~%-16.16s\n", ready ? 'R' : 'r', armed == DISARMED ? 'a' : 'A', 
         line1, hour, min, line2);
     return buf;
 }
 
+// capture the current state, bumping the version if it differs from the last published state.
+//   Returns: true if state changed
+bool AlarmManager::publishState(void)
+{
+    t_AlarmState next;
+    const t_AlarmState * prev = getState();
+
+    render();
+    memset(&next, 0, sizeof(next));  // clear padding, states are compared with memcmp
+    next.version  = stateVersion;
+    next.loopMask = loopMask;
+    next.armed    = armed;
+    next.tone     = tone;
+    next.ready    = ready;
+    next.alarm    = (state == ST_ALARM);
+    next.chime    = chime;
+    next.power    = power;
+    strcpy(next.line1, line1);
+    strcpy(next.line2, line2);
+
+    if (stateVersion != 0 && memcmp(&next, prev, sizeof(next)) == 0)
+        return false;
+
+    next.version = ++stateVersion;
+    stateHistory[stateVersion % STATE_HISTORY] = next;
+    return true;
+}
+
+// format a state message for a client at fromVersion: a delta holding only the changed fields if
+//   fromVersion is still in the history, otherwise a full snapshot.  Returns: message length
+int AlarmManager::formatStateMsg(char * buf, int bufSize, uint32_t fromVersion)
+{
+    const t_AlarmState * s = getState();
+    const t_AlarmState * from = NULL;
+    int len;
+
+    if (fromVersion != 0 && fromVersion <= stateVersion && stateVersion - fromVersion < STATE_HISTORY)
+        from = &stateHistory[fromVersion % STATE_HISTORY];
+
+    if (from == NULL)  // snapshot
+    {
+        return snprintf(buf, bufSize, "S e=%u v=%u a=%u r=%c x=%c c=%c p=%c t=%u z=%08x 1=%-16.16s 2=%-16.16s\n",
+            getStateEpoch(), s->version, s->armed, s->ready ? '1' : '0', s->alarm ? '1' : '0',
+            s->chime ? '1' : '0', s->power ? '1' : '0', s->tone, s->loopMask, s->line1, s->line2);
+    }
+
+    len = snprintf(buf, bufSize, "D v=%u", s->version);
+    if (s->armed != from->armed)
+        len += snprintf(buf+len, bufSize-len, " a=%u", s->armed);
+    if (s->ready != from->ready)
+        len += snprintf(buf+len, bufSize-len, " r=%c", s->ready ? '1' : '0');
+    if (s->alarm != from->alarm)
+        len += snprintf(buf+len, bufSize-len, " x=%c", s->alarm ? '1' : '0');
+    if (s->chime != from->chime)
+        len += snprintf(buf+len, bufSize-len, " c=%c", s->chime ? '1' : '0');
+    if (s->power != from->power)
+        len += snprintf(buf+len, bufSize-len, " p=%c", s->power ? '1' : '0');
+    if (s->tone != from->tone)
+        len += snprintf(buf+len, bufSize-len, " t=%u", s->tone);
+    if (s->loopMask != from->loopMask)
+        len += snprintf(buf+len, bufSize-len, " z=%08x", s->loopMask);
+    if (strcmp(s->line1, from->line1) != 0)
+        len += snprintf(buf+len, bufSize-len, " 1=%-16.16s", s->line1);
+    if (strcmp(s->line2, from->line2) != 0)
+        len += snprintf(buf+len, bufSize-len, " 2=%-16.16s", s->line2);
+    len += snprintf(buf+len, bufSize-len, "\n");
+    return len;
+}
+
@@ -18,6 +18,10 @@
 
 #include "stdafx.h"
 #include "Config.h"
+#include "EventJournal.h"
+#include "ArmStore.h"
+#include "ZoneTable.h"
+#include "AlarmStates.h"
 #include <time.h>
 
 static const int ALERT_MSG_SIZE = 256;   // max size of alert text sent as email/sms
@@ -44,6 +48,42 @@ enum {
     ARMED_BYPASS  // same as ARMED_STAY, but with a loop bypassed
 };
 
+static_assert((int)ZMODE_DISARMED == DISARMED && (int)ZMODE_STAY == ARMED_STAY && (int)ZMODE_AWAY == ARMED_AWAY &&
+    (int)ZMODE_BYPASS == ARMED_BYPASS, "zone modes are indexed by armed");
+
+static const int STATE_HISTORY = 64;    // published state versions kept for resuming clients
+
+// display fields marked by updateState, the lines are rendered when next read
+enum {
+    DIRTY_LINES = 0x1,  // anything else, lines are rendered from scratch
+    DIRTY_PIN   = 0x2,  // pin digits entered, stars are patched into line2
+    DIRTY_SECS  = 0x4   // delay countdown, seconds are patched into line2
+};
+
+static const int F7_FRAME_SIZE = 80;    // F7 message with keypad address, newline and null
+
+// last F7 message made, kept as a template that the fields are patched into
+struct t_F7Frame {
+    char text[F7_FRAME_SIZE];
+    int  base;              // length of the "F7" and keypad address prefix, fields are at fixed offsets after it
+    int  len;
+    bool valid;             // layout matches the fixed offsets
+};
+
+// published alarm state.  version increases by one each time any other field changes
+struct t_AlarmState {
+    uint32_t version;
+    uint32_t loopMask;      // open zones
+    uint8_t  armed;         // DISARMED, ARMED_*
+    uint8_t  tone;
+    bool     ready;
+    bool     alarm;
+    bool     chime;
+    bool     power;
+    char     line1[17];     // keypad LCD lines
+    char     line2[17];
+};
+
 // elapsed time struct
 struct t_ElapsedTime {
     int secs;
@@ -59,50 +99,78 @@ public:
     AlarmManager(void) {};   // constructor
     ~AlarmManager(void) {};  // destructor
 
-    void init(Config * pConfig);
+    void init(Config * pConfig, int partIdx, EventJournal * pJournal, ArmStore * pStore = NULL);
+    void fini(void);
+    void setConfig(Config * pConfig, uint32_t loops);
+    void resume(const t_ArmPart * pSaved, uint64_t downMs);
 
-    bool checkLoops(uint32_t * prevLoopMask);
+    bool checkLoops(uint32_t loops, uint32_t noise);
     bool checkTimeouts(void);
 
+    static AlarmManager * dispatchKeyMsg(const char * buf, int bufLen);
+
     void processKeyMsg(const char * buf, int bufLen);
-    void makeF7msg(char * buf, int hour, int min, bool altText);
+    bool arm(uint8_t mode, const char * who, uint8_t user = JOURNAL_NONE);
+    void disarm(const char * who, uint8_t user = JOURNAL_NONE);
+    void makeF7msg(char * buf, int hour, int min);
     void sendAlertMsg(const char * msg);
 
     const char * getSockMsg(int hour, int min);
 
-    void     setLastMsgTime(void);
-    uint32_t getLastMsgTime(void)
+    bool publishState(void);
+    int  formatStateMsg(char * buf, int bufSize, uint32_t fromVersion);
+    const t_AlarmState * getState(void)
     {
-        return lastMsgTime;
+        return &stateHistory[stateVersion % STATE_HISTORY];
+    }
+    uint32_t getStateVersion(void)
+    {
+        return stateVersion;
+    }
+    int getPartIdx(void)
+    {
+        return partIdx;
+    }
+    uint32_t getStateEpoch(void)     // identifies this run, versions restart with each run
+    {
+        return (uint32_t)startTime;
     }
 
-    bool getAltTextActive(void)
+    void     setLastMsgTime(void);
+    uint64_t getLastMsgTime(void)
     {
-        return altTextActive;
+        return lastMsgTime;
     }
 
-    static uint32_t getTimestamp(void);
     static t_ElapsedTime * elapsedTime(time_t start);
 
 private:
     uint8_t getPinDigits(int kp);
     uint8_t getPinDigits(void);
 
-    uint32_t readLoops(void);
+    void loadPartition(Config * pConfig);
+    void logEvent(uint8_t type, uint8_t zone, uint8_t user);
+    void saveState(void);
 
-    bool checkPinTimeout(uint32_t ms);
-    bool processTimeouts(uint32_t ms);
-    bool setPinDigit(int keypad, uint8_t digit, uint32_t ms);
+    bool checkPinTimeout(uint64_t ms);
+    bool processTimeouts(uint64_t ms);
+    bool setPinDigit(int keypad, uint8_t digit, uint64_t ms);
 
     void clearPin(void);
     bool pinPrompt(void);
-    void setAlarm(void);
-    void setDisarm(void);
+    bool fire(uint8_t event, uint8_t zone = JOURNAL_NONE, uint8_t user = JOURNAL_NONE);
+    void enterState(uint8_t zone, uint8_t user);
     void setTone(uint8_t val);
     void setTempMsg(const char * s1, const char * s2);
-    void updateState(void);
+    void updateState(uint8_t fields = DIRTY_LINES);
+    void render(void);
+    void renderLines(void);
     void turnOnBacklight(void);
     void displayOpenLoops(void);
+    bool scrollOpenLoops(uint64_t ms);
+    int  nextOpenLoop(int idx);
+
+    void dispatchZones(uint32_t mask, uint8_t mode, uint8_t event);
 
     int  validatePin(uint8_t * func);
     int  loopIndex(uint32_t mask);
@@ -111,42 +179,63 @@ private:
     uint8_t  tone;                                  // (nibble) 0-7 valid
     bool     chime;                                 // true - chime active
     bool     ready;                                 // true - ready LED lit
+    uint8_t  state;                                 // ST_*, see AlarmStates.h
+    uint8_t  mode;                                  // zone table mode (ZMODE_*) of the state
     uint8_t  armed;                                 // false - disarmed, othewise armed
     bool     power;                                 // true - AC power present
     bool     backlight;                             // true - LCD backlight lit
-    bool     alarm;                                 // if true, alarm is sounding
-    bool     armTimeoutActive;                      // arm delay while leaving active
-    bool     disarmTimeoutActive;                   // disarm delay while entering active
-    bool     altTextActive;                         // add alt F7 message
     bool     tmpTextActive;                         // momentary message is active
     uint8_t  pinDigits[MAX_KEYPADS];                // number of pin digits entered
     uint8_t  timeoutRemain;                         // number of seconds that remain in timeout
-    uint32_t timeoutStart;                          // ms timestamp of timeout start
-    uint32_t lastMsgTime;                           // ms timestamp of last F7 message sent
-    uint32_t backlightOnTime;                       // ms timestamp of turning on backlight
-    uint32_t lastPinRecv;                           // ms timestamp of last keypad key recv
-    uint32_t chimeMsgTime;                          // ms timestamp of msg with chime tone set
-    uint32_t tmpMsgTime;                            // ms timestamp when temp msg set
+    uint64_t timeoutStart;                          // ms timestamp of exit/entry delay start
+    uint64_t lastMsgTime;                           // ms timestamp of last F7 message sent
+    uint64_t backlightOnTime;                       // ms timestamp of turning on backlight
+    uint64_t lastPinRecv;                           // ms timestamp of last keypad key recv
+    uint64_t chimeMsgTime;                          // ms timestamp of msg with chime tone set
+    uint64_t tmpMsgTime;                            // ms timestamp when temp msg set
     uint32_t loopMask;                              // sensor loop mask
+    bool     loopsShown;                            // line2 was last rendered with an open loop
+    int      shownLoop;                             // open loop shown on line2, -1 if none
+    uint64_t shownLoopTime;                         // ms timestamp of showing it
     uint8_t  pinCode[MAX_KEYPADS][MAX_PIN_DIGITS];  // current pin code entered
     char     line1[17];                             // line1 text (16 chars + NULL)
     char     line2[17];                             // line2 text (16 chars + NULL)
-    char     altLine1[17];                          // alt line1 text (16 chars + NULL)
-    char     altLine2[17];                          // alt line2 text (16 chars + NULL)
     char     tempLine1[17];                         // momentary message line1
     char     tempLine2[17];                         // momentary message line2
+    uint8_t  dirty;                                 // DIRTY_* fields changed since the lines were rendered
+    uint8_t  renderedState;                         // state and pin digits (max 9) the lines were rendered for
+    uint8_t  renderedDigits;
+    t_F7Frame f7Frame;                              // F7 template
 
     Config * pConfig;                               // pointer to config class
 
-    Loop   * pLoop;                                 // pointer to sense loop class array
-    int      loopCount;                             // number of sense loops
-    Pin    * pPin;                                  // pointer to array of pin number classes
-    int      userCount;                             // number of user pin numbers
+    Loop   * pLoop;                                 // pointer to sense loop table
+    Pin    * pPin;                                  // pointer to user pin table
+    int    * pUser;                                 // pin indexes of the partition's users
+    int      userCount;                             // number of users in the partition
+
+    int          partIdx;                           // partition index in config
+    const char * partName;                          // partition name, empty for the default partition
+    uint32_t     partLoopMask;                      // loops in the partition
+    uint32_t     journalMask;                       // loops journaled by this partition (the first one they are in)
+    uint8_t      keypadMask;                        // keypads showing the partition, bit 0 is keypad 16
+    uint8_t      zoneAction[MAX_SENSE_LOOPS][ZMODE_COUNT][ZEVENT_COUNT];  // ZONE_TABLE compiled per loop
 
     int      sirenGpioPin;                          // gpio pin for siren output
+    bool     sirenOn;                               // this partition is sounding the siren
 
     time_t   startTime;                             // alarm init time
 
+    EventJournal * pJournal;                        // binary journal of zone/arming events, shared by partitions
+    ArmStore     * pStore;                          // armed state saved for a restart, shared by partitions (NULL if not saved)
+    uint32_t       layoutHash;                      // partition and loop names, a saved state only resumes into the same
+
+    static AlarmManager * keypadOwner[MAX_KEYPADS]; // partition of each keypad
+    static int            sirenOnCount;             // partitions sounding the siren
+
+    uint32_t     stateVersion;                      // version of newest published state
+    t_AlarmState stateHistory[STATE_HISTORY];       // published states, indexed by version % STATE_HISTORY
+
     char     lastAlertMsg[ALERT_MSG_SIZE];          // last alert msg sent
-    uint32_t lastAlertTime;
+    uint64_t lastAlertTime;
 };
@@ -0,0 +1,179 @@
+// The file AlarmStates.h is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "stdafx.h"
+#include "Config.h"
+#include "ZoneTable.h"
+
+// Arming state machine of AlarmManager.  An event is applied with one lookup in STATE_TABLE,
+// then the exit action of the old state and the entry action of the new one, both described
+// by STATE_INFO.  The checks at the end of the file reject, at compile time, a table with a
+// missing transition, an unreachable state or a state that can't be disarmed.
+
+enum {  // states
+    ST_NONE = 0,         // not a state, an entry left out of STATE_TABLE reads as this
+    ST_DISARMED,
+    ST_EXIT_DELAY,       // armed away, leaving before the delay runs out
+    ST_ARMED_STAY,
+    ST_ARMED_AWAY,
+    ST_ARMED_BYPASS,
+    ST_ENTRY_DELAY,      // armed away, pin must be entered before the delay runs out
+    ST_ALARM,            // sounding until disarmed
+    ST_COUNT,
+    ST_SAME = ST_COUNT   // event is ignored in this state
+};
+
+enum {  // events
+    EV_ARM_AWAY = 0,
+    EV_ARM_STAY,
+    EV_ARM_BYPASS,
+    EV_DISARM,
+    EV_ENTRY,            // entry zone opened (ZA_ENTRY_DELAY)
+    EV_FOLLOW,           // interior/follower zone opened (ZA_FOLLOW)
+    EV_TRIP,             // alarm zone opened, or instant alarm key (ZA_ALARM, ZA_PANIC)
+    EV_TIMEOUT,          // exit or entry delay ran out
+    EV_COUNT
+};
+
+enum {  // entry actions besides those in the STATE_INFO fields
+    SA_NONE = 0,
+    SA_ALARM,            // journal the alarm
+    SA_CHECK_ZONES,      // zones open when the exit delay ends react as if opened now
+};
+
+static const uint8_t ZMODE_KEEP = 0xFF;  // STATE_INFO mode: keep the mode of the previous state
+static const uint8_t TONE_KEEP  = 0xFF;  // STATE_INFO tone: leave the tone as it is
+
+struct t_StateInfo {
+    const char * name;   // for log messages
+    uint8_t mode;        // zone table mode (ZMODE_*) while in the state
+    uint8_t timer;       // state runs the DEFAULT_TIMEOUT_MS delay, started on entry
+    uint8_t tone;        // tone set on entry
+    uint8_t quietExit;   // tone cleared on exit (delay countdown or siren)
+    uint8_t action;      // SA_*
+};
+
+static constexpr t_StateInfo STATE_INFO[ST_COUNT] = {
+    /* ST_NONE         */ { "none",         ZMODE_KEEP,     0, TONE_KEEP,  0, SA_NONE        },
+    /* ST_DISARMED     */ { "disarmed",     ZMODE_DISARMED, 0, TONE_NONE,  0, SA_NONE        },
+    /* ST_EXIT_DELAY   */ { "exit-delay",   ZMODE_EXIT,     1, TONE_KEEP,  1, SA_NONE        },
+    /* ST_ARMED_STAY   */ { "armed-stay",   ZMODE_STAY,     0, TONE_KEEP,  0, SA_NONE        },
+    /* ST_ARMED_AWAY   */ { "armed-away",   ZMODE_AWAY,     0, TONE_KEEP,  0, SA_CHECK_ZONES },
+    /* ST_ARMED_BYPASS */ { "armed-bypass", ZMODE_BYPASS,   0, TONE_KEEP,  0, SA_NONE        },
+    /* ST_ENTRY_DELAY  */ { "entry-delay",  ZMODE_AWAY,     1, TONE_KEEP,  1, SA_NONE        },
+    /* ST_ALARM        */ { "alarm",        ZMODE_KEEP,     0, TONE_ALARM, 1, SA_ALARM       },
+};
+
+#define S ST_SAME
+
+static constexpr uint8_t STATE_TABLE[ST_COUNT][EV_COUNT] = {
+    //                       ARM_AWAY       ARM_STAY       ARM_BYPASS       DISARM       ENTRY           FOLLOW    TRIP      TIMEOUT
+    /* ST_NONE         */ {  S,             S,             S,               S,           S,              S,        S,        S             },
+    /* ST_DISARMED     */ {  ST_EXIT_DELAY, ST_ARMED_STAY, ST_ARMED_BYPASS, ST_DISARMED, S,              S,        ST_ALARM, S             },
+    /* ST_EXIT_DELAY   */ {  S,             S,             S,               ST_DISARMED, S,              S,        ST_ALARM, ST_ARMED_AWAY },
+    /* ST_ARMED_STAY   */ {  S,             S,             S,               ST_DISARMED, S,              ST_ALARM, ST_ALARM, S             },
+    /* ST_ARMED_AWAY   */ {  S,             S,             S,               ST_DISARMED, ST_ENTRY_DELAY, ST_ALARM, ST_ALARM, S             },
+    /* ST_ARMED_BYPASS */ {  S,             S,             S,               ST_DISARMED, S,              ST_ALARM, ST_ALARM, S             },
+    /* ST_ENTRY_DELAY  */ {  S,             S,             S,               ST_DISARMED, S,              S,        ST_ALARM, ST_ALARM      },
+    /* ST_ALARM        */ {  S,             S,             S,               ST_DISARMED, S,              S,        S,        S             },
+};
+
+#undef S
+
+// -------------------------------- compile time checks of STATE_TABLE --------------------------------
+
+// true if no entry of a real state was left out (reads as ST_NONE) or is out of range
+constexpr bool statesComplete(void)
+{
+    for (int s=ST_DISARMED; s < ST_COUNT; s++)
+        for (int e=0; e < EV_COUNT; e++)
+            if (STATE_TABLE[s][e] == ST_NONE || STATE_TABLE[s][e] > ST_SAME)
+                return false;
+    return true;
+}
+
+// bit mask of the states reachable from ST_DISARMED
+constexpr uint32_t statesReachable(void)
+{
+    uint32_t seen = 1 << ST_DISARMED;
+    uint32_t prev = 0;
+    while (seen != prev)
+    {
+        prev = seen;
+        for (int s=ST_DISARMED; s < ST_COUNT; s++)
+            if ((prev >> s) & 0x1)
+                for (int e=0; e < EV_COUNT; e++)
+                    if (STATE_TABLE[s][e] != ST_SAME)
+                        seen |= 1 << STATE_TABLE[s][e];
+    }
+    return seen;
+}
+
+// true if pred holds for every real state
+template <typename Pred>
+constexpr bool allStates(Pred pred)
+{
+    for (int s=ST_DISARMED; s < ST_COUNT; s++)
+        if (!pred(s))
+            return false;
+    return true;
+}
+
+struct StateDisarms {    // disarm works from every state
+    constexpr bool operator()(int s) const
+    {
+        return STATE_TABLE[s][EV_DISARM] == ST_DISARMED;
+    }
+};
+struct StateTimer {      // a delay state leaves when the delay runs out, other states have no delay
+    constexpr bool operator()(int s) const
+    {
+        return STATE_INFO[s].timer ? (STATE_TABLE[s][EV_TIMEOUT] != ST_SAME && STATE_TABLE[s][EV_TIMEOUT] != s) :
+            STATE_TABLE[s][EV_TIMEOUT] == ST_SAME;
+    }
+};
+struct StateTrips {      // an alarm zone trips every state but the alarm itself
+    constexpr bool operator()(int s) const
+    {
+        return STATE_TABLE[s][EV_TRIP] == (s == ST_ALARM ? (int)ST_SAME : (int)ST_ALARM);
+    }
+};
+struct StateArmOnce {    // arming only starts from disarmed
+    constexpr bool operator()(int s) const
+    {
+        return s == ST_DISARMED || (STATE_TABLE[s][EV_ARM_AWAY] == ST_SAME && STATE_TABLE[s][EV_ARM_STAY] == ST_SAME &&
+            STATE_TABLE[s][EV_ARM_BYPASS] == ST_SAME);
+    }
+};
+struct StateZoneMode {   // zone events only move between states the zone table allows in that mode
+    constexpr bool operator()(int s) const
+    {
+        return (STATE_TABLE[s][EV_ENTRY] == ST_SAME || STATE_INFO[s].mode == ZMODE_AWAY) &&
+            (STATE_TABLE[s][EV_FOLLOW] == ST_SAME || STATE_INFO[s].mode != ZMODE_DISARMED);
+    }
+};
+
+static_assert(statesComplete(),                  "STATE_TABLE has a missing transition");
+static_assert(statesReachable() == ((1u << ST_COUNT) - 1) - (1u << ST_NONE), "STATE_TABLE has an unreachable state");
+static_assert(allStates(StateDisarms()),         "STATE_TABLE has a state that can't be disarmed");
+static_assert(allStates(StateTimer()),           "STATE_TABLE has a delay state without a timeout");
+static_assert(allStates(StateTrips()),           "STATE_TABLE has a state an alarm zone does not trip");
+static_assert(allStates(StateArmOnce()),         "STATE_TABLE arms from a state other than disarmed");
+static_assert(allStates(StateZoneMode()),        "STATE_TABLE reacts to a zone event the zone table never sends");
+
+// end of AlarmStates.h
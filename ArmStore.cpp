@@ -0,0 +1,167 @@
+// The file ArmStore.cpp is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "stdafx.h"
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ArmStore.h"
+#include "Clock.h"
+#include "logMsg.h"
+
+static const size_t ARM_STORE_SIZE = 2 * sizeof(t_ArmRecord);
+
+// map the state file at path, creating it if needed.  Returns: true on success, the alarm
+//   then resumes from and saves to it
+bool ArmStore::init(const char * path)
+{
+    fini();
+
+    memset(bootId, 0, sizeof(bootId));
+    FILE * fp = fopen("/proc/sys/kernel/random/boot_id", "r");
+    if (fp != NULL)
+    {
+        if (fgets(bootId, sizeof(bootId), fp) == NULL)
+            bootId[0] = '\0';  // unknown boot, time down is taken from the wall clock
+        fclose(fp);
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0)
+    {
+        fprintf(stderr, "ArmStore failed to open '%s'\n", path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || ((size_t)st.st_size != ARM_STORE_SIZE && ftruncate(fd, ARM_STORE_SIZE) != 0))
+    {
+        fprintf(stderr, "ArmStore failed to size '%s'\n", path);
+        close(fd);
+        return false;
+    }
+    void * p = mmap(NULL, ARM_STORE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+    {
+        fprintf(stderr, "ArmStore failed to map '%s'\n", path);
+        return false;
+    }
+    pMap = (t_ArmRecord *)p;
+
+    if (!readRecord())
+    {
+        memset(&rec, 0, sizeof(rec));  // new file, or both slots torn: nothing to resume
+        rec.magic = ARM_STORE_MAGIC;
+        rec.layout = ARM_STORE_LAYOUT;
+    }
+    return true;
+}
+
+void ArmStore::fini(void)
+{
+    if (pMap != NULL)
+    {
+        munmap(pMap, ARM_STORE_SIZE);
+        pMap = NULL;
+    }
+}
+
+// 32-bit FNV-1a hash, hash continues a previous one
+uint32_t ArmStore::checksum(const void * buf, int len, uint32_t hash)
+{
+    const uint8_t * p = (const uint8_t *)buf;
+
+    for (int i=0; i < len; i++)
+    {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// pick the valid slot with the highest seq.  Returns: false if neither slot is valid
+bool ArmStore::readRecord(void)
+{
+    int best = -1;
+
+    for (int i=0; i < 2; i++)
+    {
+        if (pMap[i].magic == ARM_STORE_MAGIC && pMap[i].layout == ARM_STORE_LAYOUT &&
+            pMap[i].checksum == checksum(&pMap[i], offsetof(t_ArmRecord, checksum)) &&
+            (best < 0 || (int32_t)(pMap[i].seq - pMap[best].seq) > 0))
+        {
+            best = i;
+        }
+    }
+    if (best < 0)
+        return false;
+    rec = pMap[best];
+    return true;
+}
+
+// saved entry of partition partIdx, if it was saved for the same layoutHash.  *pDownMs is set to the
+//   ms since it was saved.  Returns: false if there is nothing to resume
+bool ArmStore::get(int partIdx, uint32_t layoutHash, t_ArmPart * pPart, uint64_t * pDownMs)
+{
+    if (pMap == NULL || partIdx >= ARM_STORE_PARTS)
+        return false;
+
+    const t_ArmPart * s = &rec.part[partIdx];
+    if (s->state == 0)  // ST_NONE, never saved
+        return false;
+    if (s->layoutHash != layoutHash)
+    {
+        ERR_MSG(LOG_CAT_ALARM, "saved state of partition %d is for another config, not resumed\n", partIdx);
+        return false;
+    }
+
+    *pPart = *s;
+    if (bootId[0] != '\0' && strcmp(rec.bootId, bootId) == 0)  // daemon restart, monotonic clock still runs
+    {
+        *pDownMs = Clock::ms() - s->savedMs;
+    }
+    else  // rebooted, a wall clock set back (no RTC, no NTP yet) counts as no time down
+    {
+        time_t now = Clock::wall();
+        *pDownMs = now > s->savedWall ? (uint64_t)(now - s->savedWall) * 1000 : 0;
+    }
+    return true;
+}
+
+// save the entry of partition partIdx, to the slot not holding the current record
+void ArmStore::save(int partIdx, const t_ArmPart * pPart)
+{
+    if (pMap == NULL || partIdx >= ARM_STORE_PARTS)
+        return;
+
+    t_ArmPart * s = &rec.part[partIdx];
+    *s = *pPart;
+    s->savedMs = Clock::ms();
+    s->savedWall = Clock::wall();
+    memcpy(rec.bootId, bootId, sizeof(rec.bootId));
+    rec.seq++;
+    rec.checksum = checksum(&rec, offsetof(t_ArmRecord, checksum));
+
+    memcpy(&pMap[rec.seq & 1], &rec, sizeof(rec));
+    if (msync(pMap, ARM_STORE_SIZE, MS_SYNC) != 0)  // on disk before the state is acted on, survives power loss
+        ERR_MSG(LOG_CAT_ALARM, "armed state sync failed\n");
+}
+
+// end of ArmStore.cpp
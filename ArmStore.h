@@ -0,0 +1,85 @@
+// The file ArmStore.h is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "stdafx.h"
+
+// Armed state of each partition, kept in a memory mapped file so a crash, watchdog reboot or
+// restart of the daemon resumes the alarm as it was instead of disarming the house.  A
+// partition saves its entry on every state change (and chime toggle, loop change while armed,
+// config reload) and AlarmManager::init restores it, see AlarmManager::resume.
+//
+// The file holds two record slots, written alternately and synced, so a torn write leaves the
+// other slot valid; the valid slot with the highest seq is current (as in LogRing).  The time
+// the alarm was down is measured on the monotonic clock when the boot is the same (daemon
+// restart), on the wall clock after a reboot.
+
+#define ARM_STORE_FILE  "/var/lib/alarmArmState"
+
+static const uint32_t ARM_STORE_MAGIC  = 0x53524d41;  // "AMRS"
+static const uint32_t ARM_STORE_LAYOUT = 1;           // bump when t_ArmRecord changes
+static const int      ARM_STORE_PARTS  = 16;          // partitions saved, later ones always start disarmed
+static const int      BOOT_ID_SIZE     = 40;          // /proc/sys/kernel/random/boot_id, 36 chars
+
+struct t_ArmPart {
+    uint32_t layoutHash;    // hash of the partition name and its loop names, saved for another config is not restored
+    uint8_t  state;         // ST_*, ST_NONE if never saved
+    uint8_t  mode;          // ZMODE_* (ST_ALARM keeps the mode it was triggered in)
+    uint8_t  chime;         // chime mode on
+    uint8_t  pad;
+    uint32_t loopMask;      // partition's loops open when saved
+    uint32_t timerMs;       // ms the exit/entry delay had run when saved
+    uint64_t savedMs;       // Clock::ms when saved
+    int64_t  savedWall;     // Clock::wall when saved
+};
+
+struct t_ArmRecord {
+    uint32_t  magic;
+    uint32_t  layout;
+    uint32_t  seq;                      // record write count, slot with the highest valid seq is current
+    uint32_t  pad;
+    char      bootId[BOOT_ID_SIZE];     // boot the record was written in
+    t_ArmPart part[ARM_STORE_PARTS];
+    uint32_t  checksum;                 // checksum of the fields above
+    uint32_t  pad2;
+};
+
+class ArmStore
+{
+public:
+    ArmStore(void)
+    {
+        pMap = NULL;
+    }
+
+    bool init(const char * path);
+    void fini(void);
+
+    bool get(int partIdx, uint32_t layoutHash, t_ArmPart * pPart, uint64_t * pDownMs);
+    void save(int partIdx, const t_ArmPart * pPart);
+
+    static uint32_t checksum(const void * buf, int len, uint32_t hash = 2166136261u);
+
+private:
+    bool readRecord(void);
+
+    t_ArmRecord * pMap;     // the two slots of the mapped file
+    t_ArmRecord   rec;      // current record
+    char          bootId[BOOT_ID_SIZE];  // this boot
+};
+
+// end of ArmStore.h
@@ -0,0 +1,87 @@
+// The file Clock.cpp is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "stdafx.h"
+#include <time.h>
+
+#include "Clock.h"
+
+#ifndef CLOCK_MONOTONIC_COARSE
+#define CLOCK_MONOTONIC_COARSE CLOCK_MONOTONIC  // pre 2.6.32 kernel, the precise clock will do
+#endif
+
+bool     Clock::virtualClock = false;
+uint64_t Clock::virtualNs = 0;
+uint64_t Clock::virtualBase = 0;
+time_t   Clock::virtualWall = 0;
+
+// returns ns since boot.  tv_sec is widened before the multiply, on the 32 bit Pi it would
+//   overflow
+uint64_t Clock::ns(void)
+{
+    if (virtualClock)
+        return virtualNs;
+
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return (uint64_t)spec.tv_sec * 1000000000 + spec.tv_nsec;
+}
+
+// returns ms since boot, at the resolution of the kernel tick
+uint64_t Clock::ms(void)
+{
+    if (virtualClock)
+        return NS_TO_MS(virtualNs);
+
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &spec);
+    return (uint64_t)spec.tv_sec * 1000 + spec.tv_nsec / 1000000;
+}
+
+// returns the wall clock time (seconds since epoch)
+time_t Clock::wall(void)
+{
+    if (virtualClock)
+        return virtualWall + (time_t)((virtualNs - virtualBase) / 1000000000);
+    return time(NULL);
+}
+
+// returns the wall clock time in ms since epoch
+uint64_t Clock::wallMs(void)
+{
+    if (virtualClock)
+        return (uint64_t)virtualWall * 1000 + NS_TO_MS(virtualNs - virtualBase);
+
+    struct timespec spec;
+    clock_gettime(CLOCK_REALTIME, &spec);
+    return (uint64_t)spec.tv_sec * 1000 + spec.tv_nsec / 1000000;
+}
+
+// switch to virtual time, set to ns since boot and wall clock time wall
+void Clock::setVirtual(uint64_t ns, time_t wall)
+{
+    virtualClock = true;
+    virtualNs = virtualBase = ns;
+    virtualWall = wall;
+}
+
+// move virtual time ahead by ns
+void Clock::advance(uint64_t ns)
+{
+    virtualNs += ns;
+}
+
+// end of Clock.cpp
@@ -0,0 +1,55 @@
+// The file Clock.h is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "stdafx.h"
+
+// Monotonic clock of the alarm: 64 bit nanoseconds since boot, which don't wrap in the life of
+// the Pi.  All timeouts are kept as 64 bit ms timestamps from ms(), the fast path: it reads
+// CLOCK_MONOTONIC_COARSE, which the kernel serves without a syscall at the resolution of its
+// tick (1-10 ms), plenty for timeouts of 100 ms and up.  ns() reads the precise clock.
+//
+// The clock can be switched to virtual time, which only moves by setVirtual() and advance().
+// alarmReplay runs the alarm core that way, and a test can jump weeks ahead without waiting.
+// wall() and wallMs() follow the virtual time from the wall time given to setVirtual().
+
+#define MS_TO_NS(ms)  ((uint64_t)(ms) * 1000000)
+#define NS_TO_MS(ns)  ((uint64_t)(ns) / 1000000)
+
+class Clock
+{
+public:
+    static uint64_t ns(void);
+    static uint64_t ms(void);
+    static time_t   wall(void);
+    static uint64_t wallMs(void);
+
+    static void setVirtual(uint64_t ns, time_t wall);
+    static void advance(uint64_t ns);
+    static bool isVirtual(void)
+    {
+        return virtualClock;
+    }
+
+private:
+    static bool     virtualClock;  // time only moves by setVirtual and advance
+    static uint64_t virtualNs;     // current virtual time
+    static uint64_t virtualBase;   // virtual time at virtualWall
+    static time_t   virtualWall;   // wall time given to setVirtual
+};
+
+// end of Clock.h
@@ -18,29 +18,223 @@
 #include <string.h>
 #include "Config.h"
 
-// init pin line from config file.  Return true if success
-bool Pin::init(const char * line)
+// config file sections
+enum {
+    SECTION_NONE = 0,
+    SECTION_PIN,
+    SECTION_IO_INPUT,
+    SECTION_IO_OUTPUT,
+    SECTION_PARTITION,
+    SECTION_CONFIG
+};
+
+// returns section started by header line pBuf
+static int sectionHeader(const char * pBuf)
+{
+    if (strncmp(pBuf, "_START_PIN_SECTION", 18) == 0)
+        return SECTION_PIN;
+    else if (strncmp(pBuf, "_START_IO_INPUT_SECTION", 23) == 0)
+        return SECTION_IO_INPUT;
+    else if (strncmp(pBuf, "_START_IO_OUTPUT_SECTION", 24) == 0)
+        return SECTION_IO_OUTPUT;
+    else if (strncmp(pBuf, "_START_PARTITION_SECTION", 24) == 0)
+        return SECTION_PARTITION;
+    else if (strncmp(pBuf, "_START_CONFIG_SECTION", 21) == 0)
+        return SECTION_CONFIG;
+    return SECTION_NONE;
+}
+
+// reset to an empty config, freeing the tables of a previous readFile
+void Config::clear(void)
+{
+    free(arena);
+    arena = NULL;
+    arenaSize = 0;
+    arenaUsed = 0;
+    strings = NULL;
+    memset(&AlarmPin, 0, sizeof(AlarmPin));
+    memset(&SenseLoop, 0, sizeof(SenseLoop));
+    memset(&Output, 0, sizeof(Output));
+    memset(&Part, 0, sizeof(Part));
+
+    baudRate = 0;
+    chimeDefault = false;
+    zoneScrollMs = DEFAULT_ZONE_SCROLL_MS;
+    serialPort[0] = '\0';
+    sendEmailAccnt[0] = '\0';
+    sendEmailPasswd[0] = '\0';
+    alertEmail[0] = '\0';
+    logLevel[0] = '\0';
+    tracePath[0] = '\0';
+    sockListen[0] = '\0';
+    sockServer[0] = '\0';
+    httpListen[0] = '\0';
+    httpToken[0] = '\0';
+    ctlSocket[0] = '\0';
+    ctlUids[0] = '\0';
+}
+
+// first pass over the config file: count the table entries and allocate the arena for them and
+//   their strings.  Every string comes from a line, so a line's length bounds its strings.
+//   Returns: true on success, with the table sizes in pins, loops, outputs and parts
+bool Config::sizeArena(FILE * fp, int * pPins, int * pLoops, int * pOutputs, int * pParts)
+{
+    int     pins = 0, loops = 0, outputs = 0, parts = 0;
+    size_t  stringBytes = 0;
+    int     section = SECTION_NONE;
+    char  * line = NULL;
+    size_t  lineSize = 0;
+    ssize_t len;
+
+    while ((len = getline(&line, &lineSize, fp)) > 0)
+    {
+        const char * pBuf = nextParm(line);
+
+        if (*pBuf == '_')
+            section = sectionHeader(pBuf);
+        else if (*pBuf == '\0' || *pBuf == '\r' || *pBuf == '\n' || *pBuf == '#')
+            continue;
+        else if (section == SECTION_PIN)
+            pins++;
+        else if (section == SECTION_IO_INPUT)
+            loops++;
+        else if (section == SECTION_IO_OUTPUT)
+            outputs++;
+        else if (section == SECTION_PARTITION)
+            parts++;
+        else
+            continue;
+        stringBytes += len + 2;  // strings of the line plus terminators
+    }
+    free(line);
+    if (parts == 0)
+    {
+        parts = 1;  // the default partition holding everything
+        stringBytes += 1;  // and its empty name (see defaultPartition)
+    }
+    int partUsers = parts * pins;  // a user may be in every partition
+
+    // pointer arrays first, then 4 byte arrays, so every array stays aligned
+    arenaSize = (2*pins + loops + outputs + parts) * sizeof(const char *) + (loops + outputs) * sizeof(int) +
+        (3*parts + partUsers) * sizeof(int) + 3 * loops * sizeof(bool) + parts * sizeof(uint8_t) +
+        loops * sizeof(*SenseLoop.faultText) + stringBytes;
+    arena = (char *)malloc(arenaSize > 0 ? arenaSize : 1);
+    if (arena == NULL)
+    {
+        fprintf(stderr, "Failed to allocate %u bytes for config\n", (unsigned)arenaSize);
+        return false;
+    }
+
+    AlarmPin.name      = (const char **)arenaAlloc(pins * sizeof(const char *));
+    AlarmPin.pin       = (const char **)arenaAlloc(pins * sizeof(const char *));
+    SenseLoop.name     = (const char **)arenaAlloc(loops * sizeof(const char *));
+    Output.funcName    = (const char **)arenaAlloc(outputs * sizeof(const char *));
+    Part.name          = (const char **)arenaAlloc(parts * sizeof(const char *));
+    SenseLoop.gpio     = (int *)arenaAlloc(loops * sizeof(int));
+    Output.gpio        = (int *)arenaAlloc(outputs * sizeof(int));
+    Part.loopMask      = (uint32_t *)arenaAlloc(parts * sizeof(uint32_t));
+    Part.userStart     = (int *)arenaAlloc(parts * sizeof(int));
+    Part.userCount     = (int *)arenaAlloc(parts * sizeof(int));
+    Part.userIdx       = (int *)arenaAlloc(partUsers * sizeof(int));
+    SenseLoop.chimeTone     = (uint8_t *)arenaAlloc(loops * sizeof(uint8_t));
+    SenseLoop.zoneType      = (uint8_t *)arenaAlloc(loops * sizeof(uint8_t));
+    SenseLoop.bypassAllowed = (bool *)arenaAlloc(loops * sizeof(bool));
+    Part.keypadMask    = (uint8_t *)arenaAlloc(parts * sizeof(uint8_t));
+    SenseLoop.faultText = (char (*)[17])arenaAlloc(loops * sizeof(*SenseLoop.faultText));
+    strings = arena + arenaUsed;
+    *pPins = pins;
+    *pLoops = loops;
+    *pOutputs = outputs;
+    *pParts = parts;
+    return true;
+}
+
+// carve size bytes from the arena (sized by sizeArena, so it can't run out)
+void * Config::arenaAlloc(size_t size)
+{
+    void * p = arena + arenaUsed;
+    arenaUsed += size;
+    return p;
+}
+
+// returns the interned copy of the len chars at str, adding it to the arena if not already there
+const char * Config::intern(const char * str, int len)
+{
+    for (const char * s = strings; s < arena + arenaUsed; s += strlen(s) + 1)
+    {
+        if (strncmp(s, str, len) == 0 && s[len] == '\0')
+            return s;
+    }
+    char * s = (char *)arenaAlloc(len + 1);
+    memcpy(s, str, len);
+    s[len] = '\0';
+    return s;
+}
+
+// intern the next text parm at *p and advance *p past it.  Returns: NULL if there is no parm
+const char * Config::internParm(const char ** p)
+{
+    const char * start = nextParm(*p);
+    const char * end = start + strcspn(start, " \t");
+
+    *p = end;
+    return end > start ? intern(start, end - start) : NULL;
+}
+
+// add pin line from config file.  Return true if success
+bool Config::initPin(const char * line)
 {
     const char * p = line;
-    p += Config::getTextParm(p, name, sizeof(name));
-    return (p > line && Config::getTextParm(p, pin, sizeof(pin)) > 0);
+    int i = AlarmPin.count;
+
+    AlarmPin.name[i] = internParm(&p);
+    AlarmPin.pin[i] = internParm(&p);
+    if (AlarmPin.name[i] == NULL || AlarmPin.pin[i] == NULL)
+        return false;
+    AlarmPin.count++;
+    return true;
+}
+
+// zone type named by the len chars at p.  true and false (the DELAY_ENTRY column of older configs)
+//   are ENTRY and PERIMETER.  Returns: ZONE_*, -1 if p is not a zone type
+static int zoneType(const char * p, int len)
+{
+    static const char * typeName[ZONE_TYPE_COUNT] = { "ENTRY", "PERIMETER", "INTERIOR", "FOLLOWER", "24H", "PANIC" };
+
+    for (int t=0; t < ZONE_TYPE_COUNT; t++)
+    {
+        if ((int)strlen(typeName[t]) == len && strncmp(p, typeName[t], len) == 0)
+            return t;
+    }
+    if (len == 4 && strncmp(p, "true", 4) == 0)
+        return ZONE_ENTRY;
+    if (len == 5 && strncmp(p, "false", 5) == 0)
+        return ZONE_PERIMETER;
+    return -1;
 }
 
-// init loop line from config file.  Return true if success
-bool Loop::init(const char * line)
+// add loop line from config file.  Return true if success
+bool Config::initLoop(const char * line)
 {
     int  len = strlen(line);
     bool success = true;
     char * endptr;
     const char * p;
+    int  i = SenseLoop.count;
+    uint8_t chimeTone;
+    int  type;
 
-    gpio = strtol(line, &endptr, 10);  // grab gpio pin number
+    SenseLoop.gpio[i] = strtol(line, &endptr, 10);  // grab gpio pin number
 
     if (endptr != line && endptr != NULL && endptr - line < len)
     {
         p = (const char *)endptr;
-        p += Config::getTextParm(p, name, sizeof(name));  // grab loop name
-        p = Config::nextParm(p);                          // jump over spaces after loop name
+        SenseLoop.name[i] = internParm(&p);            // grab loop name
+        p = Config::nextParm(p);                       // jump over spaces after loop name
+        if (SenseLoop.name[i] == NULL)
+            success = false;
+        else
+            sprintf(SenseLoop.faultText[i], "x %-14.14s", SenseLoop.name[i]);  // built once, shown as is
 
         // get chime tone for loop
         if (strncmp(p, "TONE_CHIME_1", 12) == 0)
@@ -55,37 +249,155 @@ bool Loop::init(const char * line)
             success = false;
         }
 
-        if (p + 12 - line < len)
-        {
-            p = Config::nextParm(p+12);
-            entryAllowed = (strncmp(p, "true", 4) == 0);
-        }
+        SenseLoop.chimeTone[i] = chimeTone;
+
+        p = Config::nextParm(p + strcspn(p, " \t"));   // zone type
+        int typeLen = strcspn(p, " \t\r\n");
+        if ((type = zoneType(p, typeLen)) >= 0)
+            SenseLoop.zoneType[i] = type;
         else
             success = false;
 
-        if (p + 5 - line < len)
-        {
-            p = Config::nextParm(p+5);
-            bypassAllowed = (strncmp(p, "true", 4) == 0);
-        }
+        p = Config::nextParm(p + typeLen);
+        if (*p != '\0')
+            SenseLoop.bypassAllowed[i] = (strncmp(p, "true", 4) == 0);
         else
             success = false;
     }
     else
         success = false;
 
+    if (success)
+        SenseLoop.count++;
     return success;
 }
 
-// init gpio output line from config file.  Return true if success
-bool GpioOutput::init(const char * line)
+// add gpio output line from config file.  Return true if success
+bool Config::initOutput(const char * line)
 {
     char * endptr;
+    int i = Output.count;
 
-    gpio = strtol(line, &endptr, 10);  // grab gpio pin number
+    Output.gpio[i] = strtol(line, &endptr, 10);  // grab gpio pin number
     const char * p = (const char *)endptr;
 
-    return (p > line && Config::getTextParm(p, funcName, sizeof(funcName)) > 0);
+    if (p == line || (Output.funcName[i] = internParm(&p)) == NULL)
+        return false;
+    Output.count++;
+    return true;
+}
+
+// returns the next item of the comma separated list at *p, which ends at white space.  Returns: item
+//   length, 0 at the end of the list
+static int nextItem(const char ** p, const char ** item)
+{
+    if (**p == ',')
+        (*p)++;
+    *item = *p;
+    int len = strcspn(*p, ", \t\r\n");
+    *p += len;
+    return len;
+}
+
+// add user u to partition i, if not already in it
+void Config::addPartUser(int i, int u)
+{
+    int * pUser = Part.userIdx + Part.userStart[i];
+    for (int j=0; j < Part.userCount[i]; j++)
+    {
+        if (pUser[j] == u)
+            return;
+    }
+    pUser[Part.userCount[i]++] = u;
+}
+
+// add partition line from config file: name, then comma separated lists of keypads (16 to 23),
+//   loop names and user names.  A list may be * for all.  Loops and users must already be defined.
+//   Return true if success
+bool Config::initPartition(const char * line)
+{
+    const char * p = line;
+    const char * item;
+    int i = Part.count;
+    int len;
+
+    if ((Part.name[i] = internParm(&p)) == NULL)
+        return false;
+    Part.keypadMask[i] = 0;
+    Part.loopMask[i] = 0;
+    Part.userStart[i] = (i == 0) ? 0 : Part.userStart[i-1] + Part.userCount[i-1];
+    Part.userCount[i] = 0;
+
+    p = nextParm(p);
+    while ((len = nextItem(&p, &item)) > 0)  // keypads
+    {
+        int kp = atoi(item) - 16;
+        if (len == 1 && *item == '*')
+            Part.keypadMask[i] = 0xFF;
+        else if ((int)strspn(item, "0123456789") == len && kp >= 0 && kp < MAX_KEYPADS)
+            Part.keypadMask[i] |= 1 << kp;
+        else
+        {
+            fprintf(stderr, "Bad keypad '%.*s' in partition %s, must be 16 to %d\n", len, item, Part.name[i], 15 + MAX_KEYPADS);
+            return false;
+        }
+    }
+
+    p = nextParm(p);
+    while ((len = nextItem(&p, &item)) > 0)  // loops
+    {
+        int l = 0;
+        while (l < SenseLoop.count && ((int)strlen(SenseLoop.name[l]) != len || strncmp(SenseLoop.name[l], item, len) != 0))
+            l++;
+        if (len == 1 && *item == '*')
+            Part.loopMask[i] = (SenseLoop.count < 32) ? (1u << SenseLoop.count) - 1 : 0xFFFFFFFF;
+        else if (l < SenseLoop.count)
+            Part.loopMask[i] |= 1u << l;
+        else
+        {
+            fprintf(stderr, "Unknown loop '%.*s' in partition %s\n", len, item, Part.name[i]);
+            return false;
+        }
+    }
+
+    p = nextParm(p);
+    while ((len = nextItem(&p, &item)) > 0)  // users
+    {
+        int u = 0;
+        while (u < AlarmPin.count && ((int)strlen(AlarmPin.name[u]) != len || strncmp(AlarmPin.name[u], item, len) != 0))
+            u++;
+        if (len == 1 && *item == '*')
+        {
+            for (u=0; u < AlarmPin.count; u++)
+                addPartUser(i, u);
+        }
+        else if (u < AlarmPin.count)
+            addPartUser(i, u);
+        else
+        {
+            fprintf(stderr, "Unknown user '%.*s' in partition %s\n", len, item, Part.name[i]);
+            return false;
+        }
+    }
+
+    if (Part.keypadMask[i] == 0 || Part.loopMask[i] == 0 || Part.userCount[i] == 0)
+        return false;  // each list needs at least one entry
+    Part.count++;
+    return true;
+}
+
+// make the partition used when the config has no PARTITION lines: all keypads, loops and users,
+//   with no name
+void Config::defaultPartition(void)
+{
+    Part.name[0] = intern("", 0);
+    Part.keypadMask[0] = 0xFF;
+    Part.loopMask[0] = (SenseLoop.count < 32) ? (1u << SenseLoop.count) - 1 : 0xFFFFFFFF;
+    Part.userStart[0] = 0;
+    Part.userCount[0] = 0;
+    for (int u=0; u < AlarmPin.count; u++)
+        addPartUser(0, u);
+    Part.count = 1;
 }
 
 // get pointer to next parm on config line, skipping over any white-space chars
@@ -148,6 +460,12 @@ bool Config::otherConfig(const char * line)
         chimeDefault = (*p == 't' || *p == 'T' || *p == '1');  // true if arg begins with t,T or is 1
         return true;
     }
+    else if (strncmp(p, "ZONE_SCROLL_MS", strlen("ZONE_SCROLL_MS")) == 0)
+    {
+        p = nextParm(p + strlen("ZONE_SCROLL_MS"));  // point to arg
+        zoneScrollMs = atoi(p);
+        return true;
+    }
     else if (strncmp(p, "SEND_EMAIL_ACCNT", strlen("SEND_EMAIL_ACCNT")) == 0)
     {
         p = nextParm(p + strlen("SEND_EMAIL_ACCNT"));  // point to arg
@@ -166,6 +484,46 @@ bool Config::otherConfig(const char * line)
         strncpy(alertEmail, p, MAX_PARM_LENGTH-1);
         return true;
     }
+    else if (strncmp(p, "SOCK_SERVER", strlen("SOCK_SERVER")) == 0)
+    {
+        p = nextParm(p + strlen("SOCK_SERVER"));  // point to arg
+        return getTextParm(p, sockServer, MAX_PARM_LENGTH) > 0;
+    }
+    else if (strncmp(p, "SOCK_LISTEN", strlen("SOCK_LISTEN")) == 0)
+    {
+        p = nextParm(p + strlen("SOCK_LISTEN"));  // point to arg
+        return getTextParm(p, sockListen, MAX_PARM_LENGTH) > 0;
+    }
+    else if (strncmp(p, "HTTP_LISTEN", strlen("HTTP_LISTEN")) == 0)
+    {
+        p = nextParm(p + strlen("HTTP_LISTEN"));  // point to arg
+        return getTextParm(p, httpListen, MAX_PARM_LENGTH) > 0;
+    }
+    else if (strncmp(p, "HTTP_TOKEN", strlen("HTTP_TOKEN")) == 0)
+    {
+        p = nextParm(p + strlen("HTTP_TOKEN"));  // point to arg
+        return getTextParm(p, httpToken, MAX_PARM_LENGTH) > 0;
+    }
+    else if (strncmp(p, "CTL_SOCKET", strlen("CTL_SOCKET")) == 0)
+    {
+        p = nextParm(p + strlen("CTL_SOCKET"));  // point to arg
+        return getTextParm(p, ctlSocket, MAX_PARM_LENGTH) > 0;
+    }
+    else if (strncmp(p, "CTL_UIDS", strlen("CTL_UIDS")) == 0)
+    {
+        p = nextParm(p + strlen("CTL_UIDS"));  // point to arg
+        return getTextParm(p, ctlUids, MAX_PARM_LENGTH) > 0;
+    }
+    else if (strncmp(p, "LOG_LEVEL", strlen("LOG_LEVEL")) == 0)
+    {
+        p = nextParm(p + strlen("LOG_LEVEL"));  // point to arg
+        return getTextParm(p, logLevel, MAX_PARM_LENGTH) > 0;
+    }
+    else if (strncmp(p, "INPUT_TRACE", strlen("INPUT_TRACE")) == 0)
+    {
+        p = nextParm(p + strlen("INPUT_TRACE"));  // point to arg
+        return getTextParm(p, tracePath, MAX_PARM_LENGTH) > 0;
+    }
     else
     {
         // do nothing?
@@ -173,13 +531,105 @@ bool Config::otherConfig(const char * line)
     return false;
 }
 
+// check a config that parsed for values that would misbehave at runtime.  Returns: true if usable
+bool Config::validate(void)
+{
+    bool valid = true;
+
+    if (SenseLoop.count == 0)
+    {
+        fprintf(stderr, "Config has no LOOP lines\n");
+        valid = false;
+    }
+    for (int i=0; i < SenseLoop.count; i++)
+    {
+        for (int j=0; j < i; j++)
+        {
+            if (SenseLoop.gpio[i] == SenseLoop.gpio[j])
+            {
+                fprintf(stderr, "Loops %s and %s use the same gpio %d\n", SenseLoop.name[j], SenseLoop.name[i], SenseLoop.gpio[i]);
+                valid = false;
+            }
+        }
+        for (int j=0; j < Output.count; j++)
+        {
+            if (SenseLoop.gpio[i] == Output.gpio[j])
+            {
+                fprintf(stderr, "Loop %s uses output gpio %d\n", SenseLoop.name[i], SenseLoop.gpio[i]);
+                valid = false;
+            }
+        }
+        if (SenseLoop.bypassAllowed[i] && (SenseLoop.zoneType[i] == ZONE_24H || SenseLoop.zoneType[i] == ZONE_PANIC))
+            fprintf(stderr, "Loop %s is a 24H or PANIC zone, BYPASS is ignored\n", SenseLoop.name[i]);
+    }
+    for (int i=0; i < AlarmPin.count; i++)
+    {
+        int len = strlen(AlarmPin.pin[i]);
+        if (len < MIN_PIN_DIGITS || len > MAX_PIN_DIGITS-1 || (int)strspn(AlarmPin.pin[i], "0123456789") != len)
+        {
+            fprintf(stderr, "Pin of %s must be %d to %d digits\n", AlarmPin.name[i], MIN_PIN_DIGITS, MAX_PIN_DIGITS-1);
+            valid = false;
+        }
+    }
+    uint8_t  keypads = 0;
+    uint32_t loops = 0;
+    for (int i=0; i < Part.count; i++)
+    {
+        if (keypads & Part.keypadMask[i])
+        {
+            fprintf(stderr, "Partition %s uses a keypad of another partition\n", Part.name[i]);
+            valid = false;
+        }
+        keypads |= Part.keypadMask[i];
+        loops |= Part.loopMask[i];
+    }
+    for (int i=0; i < SenseLoop.count; i++)
+    {
+        if (((loops >> i) & 0x1) == 0)
+            fprintf(stderr, "Loop %s is in no partition, it is ignored\n", SenseLoop.name[i]);
+    }
+    if (zoneScrollMs < MIN_ZONE_SCROLL_MS)
+    {
+        fprintf(stderr, "ZONE_SCROLL_MS must be at least %d, using %d\n", MIN_ZONE_SCROLL_MS, MIN_ZONE_SCROLL_MS);
+        zoneScrollMs = MIN_ZONE_SCROLL_MS;
+    }
+    return valid;
+}
+
+// log settings that differ from pOld but only take effect when the alarm is restarted
+void Config::reportRestartParms(Config * pOld)
+{
+    const struct {
+        const char * name;
+        const char * value;
+        const char * oldValue;
+    } parms[] = {
+        { "SERIAL_PORT", serialPort, pOld->serialPort },
+        { "SOCK_SERVER", sockServer, pOld->sockServer },
+        { "SOCK_LISTEN", sockListen, pOld->sockListen },
+        { "HTTP_LISTEN", httpListen, pOld->httpListen },
+        { "HTTP_TOKEN",  httpToken,  pOld->httpToken },
+        { "CTL_SOCKET",  ctlSocket,  pOld->ctlSocket },
+        { "CTL_UIDS",    ctlUids,    pOld->ctlUids },
+        { "INPUT_TRACE", tracePath,  pOld->tracePath },
+    };
+
+    for (unsigned i=0; i < sizeof(parms)/sizeof(parms[0]); i++)
+    {
+        if (strcmp(parms[i].value, parms[i].oldValue) != 0)
+            fprintf(stderr, "%s changed, takes effect when alarm is restarted\n", parms[i].name);
+    }
+    if (baudRate != pOld->baudRate)
+        fprintf(stderr, "SERIAL_BAUD_RATE changed, takes effect when alarm is restarted\n");
+}
+
 // return the gpio pin associated with the provided function name
 int Config::getOutput(const char * func)
 {
-    for (int i=0; i < outputCount; i++)
+    for (int i=0; i < Output.count; i++)
     {
-        if (strcmp(func, Output[i].funcName) == 0)
-            return Output[i].gpio;
+        if (strcmp(func, Output.funcName[i]) == 0)
+            return Output.gpio[i];
     }
     return -1;
 }
@@ -187,25 +637,28 @@ int Config::getOutput(const char * func)
 // read alarm config file.  Returns true on success
 bool Config::readFile(const char * pathAndFilename)
 {
-    enum {
-        SECTION_NONE = 0,
-        SECTION_PIN,
-        SECTION_IO_INPUT,
-        SECTION_IO_OUTPUT,
-        SECTION_CONFIG
-    } eSection = SECTION_NONE;
-
+    int  eSection = SECTION_NONE;
     bool success = true;
     FILE * fp = fopen(pathAndFilename, "r");
     int lineCount = 0;
+    char * lineBuf = NULL;
+    size_t lineSize = 0;
 
+    clear();
     if (fp == NULL)
     {
         fprintf(stderr, "Failed to open config file '%s'\n", pathAndFilename);
         return false;
     }
+    int maxPins, maxLoops, maxOutputs, maxParts;  // table sizes from the first pass
+    if (!sizeArena(fp, &maxPins, &maxLoops, &maxOutputs, &maxParts))
+    {
+        fclose(fp);
+        return false;
+    }
+    rewind(fp);
 
-    while (success && fgets(lineBuf, LINE_BUF_SIZE-1, fp) == lineBuf)  // get one line from config file
+    while (success && getline(&lineBuf, &lineSize, fp) > 0)  // get one line from config file
     {
         for (int i=0; i < (int)strlen(lineBuf); i++)
         {
@@ -221,39 +674,13 @@ bool Config::readFile(const char * pathAndFilename)
         }
         else if (*pBuf == '_')  // section header
         {
-            if (strncmp(pBuf, "_START_PIN_SECTION", 18) == 0)
-            {
-                eSection = SECTION_PIN;
-            }
-            else if (strncmp(pBuf, "_START_IO_INPUT_SECTION", 23) == 0)
-            {
-                eSection = SECTION_IO_INPUT;
-            }
-            else if (strncmp(pBuf, "_START_IO_OUTPUT_SECTION", 24) == 0)
-            {
-                eSection = SECTION_IO_OUTPUT;
-            }
-            else if (strncmp(pBuf, "_START_CONFIG_SECTION", 21) == 0)
-            {
-                eSection = SECTION_CONFIG;
-            }
-            else
-            {
-                eSection = SECTION_NONE;
-            }
+            eSection = sectionHeader(pBuf);
         }
         else if (eSection == SECTION_PIN)
         {
-            if (pinCount < MAX_PIN_CODES && AlarmPin[pinCount].init(pBuf))
-            {
-                pinCount++;
-            }
-            else 
+            if (AlarmPin.count >= maxPins || !initPin(pBuf))
             {
-                if (pinCount >= MAX_PIN_CODES)
-                    fprintf(stderr, "Too many PIN lines in config file\n");
-                else
-                    fprintf(stderr, "Error processing pin line '%s'\n", lineBuf);
+                fprintf(stderr, "Error processing pin line '%s'\n", lineBuf);
                 success = false;
             }
         }
@@ -262,16 +689,14 @@ bool Config::readFile(const char * pathAndFilename)
             if (strncmp(pBuf, "LOOP", 4) == 0)  // line begins with loop
             {
                 pBuf += strlen("LOOP");
-                if (loopCount < MAX_SENSE_LOOPS && SenseLoop[loopCount].init(pBuf))
+                if (SenseLoop.count >= MAX_SENSE_LOOPS)
                 {
-                    loopCount++;
+                    fprintf(stderr, "Too many LOOP lines in config file (max %d)\n", MAX_SENSE_LOOPS);
+                    success = false;
                 }
-                else 
+                else if (SenseLoop.count >= maxLoops || !initLoop(pBuf))
                 {
-                    if (loopCount >= MAX_SENSE_LOOPS)
-                        fprintf(stderr, "Too many LOOP lines in config file\n");
-                    else
-                        fprintf(stderr, "Error processing loop line '%s'\n", lineBuf);
+                    fprintf(stderr, "Error processing loop line '%s'\n", lineBuf);
                     success = false;
                 }
             }
@@ -282,16 +707,17 @@ bool Config::readFile(const char * pathAndFilename)
         }
         else if (eSection == SECTION_IO_OUTPUT)
         {
-            if (outputCount < MAX_GPIO_OUTPUTS && Output[outputCount].init(pBuf))
+            if (Output.count >= maxOutputs || !initOutput(pBuf))
             {
-                outputCount++;
+                fprintf(stderr, "Error processing gpio output line '%s'\n", lineBuf);
+                success = false;
             }
-            else
+        }
+        else if (eSection == SECTION_PARTITION)
+        {
+            if (strncmp(pBuf, "PARTITION", 9) != 0 || Part.count >= maxParts || !initPartition(pBuf + 9))
             {
-                if (outputCount >= MAX_GPIO_OUTPUTS)
-                    fprintf(stderr, "Too many gpio output lines in config file\n");
-                else
-                    fprintf(stderr, "Error processing gpio output line '%s'\n", lineBuf);
+                fprintf(stderr, "Error processing partition line '%s'\n", lineBuf);
                 success = false;
             }
         }
@@ -308,7 +734,10 @@ bool Config::readFile(const char * pathAndFilename)
         }
         lineCount++;
     }
+    free(lineBuf);
     fclose(fp);
+    if (success && Part.count == 0)
+        defaultPartition();
     //fprintf(stderr, "Config::readFile processed %d lines\n", lineCount);
     return success;
 }
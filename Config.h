@@ -28,20 +28,18 @@ static const uint32_t CHIME_TIMEOUT       = 2000;    // time between CHIME tone
 static const uint32_t MAIN_LOOP_SLEEP_MS  = 10;      // main loop sleep ms
 
 static const uint32_t MIN_MS_BETWEEN_F7_MSGS = 200;  // don't send F7 messages faster than this
+static const int      DEFAULT_ZONE_SCROLL_MS = 2000; // ms each open loop is shown when several are open
+static const int      MIN_ZONE_SCROLL_MS     = 500;
 
 static const uint32_t ALERT_MSG_REPEAT_TIMEOUT = 60*1000; // time between send msg repeats
 
 static const int READ_BUF_SIZE       = 256;
 static const int SOCK_BUF_SIZE       = 256;
+static const int MAX_SOCK_CMDS       = 16;    // max socket commands processed per main loop pass
 
-static const int MAX_PIN_LENGTH       = 16;
-static const int MAX_PIN_NAME_LENGTH  = 32;
-static const int MAX_PIN_CODES        =  8;
-static const int MAX_SENSE_LOOPS      = 16;
-static const int MAX_LOOP_NAME_LENGTH = 32;
+static const int MAX_SENSE_LOOPS      = 32;   // loop state is a 32-bit mask, a bit per loop
+static const int MAX_LOOP_NAME_LENGTH = 32;   // loop names are truncated to this in status shm
 static const int MAX_PARM_LENGTH      = 64;
-static const int MAX_FUNC_NAME_LENGTH = 16;
-static const int MAX_GPIO_OUTPUTS     = 4;
 
 #define ALARM_CONFIG_FILE "/etc/alarm_config"  // path to config file
 
@@ -56,34 +54,60 @@ enum {
     TONE_ALARM     = 0x7
 };
 
-class Pin
+// zone types, the TYPE column of a LOOP line.  ZoneTable.h gives the reaction of each type
+enum {
+    ZONE_ENTRY = 0,   // entry delay when armed away, instant when armed stay
+    ZONE_PERIMETER,   // instant when armed
+    ZONE_INTERIOR,    // armed away only, follows an entry delay in progress
+    ZONE_FOLLOWER,    // as interior, but also instant when armed stay
+    ZONE_24H,         // alarm at any time, disarmed too (tamper, fire)
+    ZONE_PANIC,       // alarm at any time, the alert says panic
+    ZONE_TYPE_COUNT
+};
+
+// The pin, loop, output and partition tables are sized by a first pass over the config file and carved
+// out of a single allocation (the arena), along with their strings.  Each table is a structure
+// of arrays, so a scan of one field (say every loop gpio) reads contiguous memory.  Strings are
+// interned, a name used twice is stored once.  Table entries are valid until the next readFile.
+
+class Pin    // user pin codes, entry i is pin[i] of user name[i]
 {
 public:
-    bool init(const char * line);
-
-    char name[MAX_PIN_NAME_LENGTH];
-    char pin[MAX_PIN_LENGTH];
+    int           count;
+    const char ** name;
+    const char ** pin;
 };
 
-class Loop
+class Loop   // sense loops
 {
 public:
-    bool init(const char * line);
-
-    int     gpio;
-    char    name[MAX_LOOP_NAME_LENGTH];
-    uint8_t chimeTone;
-    bool    entryAllowed;
-    bool    bypassAllowed;
+    int           count;
+    int         * gpio;
+    uint8_t     * chimeTone;
+    uint8_t     * zoneType;       // ZONE_*
+    bool        * bypassAllowed;
+    const char ** name;
+    char       (* faultText)[17]; // keypad line2 while the loop is open, "x name"
 };
 
 class GpioOutput
 {
 public:
-    bool init(const char * line);
+    int           count;
+    int         * gpio;
+    const char ** funcName;
+};
 
-    int  gpio;
-    char funcName[MAX_FUNC_NAME_LENGTH];
+class Partition  // independently armed areas, each with its own keypads, loops and users
+{
+public:
+    int           count;
+    const char ** name;          // empty for the default partition (no PARTITION lines)
+    uint8_t     * keypadMask;    // bit per keypad, bit 0 is keypad 16
+    uint32_t    * loopMask;      // bit per loop index, a loop may be in several partitions
+    int         * userStart;     // users of partition i are userIdx[userStart[i]..+userCount[i]]
+    int         * userCount;
+    int         * userIdx;       // pin indexes
 };
 
 class Config
@@ -91,43 +115,52 @@ class Config
 public:
     Config(void)
     {
-        pinCount = 0;
-        loopCount = 0;
-        outputCount = 0;
-        baudRate = 0;
-        chimeDefault = false;
-        serialPort[0] = '\0';
-        sendEmailAccnt[0] = '\0';
-        sendEmailPasswd[0] = '\0';
-        alertEmail[0] = '\0';
+        arena = NULL;
+        clear();
     }
+    ~Config(void)
+    {
+        free(arena);
+    }
+    Config(const Config &) = delete;             // tables point into the arena
+    Config & operator=(const Config &) = delete;
 
     bool readFile(const char * pathAndFilename);
+    bool validate(void);
+    void reportRestartParms(Config * pOld);
 
     Pin * getPin(void)
     {
-        return AlarmPin;
+        return &AlarmPin;
     }
     int getPinCount(void)
     {
-        return pinCount;
+        return AlarmPin.count;
     }
 
     Loop * getLoop(void)
     {
-        return SenseLoop;
+        return &SenseLoop;
     }
     int getLoopCount(void)
     {
-        return loopCount;
+        return SenseLoop.count;
     }
     GpioOutput * getOutputs(void)
     {
-        return Output;
+        return &Output;
     }
     int getOutputCount(void)
     {
-        return outputCount;
+        return Output.count;
+    }
+    Partition * getPartition(void)
+    {
+        return &Part;
+    }
+    int getPartitionCount(void)
+    {
+        return Part.count;
     }
 
     const char * getSerial(void)
@@ -146,6 +179,38 @@ public:
     {
         return alertEmail;
     }
+    const char * getSockServer(void)
+    {
+        return sockServer;
+    }
+    const char * getSockListen(void)
+    {
+        return sockListen;
+    }
+    const char * getHttpListen(void)
+    {
+        return httpListen;
+    }
+    const char * getHttpToken(void)
+    {
+        return httpToken;
+    }
+    const char * getCtlSocket(void)
+    {
+        return ctlSocket;
+    }
+    const char * getCtlUids(void)
+    {
+        return ctlUids;
+    }
+    const char * getLogLevel(void)
+    {
+        return logLevel;
+    }
+    const char * getTracePath(void)
+    {
+        return tracePath;
+    }
     int getBaudRate(void)
     {
         return baudRate;
@@ -156,6 +221,10 @@ public:
     {
         return chimeDefault;
     }
+    int getZoneScrollMs(void)
+    {
+        return zoneScrollMs;
+    }
     int getOutput(const char * func);
 
     static const char * nextParm(const char * buf);
@@ -164,23 +233,44 @@ public:
     static int getNumParm(const char * buf, char * parm, int parmSize);
 
 private:
-    static const int LINE_BUF_SIZE = 256;
-    char lineBuf[LINE_BUF_SIZE];
+    void clear(void);
+    bool sizeArena(FILE * fp, int * pPins, int * pLoops, int * pOutputs, int * pParts);
+    void * arenaAlloc(size_t size);
+    const char * intern(const char * str, int len);
+    const char * internParm(const char ** p);
+
+    bool initPin(const char * line);
+    bool initLoop(const char * line);
+    bool initOutput(const char * line);
+    bool initPartition(const char * line);
+    void addPartUser(int i, int u);
+    void defaultPartition(void);
 
     char serialPort[MAX_PARM_LENGTH];
     char sendEmailAccnt[MAX_PARM_LENGTH];
     char sendEmailPasswd[MAX_PARM_LENGTH];
     char alertEmail[MAX_PARM_LENGTH];
+    char sockServer[MAX_PARM_LENGTH];   // ip:port of web app server, empty if none
+    char sockListen[MAX_PARM_LENGTH];   // ip:port of socket server, empty if disabled
+    char httpListen[MAX_PARM_LENGTH];   // ip:port of http status server, empty if disabled
+    char httpToken[MAX_PARM_LENGTH];    // bearer token for http /keys, empty if disabled
+    char ctlSocket[MAX_PARM_LENGTH];    // path of local control socket, empty if disabled
+    char ctlUids[MAX_PARM_LENGTH];      // comma separated uids allowed to arm/disarm over ctlSocket
+    char logLevel[MAX_PARM_LENGTH];     // runtime log level spec, see setLogLevels() (empty for default)
+    char tracePath[MAX_PARM_LENGTH];    // input trace for alarmReplay, empty if disabled
     int  baudRate;
     bool chimeDefault;
+    int  zoneScrollMs;                  // ms each open loop is shown on the keypad
 
-    Pin        AlarmPin[MAX_PIN_CODES];     // max number of alarm pins in config file
-    Loop       SenseLoop[MAX_SENSE_LOOPS];  // max number of sense loops in config file
-    GpioOutput Output[MAX_GPIO_OUTPUTS];    // max number of gpio outputs in config file
+    Pin        AlarmPin;     // alarm pins in config file
+    Loop       SenseLoop;    // sense loops in config file
+    GpioOutput Output;       // gpio outputs in config file
+    Partition  Part;         // partitions in config file, or the default partition
 
-    int pinCount;
-    int loopCount;
-    int outputCount;
+    char     * arena;        // tables and strings, one allocation
+    size_t     arenaSize;
+    size_t     arenaUsed;
+    char     * strings;      // start of interned strings in the arena
 };
 
 // end of Config.h
@@ -0,0 +1,93 @@
+// The file ConfigWatch.cpp is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <errno.h>
+
+#include "ConfigWatch.h"
+#include "Clock.h"
+
+// watch the directory of pathAndFilename for the file being written or replaced.  Returns: true on success
+bool ConfigWatch::init(const char * pathAndFilename)
+{
+    char dir[MAX_PARM_LENGTH];
+
+    const char * slash = strrchr(pathAndFilename, '/');
+    if (slash == NULL)
+    {
+        strcpy(dir, ".");
+        snprintf(file, sizeof(file), "%s", pathAndFilename);
+    }
+    else
+    {
+        snprintf(dir, sizeof(dir), "%.*s", slash == pathAndFilename ? 1 : (int)(slash - pathAndFilename), pathAndFilename);
+        snprintf(file, sizeof(file), "%s", slash + 1);
+    }
+
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0 || inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+    {
+        fprintf(stderr, "Failed to watch %s (%s)\n", dir, strerror(errno));
+        fini();
+        return false;
+    }
+    return true;
+}
+
+void ConfigWatch::fini(void)
+{
+    if (fd >= 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+}
+
+// read pending inotify events.  Returns: true once the config file changed and has been
+//   left alone for CONFIG_SETTLE_MS
+bool ConfigWatch::changed(void)
+{
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    int  n;
+
+    if (fd < 0)
+        return false;
+
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+    {
+        for (char * p = buf; p < buf + n; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len)
+        {
+            struct inotify_event * ev = (struct inotify_event *)p;
+            if (ev->len > 0 && strcmp(ev->name, file) == 0)
+            {
+                pending = true;
+                lastEvent = Clock::ms();
+            }
+        }
+    }
+
+    if (pending && Clock::ms() - lastEvent >= CONFIG_SETTLE_MS)
+    {
+        pending = false;
+        return true;
+    }
+    return false;
+}
+
+// end of ConfigWatch.cpp
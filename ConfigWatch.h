@@ -0,0 +1,51 @@
+// The file ConfigWatch.h is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "stdafx.h"
+#include "Config.h"
+
+// Watches the config file with inotify so edits are reloaded without a SIGHUP.  The directory
+// is watched rather than the file, since editors usually save by writing a new file and
+// renaming it over the old one.  changed() is polled from the main loop.
+
+static const uint32_t CONFIG_SETTLE_MS = 250;  // wait for writes to stop before reloading
+
+class ConfigWatch
+{
+public:
+    ConfigWatch(void)
+    {
+        fd = -1;
+        pending = false;
+        lastEvent = 0;
+        file[0] = '\0';
+    }
+
+    bool init(const char * pathAndFilename);
+    void fini(void);
+
+    bool changed(void);
+
+private:
+    int      fd;                  // inotify fd, -1 if not watching
+    bool     pending;             // file changed, waiting for it to settle
+    uint64_t lastEvent;           // timestamp of last change event
+    char     file[MAX_PARM_LENGTH];  // file name within the watched directory
+};
+
+// end of ConfigWatch.h
@@ -0,0 +1,369 @@
+// The file CtlServer.cpp is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <errno.h>
+
+#include "CtlServer.h"
+#include "Stats.h"
+#include "InputTrace.h"
+#include "logMsg.h"
+
+static const uint32_t LISTEN_ID = 0xFFFFFFFF;  // epoll data for the listen socket
+
+// listen on unix socket sockPath, uids is a comma separated list of uids allowed to arm/disarm.
+//   Returns: true on success
+bool CtlServer::init(const char * sockPath, const char * uids, Config * pConfig)
+{
+    struct sockaddr_un addr;
+
+    this->pConfig = pConfig;
+    for (const char * p = uids; *p != '\0' && uidCount < CTL_MAX_UIDS; p++)
+    {
+        if (*p >= '0' && *p <= '9' && (p == uids || *(p-1) == ','))
+            allowUid[uidCount++] = atoi(p);
+    }
+
+    if (strlen(sockPath) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "Control socket path too long '%s'\n", sockPath);
+        return false;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, sockPath);
+
+    listenSock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenSock < 0)
+        return false;
+
+    unlink(sockPath);  // left over from a previous run
+    if (bind(listenSock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listenSock, SOMAXCONN) < 0)
+    {
+        fprintf(stderr, "Failed to listen on %s (%s)\n", sockPath, strerror(errno));
+        fini();
+        return false;
+    }
+    strcpy(path, sockPath);
+    chmod(path, 0666);  // anyone may connect and query, peer credentials decide who may arm/disarm
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0)
+    {
+        fini();
+        return false;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u32 = LISTEN_ID;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, listenSock, &ev);
+    return true;
+}
+
+void CtlServer::fini(void)
+{
+    for (int i=0; i < CTL_MAX_CLIENTS; i++)
+    {
+        if (client[i].fd >= 0)
+            closeClient(i);
+    }
+    if (epollFd >= 0)
+    {
+        close(epollFd);
+        epollFd = -1;
+    }
+    if (listenSock >= 0)
+    {
+        close(listenSock);
+        listenSock = -1;
+    }
+    if (path[0] != '\0')
+    {
+        unlink(path);
+        path[0] = '\0';
+    }
+}
+
+// accept all pending connections, recording the peer credentials
+void CtlServer::acceptClients(void)
+{
+    int fd;
+
+    while ((fd = accept4(listenSock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+        struct ucred cred;
+        socklen_t credLen = sizeof(cred);
+        int idx = 0;
+
+        while (idx < CTL_MAX_CLIENTS && client[idx].fd >= 0)
+            idx++;
+        if (idx == CTL_MAX_CLIENTS || getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &credLen) < 0)
+        {
+            ERR_MSG(LOG_CAT_SOCK, "Control client rejected (%s)\n", idx == CTL_MAX_CLIENTS ? "too many clients" : strerror(errno));
+            close(fd);
+            continue;
+        }
+
+        t_CtlConn * c = &client[idx];
+        c->fd = fd;
+        c->uid = cred.uid;
+        c->pid = cred.pid;
+        c->control = (cred.uid == 0 || cred.uid == geteuid());
+        for (int i=0; i < uidCount; i++)
+        {
+            if (cred.uid == allowUid[i])
+                c->control = true;
+        }
+        c->subscribed = false;
+        c->part = 0;
+        c->version = 0;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u32 = idx;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev);
+        INFO_MSG(LOG_CAT_SOCK, "Control client uid %u pid %d connected%s\n", (unsigned)c->uid, (int)c->pid,
+            c->control ? "" : " (query only)");
+    }
+}
+
+void CtlServer::closeClient(int idx)
+{
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, client[idx].fd, NULL);
+    close(client[idx].fd);
+    client[idx].fd = -1;
+    DEBUG_MSG(LOG_CAT_SOCK, "Control client uid %u pid %d closed\n", (unsigned)client[idx].uid, (int)client[idx].pid);
+}
+
+// send msg to client idx.  A client that is not reading is closed.  Returns: false if client was closed
+bool CtlServer::sendMsg(int idx, const t_CtlMsg * msg)
+{
+    if (send(client[idx].fd, msg, sizeof(*msg), MSG_NOSIGNAL | MSG_DONTWAIT) != (int)sizeof(*msg))
+    {
+        ERR_MSG(LOG_CAT_SOCK, "Control client uid %u pid %d: %s\n", (unsigned)client[idx].uid, (int)client[idx].pid,
+            errno == EAGAIN ? "not reading, closing" : strerror(errno));
+        closeClient(idx);
+        return false;
+    }
+    return true;
+}
+
+// sleep up to ms, returning early if a control request (or connection) is waiting
+void CtlServer::wait(uint32_t ms)
+{
+    struct epoll_event ev;
+
+    if (epollFd < 0)
+        usleep(ms * 1000);
+    else
+        epoll_wait(epollFd, &ev, 1, ms);
+}
+
+// handle all pending requests for the partCount partitions in part.  Returns: true if a request
+//   changed the alarm state
+bool CtlServer::poll(AlarmManager * part, int partCount)
+{
+    struct epoll_event events[CTL_MAX_CLIENTS + 1];
+    bool changed = false;
+
+    if (epollFd < 0)
+        return false;
+
+    int count = epoll_wait(epollFd, events, CTL_MAX_CLIENTS + 1, 0);
+    for (int i=0; i < count; i++)
+    {
+        uint32_t idx = events[i].data.u32;
+
+        if (idx == LISTEN_ID)
+        {
+            acceptClients();
+            continue;
+        }
+
+        t_CtlMsg msg;  // seqpacket, one request per recv
+        while (client[idx].fd >= 0)
+        {
+            int n = recv(client[idx].fd, &msg, sizeof(msg), MSG_DONTWAIT);
+            if (n == (int)sizeof(msg))
+            {
+                changed |= handleMsg(idx, &msg, part, partCount);
+                alarmStats.sockCmds++;
+            }
+            else if (n > 0)
+            {
+                ERR_MSG(LOG_CAT_SOCK, "Control client uid %u sent %d byte message, closing\n", (unsigned)client[idx].uid, n);
+                closeClient(idx);
+            }
+            else
+            {
+                if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                    closeClient(idx);
+                break;
+            }
+        }
+    }
+    return changed;
+}
+
+// fill msg with the current state of partition msg->part, which must be in range
+void CtlServer::fillState(t_CtlMsg * msg, AlarmManager * part, int partCount)
+{
+    AlarmManager * pAlarmManager = &part[msg->part];
+    const t_AlarmState * s = pAlarmManager->getState();
+
+    msg->epoch = pAlarmManager->getStateEpoch();
+    msg->version = s->version;
+    msg->loopMask = s->loopMask;
+    msg->armed = s->armed;
+    msg->ready = s->ready;
+    msg->alarm = s->alarm;
+    msg->chime = s->chime;
+    msg->power = s->power;
+    msg->tone = s->tone;
+    msg->zoneCount = pConfig->getLoopCount();
+    msg->zoneOpen = 0;
+    memset(msg->text, 0, sizeof(msg->text));
+    memcpy(msg->text, s->line1, 16);
+    memcpy(msg->text + 17, s->line2, 16);
+    msg->partCount = partCount;
+}
+
+// handle one request from client idx and send the response.  Returns: true if the alarm state changed
+bool CtlServer::handleMsg(int idx, t_CtlMsg * msg, AlarmManager * part, int partCount)
+{
+    t_CtlConn * c = &client[idx];
+    bool changed = false;
+    char who[32];
+
+    msg->status = CTL_OK;
+    snprintf(who, sizeof(who), "uid %u", (unsigned)c->uid);
+
+    if (msg->part >= partCount)  // no such partition, the response carries no state
+    {
+        t_CtlMsg resp;
+        memset(&resp, 0, sizeof(resp));
+        resp.cmd = msg->cmd;
+        resp.status = CTL_ERR_ARG;
+        resp.seq = msg->seq;
+        resp.arg = msg->arg;
+        resp.part = msg->part;
+        resp.partCount = partCount;
+        sendMsg(idx, &resp);
+        return false;
+    }
+    AlarmManager * pAlarmManager = &part[msg->part];
+
+    switch (msg->cmd)
+    {
+        case CTL_CMD_STATE:
+            break;
+
+        case CTL_CMD_ZONE:
+            if (msg->arg >= (uint32_t)pConfig->getLoopCount())
+                msg->status = CTL_ERR_ARG;
+            break;
+
+        case CTL_CMD_ARM_AWAY:
+        case CTL_CMD_ARM_STAY:
+        case CTL_CMD_DISARM:
+            if (!c->control)
+            {
+                ERR_MSG(LOG_CAT_SOCK, "Control client %s pid %d not allowed to arm/disarm\n", who, (int)c->pid);
+                msg->status = CTL_ERR_PERM;
+            }
+            else
+            {
+                inputTrace.control(msg->cmd, msg->part, who);
+                if (msg->cmd == CTL_CMD_DISARM)
+                {
+                    pAlarmManager->disarm(who);
+                    changed = true;
+                }
+                else if (pAlarmManager->arm(msg->cmd == CTL_CMD_ARM_AWAY ? ARMED_AWAY : ARMED_STAY, who))
+                {
+                    changed = true;
+                }
+                else
+                {
+                    msg->status = CTL_ERR_STATE;
+                }
+            }
+            if (changed)
+                pAlarmManager->publishState();  // response carries the new state
+            break;
+
+        case CTL_CMD_SUBSCRIBE:
+            c->subscribed = true;
+            c->part = msg->part;
+            c->version = pAlarmManager->getStateVersion();  // response is the starting state
+            break;
+
+        default:
+            msg->status = CTL_ERR_CMD;
+            break;
+    }
+
+    fillState(msg, part, partCount);
+    if (msg->cmd == CTL_CMD_ZONE && msg->status == CTL_OK)
+    {
+        uint32_t open = 0;  // a loop is only watched by the partitions it is in
+        for (int p=0; p < partCount; p++)
+            open |= part[p].getState()->loopMask;
+        memset(msg->text, 0, sizeof(msg->text));
+        snprintf(msg->text, sizeof(msg->text), "%s", pConfig->getLoop()->name[msg->arg]);
+        msg->zoneOpen = (open >> msg->arg) & 0x1;
+    }
+    sendMsg(idx, msg);
+    return changed;
+}
+
+// send a CTL_EVENT to each subscribed client not yet at the current state version of its partition
+void CtlServer::publish(AlarmManager * part, int partCount)
+{
+    t_CtlMsg msg;
+    int      filled = -1;  // partition msg holds the state of
+
+    for (int i=0; i < CTL_MAX_CLIENTS; i++)
+    {
+        t_CtlConn * c = &client[i];
+        if (c->fd < 0 || !c->subscribed || c->part >= partCount)
+            continue;
+        uint32_t version = part[c->part].getStateVersion();
+        if (c->version == version)
+            continue;
+
+        if (filled != c->part)
+        {
+            memset(&msg, 0, sizeof(msg));
+            msg.cmd = CTL_EVENT;
+            msg.part = c->part;
+            fillState(&msg, part, partCount);
+            filled = c->part;
+        }
+        if (sendMsg(i, &msg))
+            c->version = version;
+    }
+}
+
+// end of CtlServer.cpp
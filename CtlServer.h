@@ -0,0 +1,83 @@
+// The file CtlServer.h is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "stdafx.h"
+#include <sys/types.h>
+#include "Config.h"
+#include "AlarmManager.h"
+#include "AlarmCtl.h"
+
+// Local control socket server (protocol in AlarmCtl.h), polled from the main loop.  Commands
+// call AlarmManager directly rather than simulating key presses.  wait() replaces the main
+// loop sleep, so a request wakes the loop at once instead of waiting out MAIN_LOOP_SLEEP_MS.
+
+static const int CTL_MAX_CLIENTS = 16;   // max connected clients
+static const int CTL_MAX_UIDS    = 8;    // max uids in CTL_UIDS
+
+struct t_CtlConn {
+    int      fd;              // -1 if slot not in use
+    uid_t    uid;             // peer credentials from SO_PEERCRED
+    pid_t    pid;
+    bool     control;         // peer may arm/disarm
+    bool     subscribed;      // peer receives CTL_EVENT messages
+    uint8_t  part;            // partition subscribed to
+    uint32_t version;         // state version of part last sent to a subscriber
+};
+
+class CtlServer
+{
+public:
+    CtlServer(void)
+    {
+        listenSock = -1;
+        epollFd = -1;
+        uidCount = 0;
+        path[0] = '\0';
+        for (int i=0; i < CTL_MAX_CLIENTS; i++)
+            client[i].fd = -1;
+    }
+
+    bool init(const char * sockPath, const char * uids, Config * pConfig);
+    void fini(void);
+
+    bool poll(AlarmManager * part, int partCount);
+    void setConfig(Config * pConfig)  // config reloaded
+    {
+        this->pConfig = pConfig;
+    }
+    void publish(AlarmManager * part, int partCount);
+    void wait(uint32_t ms);
+
+private:
+    void acceptClients(void);
+    void closeClient(int idx);
+    bool handleMsg(int idx, t_CtlMsg * msg, AlarmManager * part, int partCount);
+    void fillState(t_CtlMsg * msg, AlarmManager * part, int partCount);
+    bool sendMsg(int idx, const t_CtlMsg * msg);
+
+    int      listenSock;
+    int      epollFd;
+    char     path[MAX_PARM_LENGTH];
+    uid_t    allowUid[CTL_MAX_UIDS];   // uids allowed to arm/disarm, besides root and our own
+    int      uidCount;
+    Config * pConfig;
+
+    t_CtlConn client[CTL_MAX_CLIENTS];
+};
+
+// end of CtlServer.h
@@ -0,0 +1,254 @@
+// The file EventJournal.cpp is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "stdafx.h"
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "EventJournal.h"
+#include "Clock.h"
+
+// returns current time in ms since epoch
+uint64_t EventJournal::nowMs(void)
+{
+    return Clock::wallMs();
+}
+
+const char * EventJournal::typeName(uint8_t type)
+{
+    static const char * names[EVENT_TYPE_COUNT] = {
+        "start", "open", "close", "noise", "arm-away", "arm-stay", "arm-bypass", "disarm", "alarm"
+    };
+    return type < EVENT_TYPE_COUNT ? names[type] : "unknown";
+}
+
+// open journal for appending events.  Returns: true on success
+bool EventJournal::init(const char * path, const char * idxPath)
+{
+    struct stat st;
+
+    fd = open(path, O_RDWR | O_APPEND | O_CREAT, 0644);
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        fprintf(stderr, "Failed to open event journal '%s'\n", path);
+        fini();
+        return false;
+    }
+
+    recCount = st.st_size / sizeof(t_JournalEvent);
+    if (st.st_size % sizeof(t_JournalEvent) != 0)  // partial record from a crash mid-write
+    {
+        if (ftruncate(fd, recCount * sizeof(t_JournalEvent)) != 0)
+        {
+            fprintf(stderr, "Failed to truncate partial journal record\n");
+        }
+    }
+
+    lastTimeMs = 0;
+    if (recCount > 0)
+    {
+        t_JournalEvent last;
+        if (pread(fd, &last, sizeof(last), (recCount - 1) * sizeof(t_JournalEvent)) == sizeof(last))
+            lastTimeMs = last.timeMs;
+    }
+
+    idxFd = open(idxPath, O_RDWR | O_APPEND | O_CREAT, 0644);
+    if (idxFd < 0 || fstat(idxFd, &st) != 0)
+    {
+        fprintf(stderr, "Failed to open event journal index '%s'\n", idxPath);
+        return true;  // journal still works, queries fall back to searching records
+    }
+
+    uint64_t expected = (recCount + JOURNAL_INDEX_EVERY - 1) / JOURNAL_INDEX_EVERY;
+    if ((uint64_t)st.st_size != expected * sizeof(t_JournalIndex))
+    {
+        rebuildIndex(idxPath);
+    }
+    return true;
+}
+
+void EventJournal::fini(void)
+{
+    if (fd >= 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+    if (idxFd >= 0)
+    {
+        close(idxFd);
+        idxFd = -1;
+    }
+}
+
+// rewrite the index from the journal records.  Returns: true on success
+bool EventJournal::rebuildIndex(const char * idxPath)
+{
+    if (ftruncate(idxFd, 0) != 0)
+        return false;
+
+    for (uint64_t rec=0; rec < recCount; rec += JOURNAL_INDEX_EVERY)
+    {
+        t_JournalEvent event;
+        t_JournalIndex entry;
+        if (pread(fd, &event, sizeof(event), rec * sizeof(t_JournalEvent)) != sizeof(event))
+            return false;
+        entry.timeMs = event.timeMs;
+        entry.recNum = rec;
+        if (write(idxFd, &entry, sizeof(entry)) != sizeof(entry))
+            return false;
+    }
+    fprintf(stderr, "Rebuilt event journal index '%s'\n", idxPath);
+    return true;
+}
+
+// append an event to the journal
+void EventJournal::logEvent(uint8_t type, uint8_t zone, uint8_t user, uint8_t armed, uint8_t partition)
+{
+    if (fd < 0)
+        return;
+
+    t_JournalEvent event;
+    memset(&event, 0, sizeof(event));
+
+    // keep records in time order even if the wall clock steps back (NTP sync after boot)
+    event.timeMs = nowMs();
+    if (event.timeMs < lastTimeMs)
+        event.timeMs = lastTimeMs;
+    event.type  = type;
+    event.zone  = zone;
+    event.user  = user;
+    event.armed = armed;
+    event.partition = partition;
+
+    if (write(fd, &event, sizeof(event)) != sizeof(event))
+    {
+        fprintf(stderr, "Failed to write event journal record\n");
+        return;
+    }
+    if (recCount % JOURNAL_INDEX_EVERY == 0 && idxFd >= 0)
+    {
+        t_JournalIndex entry;
+        entry.timeMs = event.timeMs;
+        entry.recNum = recCount;
+        if (write(idxFd, &entry, sizeof(entry)) != sizeof(entry))
+        {
+            fprintf(stderr, "Failed to write event journal index\n");
+        }
+    }
+    lastTimeMs = event.timeMs;
+    recCount++;
+}
+
+// map journal and index read-only for queries.  Returns: true on success
+bool EventJournal::openRead(const char * path, const char * idxPath)
+{
+    struct stat st;
+    int rfd = open(path, O_RDONLY);
+
+    closeRead();
+    if (rfd < 0 || fstat(rfd, &st) != 0)
+    {
+        if (rfd >= 0)
+            close(rfd);
+        return false;
+    }
+    recCount = st.st_size / sizeof(t_JournalEvent);
+    recMapSize = st.st_size;
+    if (recCount > 0)
+    {
+        void * p = mmap(NULL, recMapSize, PROT_READ, MAP_SHARED, rfd, 0);
+        if (p != MAP_FAILED)
+        {
+            pRecs = (const t_JournalEvent *)p;
+            madvise(p, recMapSize, MADV_SEQUENTIAL);
+        }
+    }
+    close(rfd);
+    if (recCount > 0 && pRecs == NULL)
+        return false;
+
+    rfd = open(idxPath, O_RDONLY);
+    if (rfd >= 0 && fstat(rfd, &st) == 0 && st.st_size >= (off_t)sizeof(t_JournalIndex))
+    {
+        idxMapSize = st.st_size;
+        void * p = mmap(NULL, idxMapSize, PROT_READ, MAP_SHARED, rfd, 0);
+        if (p != MAP_FAILED)
+        {
+            pIdx = (const t_JournalIndex *)p;
+            idxCount = idxMapSize / sizeof(t_JournalIndex);
+        }
+    }
+    if (rfd >= 0)
+        close(rfd);
+    return true;
+}
+
+void EventJournal::closeRead(void)
+{
+    if (pRecs != NULL)
+    {
+        munmap((void *)pRecs, recMapSize);
+        pRecs = NULL;
+    }
+    if (pIdx != NULL)
+    {
+        munmap((void *)pIdx, idxMapSize);
+        pIdx = NULL;
+        idxCount = 0;
+    }
+}
+
+// find the first record at or after timeMs.  Returns: record number (getEventCount() if none)
+uint64_t EventJournal::findTime(uint64_t timeMs)
+{
+    uint64_t lo = 0;
+    uint64_t hi = recCount;
+
+    // narrow the search to one index block using the sparse index
+    if (idxCount > 0)
+    {
+        uint64_t ilo = 0, ihi = idxCount;
+        while (ilo < ihi)  // first index entry at or after timeMs
+        {
+            uint64_t mid = (ilo + ihi) / 2;
+            if (pIdx[mid].timeMs < timeMs)
+                ilo = mid + 1;
+            else
+                ihi = mid;
+        }
+        if (ilo > 0 && pIdx[ilo-1].recNum < recCount)
+            lo = pIdx[ilo-1].recNum;
+        if (ilo < idxCount && pIdx[ilo].recNum < recCount)
+            hi = pIdx[ilo].recNum;
+    }
+
+    while (lo < hi)  // first record at or after timeMs within the block
+    {
+        uint64_t mid = (lo + hi) / 2;
+        if (pRecs[mid].timeMs < timeMs)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// end of EventJournal.cpp
@@ -0,0 +1,111 @@
+// The file EventJournal.h is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "stdafx.h"
+
+// Append-only binary journal of zone and arming events.  Records are fixed size and written
+// in time order to JOURNAL_FILE.  Every JOURNAL_INDEX_EVERY records a (time, record number)
+// entry is appended to JOURNAL_INDEX_FILE, so a time range can be located with a binary
+// search of the small index followed by a short scan.
+
+#define JOURNAL_FILE        "/var/log/alarmJournal"
+#define JOURNAL_INDEX_FILE  "/var/log/alarmJournal.idx"
+
+static const uint32_t JOURNAL_INDEX_EVERY = 256;   // records between index entries
+static const uint8_t  JOURNAL_NONE        = 0xFF;  // zone/user value when not applicable
+
+// journal event types
+enum {
+    EVENT_START = 0,    // daemon started
+    EVENT_LOOP_OPEN,    // zone = loop index
+    EVENT_LOOP_CLOSE,   // zone = loop index
+    EVENT_LOOP_NOISE,   // zone = loop index, loop change ignored as noise
+    EVENT_ARM_AWAY,     // user = pin index
+    EVENT_ARM_STAY,     // user = pin index
+    EVENT_ARM_BYPASS,   // user = pin index
+    EVENT_DISARM,       // user = pin index
+    EVENT_ALARM,        // zone = loop index that caused the alarm (if any), user = pin index (if any)
+    EVENT_TYPE_COUNT
+};
+
+struct t_JournalEvent {
+    uint64_t timeMs;    // ms since epoch (CLOCK_REALTIME)
+    uint8_t  type;      // EVENT_* type
+    uint8_t  zone;      // loop index, JOURNAL_NONE if not applicable
+    uint8_t  user;      // pin index, JOURNAL_NONE if not applicable
+    uint8_t  armed;     // armed mode after the event (of the partition)
+    uint8_t  partition; // partition index (0 in journals written before partitions)
+    uint8_t  pad[3];
+};
+
+struct t_JournalIndex {
+    uint64_t timeMs;    // time of record recNum
+    uint64_t recNum;    // record number (not byte offset)
+};
+
+class EventJournal
+{
+public:
+    EventJournal(void)
+    {
+        fd = -1;
+        idxFd = -1;
+        recCount = 0;
+        pRecs = NULL;
+        pIdx = NULL;
+        idxCount = 0;
+    }
+
+    // writer (daemon)
+    bool init(const char * path, const char * idxPath);
+    void fini(void);
+    void logEvent(uint8_t type, uint8_t zone, uint8_t user, uint8_t armed, uint8_t partition = 0);
+
+    // reader (query tool)
+    bool openRead(const char * path, const char * idxPath);
+    void closeRead(void);
+    uint64_t findTime(uint64_t timeMs);
+
+    const t_JournalEvent * getEvents(void)
+    {
+        return pRecs;
+    }
+    uint64_t getEventCount(void)
+    {
+        return recCount;
+    }
+
+    static const char * typeName(uint8_t type);
+    static uint64_t nowMs(void);
+
+private:
+    bool rebuildIndex(const char * path);
+
+    int      fd;           // journal file (writer)
+    int      idxFd;        // index file (writer)
+    uint64_t recCount;     // number of records in journal
+    uint64_t lastTimeMs;   // time of last record written
+
+    const t_JournalEvent * pRecs;   // mapped journal (reader)
+    size_t                 recMapSize;
+    const t_JournalIndex * pIdx;    // mapped index (reader)
+    size_t                 idxMapSize;
+    uint64_t               idxCount;
+};
+
+// end of EventJournal.h
@@ -0,0 +1,747 @@
+// The file HttpServer.cpp is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <errno.h>
+
+#include "HttpServer.h"
+#include "SockServer.h"
+#include "WebSocket.h"
+#include "Clock.h"
+#include "Stats.h"
+#include "logMsg.h"
+
+static const uint32_t LISTEN_ID  = 0xFFFFFFFF;  // epoll data for the listen socket
+static const char * ARMED_NAMES[] = { "disarmed", "stay", "away", "bypass" };
+
+// append printf formatted text to buf, never past size.  Returns: new length
+static int appendf(char * buf, int len, int size, const char * fmt, ...) __attribute__((format(printf, 4, 5)));
+static int appendf(char * buf, int len, int size, const char * fmt, ...)
+{
+    va_list pArg;
+
+    if (len >= size - 1)
+        return len;
+    va_start(pArg, fmt);
+    int n = vsnprintf(buf + len, size - len, fmt, pArg);
+    va_end(pArg);
+    return (n < size - len) ? len + n : size - 1;
+}
+
+// append str as a quoted JSON string.  Returns: new length
+static int appendJson(char * buf, int len, int size, const char * str)
+{
+    len = appendf(buf, len, size, "\"");
+    for (const char * p = str; *p != '\0'; p++)
+    {
+        if (*p == '"' || *p == '\\')
+            len = appendf(buf, len, size, "\\%c", *p);
+        else if ((unsigned char)*p < 0x20)
+            len = appendf(buf, len, size, "\\u%04x", *p);
+        else
+            len = appendf(buf, len, size, "%c", *p);
+    }
+    return appendf(buf, len, size, "\"");
+}
+
+// append str as a quoted Prometheus label value (backslash, quote and newline escaped).  Returns: new length
+static int appendLabel(char * buf, int len, int size, const char * str)
+{
+    len = appendf(buf, len, size, "\"");
+    for (const char * p = str; *p != '\0'; p++)
+    {
+        if (*p == '"' || *p == '\\')
+            len = appendf(buf, len, size, "\\%c", *p);
+        else if (*p == '\n')
+            len = appendf(buf, len, size, "\\n");
+        else
+            len = appendf(buf, len, size, "%c", *p);
+    }
+    return appendf(buf, len, size, "\"");
+}
+
+// Returns: zones open in any of the partCount partitions in part, a partition only sees its own loops
+static uint32_t openLoops(AlarmManager * part, int partCount)
+{
+    uint32_t mask = 0;
+
+    for (int p=0; p < partCount; p++)
+        mask |= part[p].getState()->loopMask;
+    return mask;
+}
+
+// find header name in request headers.  Returns: pointer to header value, NULL if not present
+static const char * findHeader(const char * req, const char * name)
+{
+    int nameLen = strlen(name);
+    const char * p = strstr(req, "\r\n");
+
+    while (p != NULL && p[2] != '\r')
+    {
+        p += 2;
+        if (strncasecmp(p, name, nameLen) == 0 && p[nameLen] == ':')
+        {
+            p += nameLen + 1;
+            while (*p == ' ')
+                p++;
+            return p;
+        }
+        p = strstr(p, "\r\n");
+    }
+    return NULL;
+}
+
+// listen on listenAddr ("ip:port" or "port").  Returns: true on success
+bool HttpServer::init(const char * listenAddr, const char * token, Config * pConfig)
+{
+    struct sockaddr_in addr;
+    int one = 1;
+
+    this->pConfig = pConfig;
+    snprintf(this->token, sizeof(this->token), "%s", token);
+    partCount = pConfig->getPartitionCount();  // fixed until restart
+    frame = new char[partCount][HTTP_FRAME_SIZE];
+    for (int p=0; p < partCount; p++)
+        frame[p][0] = '\0';
+
+    if (!parseListenAddr(listenAddr, &addr))
+        return false;
+
+    listenSock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenSock < 0)
+        return false;
+    setsockopt(listenSock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    if (bind(listenSock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listenSock, 16) < 0)
+    {
+        fprintf(stderr, "Failed to listen on %s (%s)\n", listenAddr, strerror(errno));
+        fini();
+        return false;
+    }
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0)
+    {
+        fini();
+        return false;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u32 = LISTEN_ID;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, listenSock, &ev);
+    return true;
+}
+
+void HttpServer::fini(void)
+{
+    for (int i=0; i < HTTP_MAX_CONNS; i++)
+    {
+        if (conn[i].fd >= 0)
+            closeConn(i);
+    }
+    if (epollFd >= 0)
+    {
+        close(epollFd);
+        epollFd = -1;
+    }
+    if (listenSock >= 0)
+    {
+        close(listenSock);
+        listenSock = -1;
+    }
+    delete[] frame;
+    frame = NULL;
+    partCount = 0;
+}
+
+void HttpServer::acceptConns(void)
+{
+    int fd;
+
+    while ((fd = accept4(listenSock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+        int idx = 0;
+        while (idx < HTTP_MAX_CONNS && conn[idx].fd >= 0)
+            idx++;
+        if (idx == HTTP_MAX_CONNS)  // all slots busy, drop the connection
+        {
+            close(fd);
+            continue;
+        }
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        t_HttpConn * c = &conn[idx];
+        c->fd = fd;
+        c->startMs = Clock::ms();
+        c->reqLen = 0;
+        c->respLen = 0;
+        c->respPos = 0;
+        c->ws = false;
+        c->wsKeys = false;
+        c->part = 0;
+        c->wsClose = false;
+        c->outWait = false;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u32 = idx;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev);
+    }
+}
+
+void HttpServer::closeConn(int idx)
+{
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, conn[idx].fd, NULL);
+    close(conn[idx].fd);
+    conn[idx].fd = -1;
+}
+
+// poll listen socket and connections, serving complete requests about the partCount partitions in part.
+//   Returns: true if a key command was processed
+bool HttpServer::poll(AlarmManager * part, int partCount)
+{
+    struct epoll_event events[HTTP_MAX_CONNS + 1];
+    bool keys = false;
+
+    if (epollFd < 0)
+        return false;
+
+    int count = epoll_wait(epollFd, events, HTTP_MAX_CONNS + 1, 0);
+    for (int i=0; i < count; i++)
+    {
+        uint32_t idx = events[i].data.u32;
+
+        if (idx == LISTEN_ID)
+        {
+            acceptConns();
+            continue;
+        }
+        t_HttpConn * c = &conn[idx];
+
+        if (c->fd >= 0 && c->respPos < c->respLen && (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR)))
+            writeConn(idx);
+        if (c->fd >= 0 && c->ws && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+            keys |= readWs(idx);
+        else if (c->fd >= 0 && c->respLen == 0 && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+            keys |= readConn(idx, part, partCount);
+    }
+
+    uint64_t ms = Clock::ms();
+    for (int i=0; i < HTTP_MAX_CONNS; i++)
+    {
+        if (conn[i].fd >= 0 && !conn[i].ws && ms - conn[i].startMs > HTTP_TIMEOUT_MS)  // slow or idle client
+            closeConn(i);
+    }
+    return keys;
+}
+
+// send the keypad display (F7 msg) of partition pPart to the websocket clients showing it, if it changed
+void HttpServer::pushFrame(AlarmManager * pPart, int hour, int min)
+{
+    char buf[HTTP_FRAME_SIZE];
+    int  p = pPart->getPartIdx();
+
+    if (epollFd < 0 || p >= partCount)
+        return;
+
+    pPart->makeF7msg(buf, hour, min);
+    if (strcmp(buf, frame[p]) == 0)
+        return;
+    strcpy(frame[p], buf);
+
+    int len = strlen(frame[p]);
+    for (int i=0; i < HTTP_MAX_CONNS; i++)
+    {
+        if (conn[i].fd >= 0 && conn[i].ws && !conn[i].wsClose && conn[i].part == p)
+            sendWs(i, WS_OP_TEXT, frame[p], len);
+    }
+}
+
+// read request data, handle the request once it is complete.  Returns: true if a key command was processed
+bool HttpServer::readConn(int idx, AlarmManager * part, int partCount)
+{
+    t_HttpConn * c = &conn[idx];
+    int n = recv(c->fd, c->req + c->reqLen, HTTP_REQ_SIZE - 1 - c->reqLen, 0);
+
+    if (n <= 0)
+    {
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+            closeConn(idx);
+        return false;
+    }
+    c->reqLen += n;
+    c->req[c->reqLen] = '\0';
+
+    const char * hdrEnd = strstr(c->req, "\r\n\r\n");
+    if (hdrEnd == NULL)
+    {
+        if (c->reqLen >= HTTP_REQ_SIZE - 1)
+        {
+            respond(c, 431, "text/plain", "headers too large\n", 18);
+            writeConn(idx);
+        }
+        return false;  // wait for the rest of the headers
+    }
+
+    const char * cl = findHeader(c->req, "Content-Length");
+    int bodyLen = (cl != NULL) ? atoi(cl) : 0;
+    int bodyStart = hdrEnd + 4 - c->req;
+    if (bodyStart + bodyLen > HTTP_REQ_SIZE - 1)
+    {
+        respond(c, 413, "text/plain", "request too large\n", 18);
+        writeConn(idx);
+        return false;
+    }
+    if (c->reqLen < bodyStart + bodyLen)
+        return false;  // wait for the rest of the body
+
+    bool keys = handleRequest(c, part, partCount);
+    writeConn(idx);
+    return keys;
+}
+
+// send response data, closing the connection when all is sent (websockets stay open)
+void HttpServer::writeConn(int idx)
+{
+    t_HttpConn * c = &conn[idx];
+    int n = send(c->fd, c->resp + c->respPos, c->respLen - c->respPos, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+    {
+        closeConn(idx);
+        return;
+    }
+    if (n > 0)
+        c->respPos += n;
+    if (c->respPos >= c->respLen)
+    {
+        if (!c->ws || c->wsClose)
+        {
+            closeConn(idx);
+            return;
+        }
+        c->respLen = 0;
+        c->respPos = 0;
+    }
+    setOutWait(idx, c->respPos < c->respLen);  // rest is sent when the socket is writable
+}
+
+// enable/disable EPOLLOUT for connection idx (websockets always read, http reads until it responds)
+void HttpServer::setOutWait(int idx, bool wait)
+{
+    t_HttpConn * c = &conn[idx];
+
+    if (c->outWait == wait)
+        return;
+    c->outWait = wait;
+
+    struct epoll_event ev;
+    ev.events = 0;
+    if (c->ws || !wait)
+        ev.events |= EPOLLIN;
+    if (wait)
+        ev.events |= EPOLLOUT;
+    ev.data.u32 = idx;
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+// queue a websocket frame to connection idx, sending now if nothing is queued.
+//   A client whose queue is full is disconnected.
+void HttpServer::sendWs(int idx, uint8_t opcode, const char * payload, int len)
+{
+    t_HttpConn * c = &conn[idx];
+
+    if (c->respPos > 0 && c->respLen + WS_MAX_HDR_SIZE + len > HTTP_RESP_SIZE)  // make room
+    {
+        memmove(c->resp, c->resp + c->respPos, c->respLen - c->respPos);
+        c->respLen -= c->respPos;
+        c->respPos = 0;
+    }
+
+    int n = wsMakeFrame(opcode, payload, len, c->resp + c->respLen, HTTP_RESP_SIZE - c->respLen);
+    if (n < 0)
+    {
+        ERR_MSG(LOG_CAT_SOCK, "websocket client not reading, closing\n");
+        closeConn(idx);
+        return;
+    }
+    bool idle = (c->respPos == c->respLen);
+    c->respLen += n;
+    if (idle)
+        writeConn(idx);
+}
+
+// switch connection idx to a websocket if the request is a valid upgrade.  Returns: false if not
+bool HttpServer::upgradeWs(int idx, const char * path)
+{
+    t_HttpConn * c = &conn[idx];
+    const char * upgrade = findHeader(c->req, "Upgrade");
+    const char * key = findHeader(c->req, "Sec-WebSocket-Key");
+    char accept[WS_ACCEPT_SIZE];
+
+    if (upgrade == NULL || strncasecmp(upgrade, "websocket", 9) != 0 || key == NULL)
+        return false;
+
+    wsAcceptKey(key, strcspn(key, " \r"), accept);
+    const char * query = strstr(path, "token=");  // browsers can't set headers on a websocket
+    c->wsKeys = (query != NULL && tokenEqual(query + 6, "&"));
+    c->ws = true;
+    c->reqLen = 0;  // req now holds received frames
+    c->respLen = snprintf(c->resp, HTTP_RESP_SIZE, "HTTP/1.1 101 Switching Protocols\r\n"
+        "Upgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n", accept);
+    c->respPos = 0;
+    alarmStats.httpRequests++;
+    INFO_MSG(LOG_CAT_SOCK, "websocket keypad connected%s\n", c->wsKeys ? "" : " (display only)");
+
+    if (frame[c->part][0] != '\0')  // show the current display right away
+        sendWs(idx, WS_OP_TEXT, frame[c->part], strlen(frame[c->part]));
+    return true;
+}
+
+// read websocket frames, passing KEYS_ messages to processKeyMsg.  Returns: true if a key command was processed
+bool HttpServer::readWs(int idx)
+{
+    t_HttpConn * c = &conn[idx];
+    bool keys = false;
+    int  used = 0;
+
+    int n = recv(c->fd, c->req + c->reqLen, HTTP_REQ_SIZE - c->reqLen, 0);
+    if (n <= 0)
+    {
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+            closeConn(idx);
+        return false;
+    }
+    c->reqLen += n;
+
+    while (c->fd >= 0 && !c->wsClose)
+    {
+        uint8_t opcode;
+        char *  payload;
+        int     len;
+        int frameLen = wsParseFrame(c->req + used, c->reqLen - used, &opcode, &payload, &len);
+        if (frameLen == 0)
+            break;  // wait for the rest of the frame
+        if (frameLen < 0)
+        {
+            ERR_MSG(LOG_CAT_SOCK, "bad websocket frame, closing\n");
+            closeConn(idx);
+            return keys;
+        }
+        used += frameLen;
+
+        if (opcode == WS_OP_TEXT)
+        {
+            char msg[SOCK_BUF_SIZE];
+            while (len > 0 && (payload[len-1] == '\n' || payload[len-1] == '\r'))
+                len--;
+            if (!c->wsKeys || len < 5 || len >= SOCK_BUF_SIZE || strncmp(payload, "KEYS_", 5) != 0)
+            {
+                ERR_MSG(LOG_CAT_SOCK, "websocket message ignored (%s)\n", c->wsKeys ? "not a KEYS_ message" : "no token");
+                continue;
+            }
+            memcpy(msg, payload, len);
+            msg[len] = '\0';
+            AlarmManager * pPart = AlarmManager::dispatchKeyMsg(msg, len);  // to the partition of the keypad
+            alarmStats.sockCmds++;
+            keys = true;
+            if (pPart != NULL && pPart->getPartIdx() != c->part && pPart->getPartIdx() < partCount)
+            {
+                c->part = pPart->getPartIdx();  // follow the keypad, show its partition from now on
+                if (frame[c->part][0] != '\0')
+                    sendWs(idx, WS_OP_TEXT, frame[c->part], strlen(frame[c->part]));
+            }
+        }
+        else if (opcode == WS_OP_PING)
+        {
+            sendWs(idx, WS_OP_PONG, payload, len);
+        }
+        else if (opcode == WS_OP_CLOSE)
+        {
+            c->wsClose = true;  // echo the status code, connection closes once it is sent
+            sendWs(idx, WS_OP_CLOSE, payload, len < 2 ? len : 2);
+        }
+    }
+
+    if (c->fd >= 0)
+    {
+        c->reqLen -= used;
+        memmove(c->req, c->req + used, c->reqLen);
+        if (c->reqLen == HTTP_REQ_SIZE)
+        {
+            ERR_MSG(LOG_CAT_SOCK, "websocket frame too large, closing\n");
+            closeConn(idx);
+        }
+    }
+    return keys;
+}
+
+// build response headers and body in the connection's response buffer
+void HttpServer::respond(t_HttpConn * c, int status, const char * type, const char * body, int bodyLen)
+{
+    const char * reason = status == 200 ? "OK" : status == 400 ? "Bad Request" : status == 401 ? "Unauthorized" :
+        status == 403 ? "Forbidden" : status == 404 ? "Not Found" : status == 405 ? "Method Not Allowed" :
+        status == 413 ? "Payload Too Large" : "Request Header Fields Too Large";
+
+    c->respLen = snprintf(c->resp, HTTP_RESP_SIZE, "HTTP/1.1 %d %s\r\nContent-Type: %s\r\n"
+        "Content-Length: %d\r\nCache-Control: no-store\r\nConnection: close\r\n\r\n", status, reason, type, bodyLen);
+    if (bodyLen > HTTP_RESP_SIZE - c->respLen)
+        bodyLen = HTTP_RESP_SIZE - c->respLen;
+    memcpy(c->resp + c->respLen, body, bodyLen);
+    c->respLen += bodyLen;
+    c->respPos = 0;
+    alarmStats.httpRequests++;
+}
+
+// check "Authorization: Bearer <token>" header.  Returns: true if token matches
+bool HttpServer::checkToken(const char * req)
+{
+    const char * auth = findHeader(req, "Authorization");
+
+    if (auth == NULL || strncmp(auth, "Bearer ", 7) != 0)
+        return false;
+    return tokenEqual(auth + 7, " \r");
+}
+
+// compare str, ended by '\0' or one of terminators, to the token.  Returns: true if token set and matches
+bool HttpServer::tokenEqual(const char * str, const char * terminators)
+{
+    int tokenLen = strlen(token);
+
+    if (tokenLen == 0)
+        return false;
+
+    uint8_t diff = 0;  // compare every byte, so response time does not reveal the matching prefix
+    for (int i=0; i < tokenLen; i++)
+    {
+        diff |= str[i] ^ token[i];
+        if (str[i] == '\0')
+            return false;
+    }
+    return diff == 0 && (str[tokenLen] == '\0' || strchr(terminators, str[tokenLen]) != NULL);
+}
+
+// handle a complete request.  Returns: true if a key command was processed
+bool HttpServer::handleRequest(t_HttpConn * c, AlarmManager * part, int partCount)
+{
+    char method[8], path[64];
+
+    if (sscanf(c->req, "%7s %63s", method, path) != 2)
+    {
+        respond(c, 400, "text/plain", "bad request\n", 12);
+        return false;
+    }
+
+    if (strcmp(path, "/status") == 0 && strcmp(method, "GET") == 0)
+    {
+        respond(c, 200, "application/json", body, renderStatus(part, partCount));
+    }
+    else if (strcmp(path, "/metrics") == 0 && strcmp(method, "GET") == 0)
+    {
+        respond(c, 200, "text/plain; version=0.0.4", body, renderMetrics(part, partCount));
+    }
+    else if (strncmp(path, "/ws", 3) == 0 && (path[3] == '\0' || path[3] == '?'))
+    {
+        if (strcmp(method, "GET") != 0)
+            respond(c, 405, "text/plain", "use GET\n", 8);
+        else if (!upgradeWs(c - conn, path))
+            respond(c, 400, "text/plain", "websocket upgrade expected\n", 27);
+    }
+    else if (strcmp(path, "/keys") == 0)
+    {
+        if (strcmp(method, "POST") != 0)
+        {
+            respond(c, 405, "text/plain", "use POST\n", 9);
+        }
+        else if (token[0] == '\0')
+        {
+            respond(c, 403, "text/plain", "no HTTP_TOKEN configured\n", 25);
+        }
+        else if (!checkToken(c->req))
+        {
+            ERR_MSG(LOG_CAT_SOCK, "http /keys request with bad token\n");
+            respond(c, 401, "text/plain", "bad token\n", 10);
+        }
+        else
+        {
+            const char * msg = strstr(c->req, "\r\n\r\n") + 4;
+            int msgLen = strcspn(msg, "\r\n");
+            if (strncmp(msg, "KEYS_", 5) != 0)
+            {
+                respond(c, 400, "text/plain", "body must be a KEYS_ message\n", 29);
+                return false;
+            }
+            ((char *)msg)[msgLen] = '\0';
+            AlarmManager * pPart = AlarmManager::dispatchKeyMsg(msg, msgLen);  // to the partition of the keypad
+            if (pPart == NULL)
+            {
+                respond(c, 400, "text/plain", "keypad is in no partition\n", 26);
+                return false;
+            }
+            int len = snprintf(body, HTTP_RESP_SIZE, "{\"ok\":true,\"version\":%u}\n", pPart->getStateVersion());
+            respond(c, 200, "application/json", body, len);
+            return true;
+        }
+    }
+    else
+    {
+        respond(c, 404, "text/plain", "not found\n", 10);
+    }
+    return false;
+}
+
+// render /status JSON into body.  The house fields are those of the first partition, except
+//   version (sum of the partitions'), ready (all partitions) and alarm (any partition).
+//   Returns: body length
+int HttpServer::renderStatus(AlarmManager * part, int partCount)
+{
+    const t_AlarmState * s = part[0].getState();
+    Loop * pLoop = pConfig->getLoop();
+    uint32_t open = openLoops(part, partCount);
+    uint32_t version = 0;
+    bool ready = true, alarm = false;
+    int size = HTTP_RESP_SIZE - 256;  // leave room for headers
+    int len = 0;
+
+    for (int p=0; p < partCount; p++)
+    {
+        version += part[p].getState()->version;
+        ready = ready && part[p].getState()->ready;
+        alarm = alarm || part[p].getState()->alarm;
+    }
+    len = appendf(body, len, size, "{\"epoch\":%u,\"version\":%u,\"uptime\":%ld,\"armed\":\"%s\","
+        "\"ready\":%s,\"alarm\":%s,\"chime\":%s,\"power\":%s,\"tone\":%u,\"line1\":",
+        part[0].getStateEpoch(), version, (long)(Clock::wall() - part[0].getStateEpoch()),
+        s->armed < 4 ? ARMED_NAMES[s->armed] : "unknown", ready ? "true" : "false",
+        alarm ? "true" : "false", s->chime ? "true" : "false", s->power ? "true" : "false", s->tone);
+    len = appendJson(body, len, size, s->line1);
+    len = appendf(body, len, size, ",\"line2\":");
+    len = appendJson(body, len, size, s->line2);
+    len = appendf(body, len, size, ",\"partitions\":[");
+    for (int p=0; p < partCount; p++)
+    {
+        const t_AlarmState * ps = part[p].getState();
+        len = appendf(body, len, size, "%s{\"name\":", p > 0 ? "," : "");
+        len = appendJson(body, len, size, pConfig->getPartition()->name[p]);
+        len = appendf(body, len, size, ",\"version\":%u,\"armed\":\"%s\",\"ready\":%s,\"alarm\":%s,\"chime\":%s,"
+            "\"tone\":%u,\"open\":%u,\"line1\":", ps->version, ps->armed < 4 ? ARMED_NAMES[ps->armed] : "unknown",
+            ps->ready ? "true" : "false", ps->alarm ? "true" : "false", ps->chime ? "true" : "false", ps->tone,
+            ps->loopMask);
+        len = appendJson(body, len, size, ps->line1);
+        len = appendf(body, len, size, ",\"line2\":");
+        len = appendJson(body, len, size, ps->line2);
+        len = appendf(body, len, size, "}");
+    }
+    len = appendf(body, len, size, "],\"zones\":[");
+    for (int i=0; i < pConfig->getLoopCount(); i++)
+    {
+        len = appendf(body, len, size, "%s{\"name\":", i > 0 ? "," : "");
+        len = appendJson(body, len, size, pLoop->name[i]);
+        len = appendf(body, len, size, ",\"open\":%s}", (open >> i) & 0x1 ? "true" : "false");
+    }
+    return appendf(body, len, size, "]}\n");
+}
+
+// render /metrics in Prometheus text format into body.  The state gauges have a partition
+//   label, empty (the same as no label) for the default partition.  Returns: body length
+int HttpServer::renderMetrics(AlarmManager * part, int partCount)
+{
+    static const struct {
+        const char * name;
+        const char * help;
+        uint32_t   * value;
+    } counters[] = {
+        { "alarm_serial_errors_total",    "Bad or unexpected serial messages and short writes.", &alarmStats.serialErrors },
+        { "alarm_f7_messages_total",      "F7 messages sent to keypads.",                        &alarmStats.f7Sent },
+        { "alarm_key_messages_total",     "KEYS messages processed.",                            &alarmStats.keyMsgs },
+        { "alarm_loop_changes_total",     "Sense loop open/close changes.",                      &alarmStats.loopChanges },
+        { "alarm_loop_noise_total",       "Sense loop changes ignored as noise.",                &alarmStats.loopNoise },
+        { "alarm_alerts_sent_total",      "Alert emails sent.",                                  &alarmStats.alertsSent },
+        { "alarm_alert_failures_total",   "Alert emails that failed to send.",                   &alarmStats.alertFailures },
+        { "alarm_socket_commands_total",  "Commands received on sockets.",                       &alarmStats.sockCmds },
+        { "alarm_http_requests_total",    "HTTP requests served.",                               &alarmStats.httpRequests },
+    };
+    Loop * pLoop = pConfig->getLoop();
+    const char ** partName = pConfig->getPartition()->name;
+    uint32_t open = openLoops(part, partCount);
+    int size = HTTP_RESP_SIZE - 256;  // leave room for headers
+    int len = 0;
+
+    for (unsigned i=0; i < sizeof(counters)/sizeof(counters[0]); i++)
+    {
+        len = appendf(body, len, size, "# HELP %s %s\n# TYPE %s counter\n%s %u\n", counters[i].name,
+            counters[i].help, counters[i].name, counters[i].name, *counters[i].value);
+    }
+
+    len = appendf(body, len, size, "# HELP alarm_uptime_seconds Time since the alarm daemon started.\n"
+        "# TYPE alarm_uptime_seconds gauge\nalarm_uptime_seconds %ld\n", (long)(Clock::wall() - part[0].getStateEpoch()));
+    len = appendf(body, len, size, "# HELP alarm_state_version Published alarm state version.\n"
+        "# TYPE alarm_state_version counter\n");
+    for (int p=0; p < partCount; p++)
+    {
+        len = appendf(body, len, size, "alarm_state_version{partition=");
+        len = appendLabel(body, len, size, partName[p]);
+        len = appendf(body, len, size, "} %u\n", part[p].getState()->version);
+    }
+    len = appendf(body, len, size, "# HELP alarm_armed Armed mode (1 for the current mode).\n# TYPE alarm_armed gauge\n");
+    for (int p=0; p < partCount; p++)
+    {
+        for (int i=0; i < 4; i++)
+        {
+            len = appendf(body, len, size, "alarm_armed{partition=");
+            len = appendLabel(body, len, size, partName[p]);
+            len = appendf(body, len, size, ",mode=\"%s\"} %d\n", ARMED_NAMES[i], part[p].getState()->armed == i);
+        }
+    }
+    len = appendf(body, len, size, "# HELP alarm_alarm Alarm is sounding.\n# TYPE alarm_alarm gauge\n");
+    for (int p=0; p < partCount; p++)
+    {
+        len = appendf(body, len, size, "alarm_alarm{partition=");
+        len = appendLabel(body, len, size, partName[p]);
+        len = appendf(body, len, size, "} %d\n", part[p].getState()->alarm);
+    }
+    len = appendf(body, len, size, "# HELP alarm_ready All zones closed, ready to arm.\n# TYPE alarm_ready gauge\n");
+    for (int p=0; p < partCount; p++)
+    {
+        len = appendf(body, len, size, "alarm_ready{partition=");
+        len = appendLabel(body, len, size, partName[p]);
+        len = appendf(body, len, size, "} %d\n", part[p].getState()->ready);
+    }
+    len = appendf(body, len, size, "# HELP alarm_zone_open Zone (sense loop) is open.\n# TYPE alarm_zone_open gauge\n");
+    for (int i=0; i < pConfig->getLoopCount(); i++)
+    {
+        len = appendf(body, len, size, "alarm_zone_open{zone=");
+        len = appendLabel(body, len, size, pLoop->name[i]);
+        len = appendf(body, len, size, "} %u\n", (open >> i) & 0x1);
+    }
+    return len;
+}
+
+// end of HttpServer.cpp
@@ -0,0 +1,110 @@
+// The file HttpServer.h is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "stdafx.h"
+#include "Config.h"
+#include "AlarmManager.h"
+
+// Minimal HTTP/1.1 server polled from the main loop (never blocks), listening on HTTP_LISTEN
+// from alarm_config:
+//   GET  /status   JSON snapshot of the alarm state, the house and each partition
+//   GET  /metrics  Prometheus text format health counters and state gauges (partition label)
+//   POST /keys     body is a KEYS_ message, needs "Authorization: Bearer <HTTP_TOKEN>"
+//   GET  /ws       WebSocket for browser keypads, "/ws?token=<HTTP_TOKEN>" to allow key events
+// One request per connection (Connection: close).  Requests and responses use buffers
+// allocated once with the connection slots.
+//
+// A WebSocket connection stays open.  It is sent the keypad display (the F7 message) each time
+// it changes, and may send KEYS_ messages in the same format the Arduino uses.  With partitions
+// it shows the partition of the keypad its last KEYS_ message came from, the first partition
+// until it sends one.  The slot's req buffer then holds
+// partial received frames and resp queues unsent frames; a client that lets resp fill up is
+// disconnected.
+
+static const int HTTP_MAX_CONNS  = 16;     // max simultaneous connections (including websockets)
+static const int HTTP_REQ_SIZE   = 2048;   // max request size (headers + body)
+static const int HTTP_RESP_SIZE  = 8192;   // max response size (headers + body)
+static const int HTTP_FRAME_SIZE = 160;    // max size of a keypad display frame
+static const uint32_t HTTP_TIMEOUT_MS = 5000;  // close connections idle this long (not websockets)
+
+struct t_HttpConn {
+    int      fd;                    // -1 if slot not in use
+    uint64_t startMs;               // ms timestamp of accept
+    int      reqLen;                // bytes in req
+    char     req[HTTP_REQ_SIZE];
+    int      respLen;               // bytes in resp, 0 until request handled
+    int      respPos;               // bytes of resp sent
+    char     resp[HTTP_RESP_SIZE];
+    bool     ws;                    // connection upgraded to a websocket
+    bool     wsKeys;                // websocket client gave the token, key events allowed
+    bool     wsClose;               // close frame queued, close once it is sent
+    bool     outWait;               // waiting for socket to be writable
+    int      part;                  // partition whose display a websocket is sent
+};
+
+class HttpServer
+{
+public:
+    HttpServer(void)
+    {
+        listenSock = -1;
+        epollFd = -1;
+        partCount = 0;
+        frame = NULL;
+        for (int i=0; i < HTTP_MAX_CONNS; i++)
+            conn[i].fd = -1;
+    }
+
+    bool init(const char * listenAddr, const char * token, Config * pConfig);
+    void fini(void);
+
+    bool poll(AlarmManager * part, int partCount);
+    void setConfig(Config * pConfig)  // config reloaded
+    {
+        this->pConfig = pConfig;
+    }
+    void pushFrame(AlarmManager * pPart, int hour, int min);
+
+private:
+    void acceptConns(void);
+    void closeConn(int idx);
+    bool readConn(int idx, AlarmManager * part, int partCount);
+    void writeConn(int idx);
+    void setOutWait(int idx, bool wait);
+    bool handleRequest(t_HttpConn * c, AlarmManager * part, int partCount);
+    void respond(t_HttpConn * c, int status, const char * type, const char * body, int bodyLen);
+    int  renderStatus(AlarmManager * part, int partCount);
+    int  renderMetrics(AlarmManager * part, int partCount);
+    bool checkToken(const char * req);
+    bool tokenEqual(const char * str, const char * terminators);
+    bool upgradeWs(int idx, const char * path);
+    bool readWs(int idx);
+    void sendWs(int idx, uint8_t opcode, const char * payload, int len);
+
+    int      listenSock;
+    int      epollFd;
+    char     token[MAX_PARM_LENGTH];   // bearer token for /keys, empty disables /keys
+    Config * pConfig;
+
+    t_HttpConn conn[HTTP_MAX_CONNS];
+    char       body[HTTP_RESP_SIZE];   // response body rendered here, then copied after headers
+    int        partCount;
+    char    (* frame)[HTTP_FRAME_SIZE]; // per partition, keypad display last sent to websockets
+};
+
+// end of HttpServer.h
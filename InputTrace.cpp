@@ -0,0 +1,325 @@
+// The file InputTrace.cpp is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "stdafx.h"
+#include <string.h>
+#include <zlib.h>
+
+#include "InputTrace.h"
+#include "Config.h"
+#include "Clock.h"
+#include "logMsg.h"
+
+// start a new trace at path, the previous one is kept as path.1.  Returns: true on success
+bool InputTrace::init(const char * path, const char * configPath)
+{
+    char old[MAX_PARM_LENGTH + 4];
+
+    snprintf(old, sizeof(old), "%s.1", path);
+    rename(path, old);  // keep the trace of the previous run, it may hold the incident
+
+    fp = fopen(path, "wb");
+    if (fp == NULL)
+    {
+        fprintf(stderr, "Failed to create input trace '%s'\n", path);
+        return false;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic     = TRACE_MAGIC;
+    header.layout    = TRACE_LAYOUT;
+    header.configCrc = fileCrc(configPath);
+    header.startMs   = Clock::ms();
+    header.startWall = Clock::wall();
+    lastMs = passStartMs = header.startMs;
+    passLen = 0;
+    passInput = false;
+
+    if (fwrite(&header, sizeof(header), 1, fp) != 1 || fflush(fp) != 0)
+    {
+        fprintf(stderr, "Failed to write input trace '%s'\n", path);
+        fini();
+        return false;
+    }
+    return true;
+}
+
+void InputTrace::fini(void)
+{
+    if (fp != NULL)
+    {
+        fclose(fp);
+        fp = NULL;
+    }
+}
+
+// add the type and time of a record to the pass buffer, writing out the buffer first if the
+//   largest record might not fit
+void InputTrace::put(uint8_t type)
+{
+    uint64_t ms = Clock::ms();
+
+    if (passLen > TRACE_PASS_SIZE - TRACE_TEXT_SIZE - 16)
+        flushPass();  // long pass, keep what is there
+    pass[passLen++] = type;
+    putVarint(ms - lastMs);
+    lastMs = ms;
+    if (type != TRACE_CHECK)
+        passInput = true;
+}
+
+void InputTrace::putVarint(uint64_t val)
+{
+    while (val >= 0x80)
+    {
+        pass[passLen++] = (val & 0x7F) | 0x80;
+        val >>= 7;
+    }
+    pass[passLen++] = val;
+}
+
+void InputTrace::putText(const char * text, int len)
+{
+    len = min(len, TRACE_TEXT_SIZE - 1);
+    putVarint(len);
+    memcpy(pass + passLen, text, len);
+    passLen += len;
+}
+
+// record a sample that changed the loop mask or was ignored as noise
+void InputTrace::loops(uint32_t mask, uint32_t noise)
+{
+    if (fp == NULL)
+        return;
+    put(TRACE_LOOPS);
+    putVarint(mask);
+    putVarint(noise);
+}
+
+// record a KEYS message from any source (serial, socket, http)
+void InputTrace::keys(const char * buf, int len)
+{
+    if (fp == NULL)
+        return;
+    put(TRACE_KEYS);
+    putText(buf, len);
+}
+
+// record a control socket arm/disarm
+void InputTrace::control(uint8_t cmd, uint8_t partIdx, const char * who)
+{
+    if (fp == NULL)
+        return;
+    put(TRACE_CONTROL);
+    pass[passLen++] = cmd;
+    pass[passLen++] = partIdx;
+    putText(who, strlen(who));
+}
+
+// record that the partitions are about to check their loops and timeouts
+void InputTrace::check(void)
+{
+    if (fp == NULL)
+        return;
+    put(TRACE_CHECK);
+}
+
+// record an F7 msg sent for partition part
+void InputTrace::frame(int part, int hour, int min)
+{
+    if (fp == NULL)
+        return;
+    put(TRACE_F7);
+    pass[passLen++] = part;
+    pass[passLen++] = hour;
+    pass[passLen++] = min;
+}
+
+// record a config reload, replay can only follow it with the same config file
+void InputTrace::reload(const char * configPath)
+{
+    if (fp == NULL)
+        return;
+    put(TRACE_RELOAD);
+    putVarint(fileCrc(configPath));
+}
+
+// record the state partition part resumed from the previous run, with the delay time it had run
+//   and the time down combined
+void InputTrace::resume(int part, const t_ArmPart * pSaved, uint64_t downMs)
+{
+    if (fp == NULL)
+        return;
+    put(TRACE_RESUME);
+    pass[passLen++] = part;
+    putVarint(pSaved->state | pSaved->mode << 8 | pSaved->chime << 16);
+    putVarint(pSaved->loopMask);
+    putVarint(min(pSaved->timerMs + downMs, (uint64_t)0xFFFFFFFF));
+}
+
+// end of a main loop pass.  changed is true if a check changed the alarm state.  Passes with no
+//   input that changed nothing are dropped
+void InputTrace::endPass(bool changed)
+{
+    if (fp == NULL)
+        return;
+    if (passInput || changed)
+    {
+        put(TRACE_END);
+        flushPass();
+        if (fp != NULL && fflush(fp) != 0)
+        {
+            ERR_MSG(LOG_CAT_ALARM, "input trace write failed, trace stopped\n");
+            fini();
+        }
+    }
+    passLen = 0;
+    passInput = false;
+    lastMs = passStartMs;  // dropped records don't count
+}
+
+// write the pass buffer to the file
+void InputTrace::flushPass(void)
+{
+    if (passLen > 0 && fwrite(pass, passLen, 1, fp) != 1)
+    {
+        ERR_MSG(LOG_CAT_ALARM, "input trace write failed, trace stopped\n");
+        fini();
+    }
+    passLen = 0;
+    passStartMs = lastMs;
+}
+
+// open a trace for replay.  Returns: false if it can't be read or is not a trace
+bool InputTrace::openRead(const char * path)
+{
+    fp = fopen(path, "rb");
+    if (fp == NULL)
+        return false;
+
+    if (fread(&header, sizeof(header), 1, fp) != 1 || header.magic != TRACE_MAGIC || header.layout != TRACE_LAYOUT)
+    {
+        closeRead();
+        return false;
+    }
+    lastMs = header.startMs;
+    return true;
+}
+
+void InputTrace::closeRead(void)
+{
+    fini();
+}
+
+bool InputTrace::getVarint(uint64_t * pVal)
+{
+    uint64_t val = 0;
+    int c;
+
+    for (int shift=0; shift < 70; shift += 7)
+    {
+        if ((c = getc(fp)) == EOF)
+            return false;
+        val |= (uint64_t)(c & 0x7F) << shift;
+        if ((c & 0x80) == 0)
+        {
+            *pVal = val;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool InputTrace::getVarint(uint32_t * pVal)
+{
+    uint64_t val;
+
+    if (!getVarint(&val) || val > 0xFFFFFFFF)
+        return false;
+    *pVal = val;
+    return true;
+}
+
+// read the next record.  Returns: false at the end of the trace (or at a record cut short by a crash)
+bool InputTrace::next(t_TraceRec * pRec)
+{
+    uint64_t delta;
+    int      type = getc(fp);
+
+    if (type == EOF || type == 0 || type >= TRACE_TYPE_COUNT || !getVarint(&delta))
+        return false;
+
+    lastMs += delta;
+    pRec->type = type;
+    pRec->ms = lastMs;
+    pRec->len = 0;
+    pRec->text[0] = '\0';
+
+    bool ok = true;
+    uint32_t len = 0;
+    switch (type)
+    {
+        case TRACE_LOOPS:
+            ok = getVarint(&pRec->arg[0]) && getVarint(&pRec->arg[1]);
+            break;
+
+        case TRACE_CONTROL:
+            ok = (int)(pRec->arg[0] = getc(fp)) != EOF && (int)(pRec->arg[1] = getc(fp)) != EOF;
+            // fall through, who follows the command and partition
+        case TRACE_KEYS:
+            ok = ok && getVarint(&len) && len < (uint32_t)TRACE_TEXT_SIZE && fread(pRec->text, 1, len, fp) == len;
+            pRec->len = len;
+            pRec->text[ok ? len : 0] = '\0';
+            break;
+
+        case TRACE_F7:
+            for (int i=0; i < 3; i++)
+                ok = ok && (int)(pRec->arg[i] = getc(fp)) != EOF;
+            break;
+
+        case TRACE_RELOAD:
+            ok = getVarint(&pRec->arg[0]);
+            break;
+
+        case TRACE_RESUME:
+            ok = (int)(pRec->arg[0] = getc(fp)) != EOF;
+            for (int i=1; i < 4; i++)
+                ok = ok && getVarint(&pRec->arg[i]);
+            break;
+
+        default:  // CHECK, END have no fields
+            break;
+    }
+    return ok;
+}
+
+// returns crc32 of the file at path, 0 if it can't be read
+uint32_t InputTrace::fileCrc(const char * path)
+{
+    FILE * f = fopen(path, "rb");
+    uint8_t buf[1024];
+    uLong crc = crc32(0, NULL, 0);
+    size_t n;
+
+    if (f == NULL)
+        return 0;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        crc = crc32(crc, buf, n);
+    fclose(f);
+    return crc;
+}
+
+// end of InputTrace.cpp
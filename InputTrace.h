@@ -0,0 +1,120 @@
+// The file InputTrace.h is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "stdafx.h"
+#include "ArmStore.h"
+
+// Binary trace of the inputs of the alarm core, replayed by alarmReplay to reproduce a field
+// incident.  Each main loop pass collects its records in a buffer: sampled loop changes, KEYS
+// messages, control socket arm/disarm, the point the partitions check their loops and
+// timeouts, the F7 messages sent, and the armed state resumed at startup (see ArmStore).  The buffer is written only if the pass had an input or
+// a check changed something.  A pass that isn't written leaves the alarm state as it was, so
+// replaying the written passes at their recorded times gives the same F7 messages, alerts and
+// gpio writes, and an idle alarm writes nothing.
+//
+// The file is a t_TraceHeader followed by records: a type byte, the ms since the previous
+// record and the fields of the type.  Numbers are varints (7 bits per byte, low bits first),
+// text is a varint length and the bytes.  The trace of the previous run is kept as path.1.
+
+static const uint32_t TRACE_MAGIC     = 0x31525441;  // "ATR1"
+static const uint32_t TRACE_LAYOUT    = 4;           // bump when a record changes
+static const int      TRACE_PASS_SIZE = 4096;        // records of one main loop pass are buffered
+static const int      TRACE_TEXT_SIZE = 256;         // longest KEYS message or control user (SOCK_BUF_SIZE)
+
+// record types
+enum {
+    TRACE_LOOPS = 1,    // loop mask and noise mask of a sample that changed something
+    TRACE_KEYS,         // KEYS message, as passed to AlarmManager::dispatchKeyMsg
+    TRACE_CONTROL,      // control socket arm/disarm: CTL_CMD_*, partition, who
+    TRACE_CHECK,        // partitions check their loops and timeouts
+    TRACE_F7,           // F7 msg sent: partition, hour, min
+    TRACE_RELOAD,       // config reloaded: crc32 of the new config file
+    TRACE_RESUME,       // saved state resumed: partition, state | mode << 8 | chime << 16, loop mask, delay ms run
+    TRACE_END,          // end of pass, partitions publish their state
+    TRACE_TYPE_COUNT
+};
+
+struct t_TraceHeader {
+    uint32_t magic;         // TRACE_MAGIC
+    uint32_t layout;        // TRACE_LAYOUT
+    uint32_t configCrc;     // crc32 of the config file the alarm started with
+    uint64_t startMs;       // Clock::ms when the trace started
+    int64_t  startWall;     // Clock::wall when the trace started
+};
+
+struct t_TraceRec {
+    uint8_t  type;          // TRACE_*
+    uint64_t ms;            // Clock::ms of the record
+    uint32_t arg[4];        // LOOPS: mask, noise  CONTROL: cmd, partition  F7: partition, hour, min  RELOAD: crc  RESUME: see above
+    int      len;           // KEYS, CONTROL: length of text
+    char     text[TRACE_TEXT_SIZE];  // null terminated
+};
+
+class InputTrace
+{
+public:
+    InputTrace(void)
+    {
+        fp = NULL;
+        passLen = 0;
+        passInput = false;
+    }
+
+    // writer (daemon)
+    bool init(const char * path, const char * configPath);
+    void fini(void);
+    void loops(uint32_t mask, uint32_t noise);
+    void keys(const char * buf, int len);
+    void control(uint8_t cmd, uint8_t partIdx, const char * who);
+    void check(void);
+    void frame(int part, int hour, int min);
+    void reload(const char * configPath);
+    void resume(int part, const t_ArmPart * pSaved, uint64_t downMs);
+    void endPass(bool changed);
+
+    // reader (replay)
+    bool openRead(const char * path);
+    void closeRead(void);
+    bool next(t_TraceRec * pRec);
+    const t_TraceHeader * getHeader(void)
+    {
+        return &header;
+    }
+
+    static uint32_t fileCrc(const char * path);
+
+private:
+    void put(uint8_t type);
+    void putVarint(uint64_t val);
+    void putText(const char * text, int len);
+    void flushPass(void);
+    bool getVarint(uint64_t * pVal);
+    bool getVarint(uint32_t * pVal);
+
+    FILE        * fp;
+    t_TraceHeader header;
+    uint64_t      lastMs;                    // time of the previous record (written or read)
+    uint64_t      passStartMs;               // lastMs before the pass, restored if the pass is dropped
+    uint8_t       pass[TRACE_PASS_SIZE];     // records of the current pass
+    int           passLen;
+    bool          passInput;                 // pass has a record besides TRACE_CHECK
+};
+
+extern InputTrace inputTrace;  // the daemon's trace, closed unless INPUT_TRACE is set (see main.cpp)
+
+// end of InputTrace.h
@@ -0,0 +1,93 @@
+// The file LineBuf.cpp is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "stdafx.h"
+#include <string.h>
+
+#include "LineBuf.h"
+#include "logMsg.h"
+
+// returns pointer to free space for reading into, and its size in avail
+char * LineBuf::getSpace(int * avail)
+{
+    if (start > 0 && start + len == LINE_BUF_SIZE)  // no room at end, move unprocessed bytes down
+    {
+        memmove(buf, buf + start, len);
+        start = 0;
+    }
+    else if (len == 0)
+    {
+        start = 0;
+    }
+
+    if (len == LINE_BUF_SIZE)  // buffer full of one partial line, drop it and the rest of the line
+    {
+        ERR_MSG(LOG_CAT_SOCK, "Socket message too long, discarded\n");
+        discard = true;
+        start = 0;
+        len = 0;
+        scanned = 0;
+    }
+    *avail = LINE_BUF_SIZE - (start + len);
+    return buf + start + len;
+}
+
+// count bytes were read into the space from getSpace
+void LineBuf::added(int count)
+{
+    len += count;
+}
+
+// copy the next complete line (without newline) to line.  Returns: line length, -1 if no complete line
+int LineBuf::nextLine(char * line, int lineSize)
+{
+    while (scanned < len)
+    {
+        char * p = (char *)memchr(buf + start + scanned, '\n', len - scanned);
+        if (p == NULL)
+        {
+            scanned = len;
+            break;
+        }
+
+        int lineLen = p - (buf + start);
+        char * text = buf + start;
+        start += lineLen + 1;
+        len -= lineLen + 1;
+        scanned = 0;
+
+        if (discard)  // end of an overlong line
+        {
+            discard = false;
+            continue;
+        }
+        if (lineLen > 0 && text[lineLen-1] == '\r')
+            lineLen--;
+        if (lineLen == 0)  // skip blank lines
+            continue;
+        if (lineLen >= lineSize)
+        {
+            ERR_MSG(LOG_CAT_SOCK, "Socket message too long, discarded\n");
+            continue;
+        }
+        memcpy(line, text, lineLen);
+        line[lineLen] = '\0';
+        return lineLen;
+    }
+    return -1;
+}
+
+// end of LineBuf.cpp
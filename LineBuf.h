@@ -0,0 +1,55 @@
+// The file LineBuf.h is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "stdafx.h"
+
+// Reassembles newline delimited messages from a byte stream.  Data read from a socket is
+// added with getSpace()/added(), complete non-blank lines are taken with nextLine().  A line longer
+// than the buffer is discarded up to its newline.
+
+static const int LINE_BUF_SIZE = 512;   // bytes of partial and unprocessed lines held
+
+class LineBuf
+{
+public:
+    LineBuf(void)
+    {
+        init();
+    }
+
+    void init(void)
+    {
+        start = 0;
+        len = 0;
+        scanned = 0;
+        discard = false;
+    }
+
+    char * getSpace(int * avail);
+    void   added(int count);
+    int    nextLine(char * line, int lineSize);
+
+private:
+    char buf[LINE_BUF_SIZE];
+    int  start;      // offset of first unprocessed byte
+    int  len;        // unprocessed bytes from start
+    int  scanned;    // bytes from start already searched for a newline
+    bool discard;    // dropping the rest of an overlong line
+};
+
+// end of LineBuf.h
@@ -0,0 +1,281 @@
+// The file LogRing.cpp is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "stdafx.h"
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "LogRing.h"
+
+static const int REC_HEAD_SIZE = 8;     // pos + len + check
+static const int REC_TAIL_SIZE = 2;     // trailing len
+static const int REC_MAX_TEXT  = 1024;  // longer records are truncated
+
+// map the ring file at path (anonymous memory if path is NULL).  Returns: true on success
+bool LogRing::init(const char * path, uint32_t dataSize, bool readOnly)
+{
+    int fd = -1;
+
+    fini();
+    mapSize = 2 * sizeof(t_LogRingHeader) + dataSize;
+
+    if (path != NULL)
+    {
+        fd = open(path, readOnly ? O_RDONLY : O_RDWR | O_CREAT, 0644);
+        if (fd < 0)
+        {
+            fprintf(stderr, "LogRing failed to open '%s'\n", path);
+        }
+        else
+        {
+            struct stat st;
+            if (fstat(fd, &st) != 0)
+            {
+                close(fd);
+                fd = -1;
+            }
+            else if (readOnly)
+            {
+                mapSize = st.st_size;  // reader takes whatever size the daemon created
+            }
+            else if ((size_t)st.st_size != mapSize && ftruncate(fd, mapSize) != 0)  // new file or size changed
+            {
+                fprintf(stderr, "LogRing failed to size '%s'\n", path);
+                close(fd);
+                fd = -1;
+            }
+        }
+    }
+
+    if (fd >= 0 && mapSize > 2 * sizeof(t_LogRingHeader))
+    {
+        pMap = (uint8_t *)mmap(NULL, mapSize, readOnly ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (pMap == MAP_FAILED)
+            pMap = NULL;
+    }
+    if (fd >= 0)
+        close(fd);
+
+    if (pMap == NULL)
+    {
+        if (readOnly)
+            return false;
+        // no usable file, keep the ring in memory.  It will not survive a crash
+        mapSize = 2 * sizeof(t_LogRingHeader) + dataSize;
+        pMap = (uint8_t *)mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (pMap == MAP_FAILED)
+        {
+            pMap = NULL;
+            return false;
+        }
+    }
+    pData = pMap + 2 * sizeof(t_LogRingHeader);
+
+    if (!readHeader() || (!readOnly && hdr.dataSize != dataSize))
+    {
+        if (readOnly)
+        {
+            fini();
+            return false;
+        }
+        memset(&hdr, 0, sizeof(hdr));  // no valid header, start an empty ring
+        hdr.magic = LOG_RING_MAGIC;
+        hdr.dataSize = dataSize;
+        writeHeader();
+    }
+    return true;
+}
+
+void LogRing::fini(void)
+{
+    if (pMap != NULL)
+    {
+        munmap(pMap, mapSize);
+        pMap = NULL;
+        pData = NULL;
+    }
+}
+
+// 32-bit FNV-1a hash
+uint32_t LogRing::checksum(const void * buf, int len)
+{
+    const uint8_t * p = (const uint8_t *)buf;
+    uint32_t hash = 2166136261u;
+
+    for (int i=0; i < len; i++)
+    {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// pick the valid header slot with the highest seq.  Returns: false if neither slot is valid
+bool LogRing::readHeader(void)
+{
+    const t_LogRingHeader * slot = (const t_LogRingHeader *)pMap;
+    int best = -1;
+
+    for (int i=0; i < 2; i++)
+    {
+        if (slot[i].magic == LOG_RING_MAGIC &&
+            slot[i].dataSize + 2 * sizeof(t_LogRingHeader) <= mapSize &&
+            slot[i].checksum == checksum(&slot[i], offsetof(t_LogRingHeader, checksum)) &&
+            (best < 0 || (int32_t)(slot[i].seq - slot[best].seq) > 0))
+        {
+            best = i;
+        }
+    }
+    if (best < 0)
+        return false;
+    hdr = slot[best];
+    return true;
+}
+
+// write the header to the slot not holding the previous header
+void LogRing::writeHeader(void)
+{
+    hdr.seq++;
+    hdr.checksum = checksum(&hdr, offsetof(t_LogRingHeader, checksum));
+    memcpy(pMap + (hdr.seq & 1) * sizeof(t_LogRingHeader), &hdr, sizeof(hdr));
+}
+
+// copy len bytes into the data area at ring position pos, wrapping at the end
+void LogRing::copyIn(uint64_t pos, const void * src, int len)
+{
+    uint32_t off = pos % hdr.dataSize;
+    uint32_t first = (uint32_t)len < hdr.dataSize - off ? len : hdr.dataSize - off;
+
+    memcpy(pData + off, src, first);
+    memcpy(pData, (const uint8_t *)src + first, len - first);
+}
+
+// copy len bytes out of the data area at ring position pos, wrapping at the end
+void LogRing::copyOut(uint64_t pos, void * dst, int len)
+{
+    uint32_t off = pos % hdr.dataSize;
+    uint32_t first = (uint32_t)len < hdr.dataSize - off ? len : hdr.dataSize - off;
+
+    memcpy(dst, pData + off, first);
+    memcpy((uint8_t *)dst + first, pData, len - first);
+}
+
+// append a text record to the ring, overwriting the oldest records
+void LogRing::append(const char * text, int len)
+{
+    if (pData == NULL || len <= 0)
+        return;
+    if (len > REC_MAX_TEXT)
+        len = REC_MAX_TEXT;
+
+    uint32_t pos = (uint32_t)hdr.writePos;
+    uint16_t len16 = len;
+    uint16_t check = checksum(text, len) ^ pos;
+
+    copyIn(hdr.writePos, &pos, 4);
+    copyIn(hdr.writePos + 4, &len16, 2);
+    copyIn(hdr.writePos + 6, &check, 2);
+    copyIn(hdr.writePos + REC_HEAD_SIZE, text, len);
+    copyIn(hdr.writePos + REC_HEAD_SIZE + len, &len16, 2);
+
+    hdr.writePos += REC_HEAD_SIZE + len + REC_TAIL_SIZE;  // record is complete before header moves
+    writeHeader();
+}
+
+// find the start of the record ending at ring position end.  Returns: false if record is not valid
+bool LogRing::recordAt(uint64_t end, uint64_t * start)
+{
+    uint16_t len, len2, check;
+    uint32_t pos;
+    char     text[REC_MAX_TEXT];
+
+    if (end < (uint64_t)(REC_HEAD_SIZE + REC_TAIL_SIZE))
+        return false;
+    copyOut(end - REC_TAIL_SIZE, &len, 2);
+    if (len == 0 || len > REC_MAX_TEXT || end < (uint64_t)(REC_HEAD_SIZE + len + REC_TAIL_SIZE))
+        return false;
+
+    *start = end - REC_HEAD_SIZE - len - REC_TAIL_SIZE;
+    if (hdr.writePos - *start > hdr.dataSize)
+        return false;  // record has been partially overwritten
+
+    copyOut(*start, &pos, 4);
+    copyOut(*start + 4, &len2, 2);
+    copyOut(*start + 6, &check, 2);
+    copyOut(*start + REC_HEAD_SIZE, text, len);
+
+    return pos == (uint32_t)*start && len2 == len && check == (uint16_t)(checksum(text, len) ^ pos);
+}
+
+// pass the newest maxRecs records written at or after fromPos to func, oldest first.
+//   Returns: record count, -1 if there was no memory to walk maxRecs records
+int LogRing::readRecords(uint64_t fromPos, int maxRecs, t_LogRingFunc func, void * ctx)
+{
+    if (pData == NULL || maxRecs <= 0)
+        return 0;
+
+    uint64_t * starts = (uint64_t *)malloc(maxRecs * sizeof(uint64_t));
+    if (starts == NULL)
+        return -1;
+
+    // walk back from the write position until the oldest valid record
+    int count = 0;
+    uint64_t end = hdr.writePos;
+    while (count < maxRecs && end > fromPos && recordAt(end, &starts[count]) && starts[count] >= fromPos)
+    {
+        end = starts[count++];
+    }
+
+    char text[REC_MAX_TEXT + 1];
+    for (int i=count-1; i >= 0; i--)
+    {
+        uint16_t len;
+        copyOut(starts[i] + 4, &len, 2);
+        copyOut(starts[i] + REC_HEAD_SIZE, text, len);
+        text[len] = '\0';
+        func(text, len, ctx);
+    }
+    free(starts);
+    return count;
+}
+
+// mark all records as written to alarmLog
+void LogRing::setFlushed(void)
+{
+    hdr.flushPos = hdr.writePos;
+    writeHeader();
+}
+
+// start a new daemon run.  Records from earlier runs stay in the ring but are considered flushed
+void LogRing::newGeneration(void)
+{
+    hdr.generation++;
+    hdr.flushPos = hdr.writePos;
+    writeHeader();
+}
+
+// schedule write back of the mapped file to disk, or if wait write it back before returning
+void LogRing::sync(bool wait)
+{
+    if (pMap != NULL)
+        msync(pMap, mapSize, wait ? MS_SYNC : MS_ASYNC);
+}
+
+// end of LogRing.cpp
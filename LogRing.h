@@ -0,0 +1,98 @@
+// The file LogRing.h is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "stdafx.h"
+
+// Ring of variable length text records kept in a memory mapped file, so the most recent log
+// messages survive a crash of the daemon (and a power loss, once synced) and can be recovered
+// by the next run or by the alarmRingDump tool.
+//
+// File layout: two header slots (updated alternately, so a torn header write leaves the other
+// one valid) followed by the data area.  Each record in the data area is
+//   [pos:4][len:2][check:2] text[len] [len:2]
+// where pos is the low 32 bits of the record's write position.  The trailing length lets
+// records be walked backwards from the write position, and records wrap around the end of
+// the data area byte by byte.
+
+static const uint32_t LOG_RING_MAGIC = 0x474e5241;  // "ARNG"
+
+struct t_LogRingHeader {
+    uint32_t magic;
+    uint32_t dataSize;      // size of data area in bytes
+    uint32_t generation;    // incremented each time the daemon starts
+    uint32_t seq;           // header update count, slot with the highest valid seq is current
+    uint64_t writePos;      // total bytes ever written, data offset is writePos % dataSize
+    uint64_t flushPos;      // writePos when records were last written to alarmLog
+    uint32_t checksum;      // checksum of the fields above
+    uint32_t pad;
+};
+
+typedef void (*t_LogRingFunc)(const char * text, int len, void * ctx);
+
+class LogRing
+{
+public:
+    LogRing(void)
+    {
+        pMap = NULL;
+        mapSize = 0;
+        pData = NULL;
+    }
+
+    bool init(const char * path, uint32_t dataSize, bool readOnly);
+    void fini(void);
+
+    void append(const char * text, int len);
+    int  readRecords(uint64_t fromPos, int maxRecs, t_LogRingFunc func, void * ctx);
+    void setFlushed(void);
+    void newGeneration(void);
+    void sync(bool wait = false);
+
+    uint64_t getWritePos(void)
+    {
+        return hdr.writePos;
+    }
+    uint64_t getFlushPos(void)
+    {
+        return hdr.flushPos;
+    }
+    uint32_t getGeneration(void)
+    {
+        return hdr.generation;
+    }
+    uint32_t getDataSize(void)
+    {
+        return hdr.dataSize;
+    }
+
+private:
+    void writeHeader(void);
+    bool readHeader(void);
+    void copyIn(uint64_t pos, const void * src, int len);
+    void copyOut(uint64_t pos, void * dst, int len);
+    bool recordAt(uint64_t end, uint64_t * start);
+
+    static uint32_t checksum(const void * buf, int len);
+
+    uint8_t       * pMap;      // mapped file (or anonymous memory)
+    size_t          mapSize;
+    uint8_t       * pData;     // start of data area
+    t_LogRingHeader hdr;       // current header
+};
+
+// end of LogRing.h
@@ -0,0 +1,108 @@
+// The file SenseLoops.cpp is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "SenseLoops.h"
+#include "Clock.h"
+#include "logMsg.h"
+#include "Stats.h"
+#include <wiringPi.h>
+
+void SenseLoops::init(Config * pConfig)
+{
+    pLoop     = pConfig->getLoop();
+    loopCount = pConfig->getLoopCount();
+}
+
+// switch to a reloaded config.  The loop mask is carried over by gpio, loops new in the config
+//   start closed and are picked up by the next sample
+void SenseLoops::setConfig(Config * pConfig)
+{
+    Loop   * pNewLoop = pConfig->getLoop();
+    uint32_t newMask = 0;
+
+    for (int i=0; i < pConfig->getLoopCount(); i++)
+    {
+        for (int j=0; j < loopCount; j++)
+        {
+            if (pNewLoop->gpio[i] == pLoop->gpio[j])
+                newMask |= ((mask >> j) & 0x1) << i;
+        }
+    }
+    pLoop     = pNewLoop;
+    loopCount = pConfig->getLoopCount();
+    mask      = newMask;
+    noise     = 0;
+}
+
+// read the sense loops.  Returns: 32-bit loop mask
+uint32_t SenseLoops::readLoops(void)
+{
+    uint32_t loops = 0;
+
+    // read the sense loop state by doing a digital read of associated GPIO pin (high => open loop)
+    for (int i=0; i < loopCount; i++)
+    {
+        if (digitalRead(pLoop->gpio[i]))
+        {
+            loops |= (1 << i);
+        }
+    }
+    return loops;
+}
+
+// sample the sense loops.  Returns: true if the loop mask changed or a change was ignored as noise
+bool SenseLoops::sample(void)
+{
+    uint32_t sampleLoop = readLoops();        // sample loops
+
+    noise = 0;
+    if (sampleLoop == mask)
+        return false;
+
+    uint64_t start = Clock::ms();
+    uint64_t now;
+    uint32_t count = 0;
+    uint32_t loopVal;
+
+    // start a tight loop to make sure this is a real loop change and not noise
+    while (((now = Clock::ms()) - start) < LOOP_SETTLE_MS)
+    {
+        if (sampleLoop != (loopVal = readLoops()))
+        {
+            noise = sampleLoop ^ mask;  // loop state is not stable, ignore for now
+            int idx = __builtin_ctz(noise);
+            alarmStats.loopNoise++;
+            LOG_MSG(LOG_CAT_GPIO, LOG_LVL_DEBUG, LOG_DEBUG_1, "noise: loop %s %s only %ums, count %u\n", pLoop->name[idx],
+                ((sampleLoop >> idx) & 0x1) ? "opened" : "closed", (uint32_t)(now - start), count);
+            return true;
+        }
+        count++;
+    }
+
+    uint32_t diffMask = sampleLoop ^ mask;
+    for (int i=0; i < loopCount; i++)
+    {
+        if ((diffMask >> i) & 0x1)
+        {
+            alarmStats.loopChanges++;
+            INFO_MSG(LOG_CAT_GPIO, "Loop %s %s\n", pLoop->name[i], ((sampleLoop >> i) & 0x1) ? "opened" : "closed");
+        }
+    }
+    mask = sampleLoop;
+    return true;
+}
+
+// end of SenseLoops.cpp
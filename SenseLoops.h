@@ -0,0 +1,60 @@
+// The file SenseLoops.h is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "stdafx.h"
+#include "Config.h"
+
+// Samples the sense loop gpios once per main loop pass for all partitions.  A change must hold
+// steady for LOOP_SETTLE_MS before it is accepted, a change that doesn't is reported as noise.
+// Each partition then picks its own loops out of the mask (see AlarmManager::checkLoops).
+
+static const uint32_t LOOP_SETTLE_MS = 400;  // loop change must be stable this long
+
+class SenseLoops
+{
+public:
+    SenseLoops(void)
+    {
+        mask = 0;
+        noise = 0;
+    }
+
+    void init(Config * pConfig);
+    void setConfig(Config * pConfig);
+
+    bool sample(void);
+
+    uint32_t getMask(void)    // open loops, bit per loop index
+    {
+        return mask;
+    }
+    uint32_t getNoise(void)   // loops whose change was ignored as noise on the last sample
+    {
+        return noise;
+    }
+
+private:
+    uint32_t readLoops(void);
+
+    Loop   * pLoop;      // pointer to sense loop table
+    int      loopCount;
+    uint32_t mask;
+    uint32_t noise;
+};
+
+// end of SenseLoops.h
@@ -27,6 +27,7 @@
 #include "AlarmManager.h"
 #include "Serial.h"
 #include "logMsg.h"
+#include "Stats.h"
 
 // open serial port for read/write, raw, non-blocking
 bool Serial::init(const char * serialPort, const int baudRate)
@@ -93,13 +94,15 @@ uint8_t Serial::parseMsg(const char * cmd, const int len)
     }
     else if (strncmp(cmd, "ERR_", 4) == 0)  // recv error msg, probably buf overflow
     {
-        logMsg(LOG_DEFAULT, "Err mesg: '%s'\n", cmd);
+        ERR_MSG(LOG_CAT_SERIAL, "Err mesg: '%s'\n", cmd);
+        alarmStats.serialErrors++;
         return SERIAL_CMD_ERROR;
     }
 // FIXME - need VOLTS message here
     else
     {
-        logMsg(LOG_DEFAULT, "Unexpected mesg: '%s'\n", cmd);
+        ERR_MSG(LOG_CAT_SERIAL, "Unexpected mesg: '%s'\n", cmd);
+        alarmStats.serialErrors++;
     }
     return SERIAL_CMD_NONE;
 }
@@ -110,33 +113,18 @@ void Serial::sendF7msg(AlarmManager * pAlarmManager, int hour, int min)
     if (fd > 0)
     {
         char buf[128];
-        pAlarmManager->makeF7msg(buf, hour, min, false);
+        pAlarmManager->makeF7msg(buf, hour, min);
         int writeBytes = write(fd, (void *)buf, strlen(buf));
     
         if (writeBytes == (int)strlen(buf))
         {
-            logMsg(LOG_DEFAULT, "Sent F7 msg to keypad: %s", buf);
+            DEBUG_MSG(LOG_CAT_SERIAL, "Sent F7 msg to keypad: %s", buf);
+            alarmStats.f7Sent++;
         }
         else
         {
-            logMsg(LOG_DEFAULT, "ERR: Short write of F7 msg to keypad: %s", buf);
-        }
-
-        if (pAlarmManager->getAltTextActive())
-        {
-            usleep(MIN_MS_BETWEEN_F7_MSGS * 1000);  // sleep MIN_MS_BETWEEN_F7_MSGS between F7 & F7A msg
-
-            pAlarmManager->makeF7msg(buf, hour, min, true);
-            writeBytes = write(fd, (void *)buf, strlen(buf));
-    
-            if (writeBytes == (int)strlen(buf))
-            {
-                logMsg(LOG_DEFAULT, "Sent F7A msg to keypad: %s", buf);
-            }
-            else
-            {
-                logMsg(LOG_DEFAULT, "ERR: Short write of F7A msg to keypad: %s", buf);
-            }
+            ERR_MSG(LOG_CAT_SERIAL, "ERR: Short write of F7 msg to keypad: %s", buf);
+            alarmStats.serialErrors++;
         }
         pAlarmManager->setLastMsgTime();
     }
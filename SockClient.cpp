@@ -18,115 +18,264 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
-#include <netdb.h>
 #include <fcntl.h>
 #include <errno.h>
 
 #include "Config.h"
 #include "SockClient.h"
+#include "Clock.h"
+#include "logMsg.h"
 
-static const uint16_t port = YOUR_SERVER_PORT;
+static const uint32_t RETRY_MIN_MS       = 1000;       // first retry delay after a failure
+static const uint32_t RETRY_MAX_MS       = 60 * 1000;  // retry delay doubles up to this
+static const uint32_t CONNECT_TIMEOUT_MS = 10 * 1000;  // give up on a connect in progress after this
 
-// if socket fails to init, wait this long before retry
-static const int SOCKET_RESET_WAIT_MS = 60 * 1000;
-static const int FAIL_RETRY_COUNT = SOCKET_RESET_WAIT_MS / MAIN_LOOP_SLEEP_MS;
+// keepalive probes start after KEEPALIVE_IDLE_S idle secs, connection drops after KEEPALIVE_COUNT missed
+static const int KEEPALIVE_IDLE_S   = 30;
+static const int KEEPALIVE_INTVL_S  = 10;
+static const int KEEPALIVE_COUNT    = 3;
+static const int USER_TIMEOUT_MS    = 30 * 1000;  // drop connection if sent data is unacked this long
 
-bool SockClient::init(void)
+// set server address ("ip:port") and start connecting.  Returns: false if address is not valid
+bool SockClient::init(const char * serverAddr)
 {
-    failCount = 0;
-    clientSock = socket(PF_INET, SOCK_STREAM, 0);
+    char ip[32];
+    const char * colon = strrchr(serverAddr, ':');
 
-    if (clientSock >= 0)
-    {
-        struct sockaddr_in serverAddr;
-        socklen_t addrSize = sizeof(serverAddr);
+    fini();
+    memset(&this->serverAddr, 0, sizeof(this->serverAddr));
+    if (colon == NULL)
+        return false;
+    snprintf(ip, sizeof(ip), "%.*s", (int)(colon - serverAddr), serverAddr);
 
-        serverAddr.sin_family = AF_INET;
-        serverAddr.sin_port = htons(port);
-        serverAddr.sin_addr.s_addr = inet_addr("YOUR_SERVER_IP_ADDRESS");
-        memset(serverAddr.sin_zero, 0, sizeof(serverAddr.sin_zero));
-
-        if (connect(clientSock, (struct sockaddr *)&serverAddr, addrSize) >= 0)
-        {
-            // change socket to non-blocking
-            fcntl(clientSock, F_SETFL, fcntl(clientSock, F_GETFL, 0) | O_NONBLOCK);
-            return true;
-        }
-        else  // connect failed, close open socket
-        {
-            fini();
-        }
+    this->serverAddr.sin_family = AF_INET;
+    this->serverAddr.sin_port = htons(atoi(colon + 1));
+    if (this->serverAddr.sin_port == 0 || inet_pton(AF_INET, ip, &this->serverAddr.sin_addr) != 1)
+    {
+        fprintf(stderr, "Invalid socket server address '%s'\n", serverAddr);
+        return false;
     }
-    return false;
+
+    srandom(Clock::ns() ^ getpid());  // jitter differs between panels restarted together
+    failCount = 0;
+    backoffMs = 0;
+    retryDelay = 0;
+    state = SOCK_WAIT_RETRY;  // connect on first service()
+    stateTime = Clock::ms();
+    return true;
 }
 
 void SockClient::fini(void)
+{
+    closeSock();
+    state = SOCK_DISABLED;
+}
+
+void SockClient::closeSock(void)
 {
     if (clientSock >= 0)
     {
         close(clientSock);
         clientSock = -1;
     }
+    wlen = 0;  // a new connection starts on a message boundary
 }
 
-int SockClient::recvMsg(char * buf, int bufSize)
+const char * SockClient::getStateName(void)
 {
-    int readBytes;
+    static const char * names[] = { "disabled", "wait-retry", "connecting", "connected" };
+    return names[state];
+}
 
-    if (clientSock < 0) // socket is not open
+// returns ms until next connect attempt, 0 if not waiting to retry
+uint32_t SockClient::getRetryMs(void)
+{
+    uint32_t waited = min(Clock::ms() - stateTime, (uint64_t)retryDelay);
+    if (state != SOCK_WAIT_RETRY || waited >= retryDelay)
+        return 0;
+    return retryDelay - waited;
+}
+
+// start a non-blocking connect to the server
+void SockClient::startConnect(void)
+{
+    clientSock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (clientSock < 0)
     {
-        if (++failCount > FAIL_RETRY_COUNT)
-        {
-            init();  // try and open socket
-        }
+        connectFailed(strerror(errno));
+        return;
+    }
+
+    int one = 1;
+    int idle = KEEPALIVE_IDLE_S, intvl = KEEPALIVE_INTVL_S, count = KEEPALIVE_COUNT;
+    int userTimeout = USER_TIMEOUT_MS;
+    setsockopt(clientSock, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+    setsockopt(clientSock, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+    setsockopt(clientSock, IPPROTO_TCP, TCP_KEEPINTVL, &intvl, sizeof(intvl));
+    setsockopt(clientSock, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+    setsockopt(clientSock, IPPROTO_TCP, TCP_USER_TIMEOUT, &userTimeout, sizeof(userTimeout));
+    setsockopt(clientSock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    lineBuf.init();  // drop any partial message from the previous connection
+    stateTime = Clock::ms();
+    if (connect(clientSock, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) == 0)
+    {
+        state = SOCK_CONNECTED;  // local connects can complete immediately
+        failCount = 0;
+        INFO_MSG(LOG_CAT_SOCK, "Connected to web app server\n");
     }
-    if (clientSock >= 0) 
+    else if (errno == EINPROGRESS)
     {
-        readBytes = recv(clientSock, buf, bufSize-1, 0);
-        if (readBytes > 0)
-        {
-            //fprintf(stderr, "Recv %d bytes: %s\n", readBytes, buf);
-            return readBytes;
-        }
-        else  // socket closed or failed to read
+        state = SOCK_CONNECTING;
+    }
+    else
+    {
+        connectFailed(strerror(errno));
+    }
+}
+
+// close socket and wait a jittered, exponentially increasing time before the next connect
+void SockClient::connectFailed(const char * reason)
+{
+    closeSock();
+
+    if (state == SOCK_CONNECTED || backoffMs == 0)  // lost an established connection, retry soon
+        backoffMs = RETRY_MIN_MS;
+    else
+        backoffMs = backoffMs >= RETRY_MAX_MS / 2 ? RETRY_MAX_MS : backoffMs * 2;
+
+    if (failCount++ == 0)
+        INFO_MSG(LOG_CAT_SOCK, "Web app server connection failed: %s\n", reason);
+    else
+        DEBUG_MSG(LOG_CAT_SOCK, "Web app server connect retry %u failed: %s\n", failCount, reason);
+
+    state = SOCK_WAIT_RETRY;
+    stateTime = Clock::ms();
+    retryDelay = backoffMs / 2 + random() % (backoffMs / 2 + 1);  // wait between half and all of the backoff
+}
+
+// advance the connect state machine, never blocks
+void SockClient::service(void)
+{
+    if (state == SOCK_WAIT_RETRY && getRetryMs() == 0)
+    {
+        startConnect();
+    }
+    if (state == SOCK_CONNECTING)
+    {
+        struct pollfd pfd;
+        pfd.fd = clientSock;
+        pfd.events = POLLOUT;
+
+        if (poll(&pfd, 1, 0) > 0)  // writable, connect has completed
         {
-            if (readBytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            int err = 0;
+            socklen_t len = sizeof(err);
+            getsockopt(clientSock, SOL_SOCKET, SO_ERROR, &err, &len);
+            if (err == 0)
             {
-                return 0; // timeout, nothing to read
+                state = SOCK_CONNECTED;
+                INFO_MSG(LOG_CAT_SOCK, "Connected to web app server after %u failed attempts\n", failCount);
+                failCount = 0;
             }
             else
             {
-                fini();  // some other failure. close socket this time, will re-open on next recvMsg
+                connectFailed(strerror(err));
             }
         }
+        else if (Clock::ms() - stateTime > CONNECT_TIMEOUT_MS)
+        {
+            connectFailed("connect timed out");
+        }
+    }
+    if (state == SOCK_CONNECTED && wlen > 0)
+    {
+        flushSend();
     }
-    return 0;
 }
 
-bool SockClient::sendMsg(const char * msg)
+// send the queued rest of a message.  Returns: false if the connection failed
+bool SockClient::flushSend(void)
 {
-    if (clientSock < 0)
+    int sent = send(clientSock, wbuf, wlen, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+    if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
     {
-        if (++failCount > FAIL_RETRY_COUNT)
-        {
-            init();  // try and open socket
-        }
+        connectFailed(strerror(errno));
+        return false;
     }
-    if (clientSock >= 0)
+    if (sent > 0)
+    {
+        wlen -= sent;
+        memmove(wbuf, wbuf + sent, wlen);
+    }
+    return true;
+}
+
+// get the next complete message (without newline) from the server.  Returns: message length, 0 if none
+int SockClient::recvMsg(char * buf, int bufSize)
+{
+    int msgLen;
+
+    service();
+    if (state != SOCK_CONNECTED)
+        return 0;
+
+    while ((msgLen = lineBuf.nextLine(buf, bufSize)) < 0)  // no complete message buffered, read more
     {
-        if (send(clientSock, msg, strlen(msg), 0) >= 0)
+        int avail;
+        char * space = lineBuf.getSpace(&avail);
+        int readBytes = recv(clientSock, space, avail, 0);
+        if (readBytes > 0)
         {
-            return true;
+            lineBuf.added(readBytes);
         }
-        else  // sock send failed
+        else if (readBytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
         {
-            fini();  // close socket this time, will re-open on next try
+            return 0; // nothing to read
+        }
+        else
+        {
+            // server closed the connection, or keepalive/user timeout detected a dead peer
+            connectFailed(readBytes == 0 ? "closed by server" : strerror(errno));
+            return 0;
         }
     }
-    return false;
+    return msgLen;
 }
 
+// send msg to the server.  Returns: true if sent or its rest queued, false if not connected or the
+//   socket is full (nothing of msg was sent, the caller should send again later)
+bool SockClient::sendMsg(const char * msg)
+{
+    service();  // also sends what is queued
+    if (state != SOCK_CONNECTED || wlen > 0)
+        return false;
+
+    int len = strlen(msg);
+    int sent = send(clientSock, msg, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (sent < 0)
+    {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            connectFailed(strerror(errno));
+        return false;
+    }
+    if (sent < len)  // queue the rest, the server must get whole lines
+    {
+        if (len - sent > SOCK_SERVER_WBUF)
+        {
+            connectFailed("message too long for write buffer");
+            return false;
+        }
+        memcpy(wbuf, msg + sent, len - sent);
+        wlen = len - sent;
+    }
+    return true;
+}
@@ -17,19 +17,74 @@
 #pragma once
 
 #include "stdafx.h"
+#include "LineBuf.h"
+#include <netinet/in.h>
+
+// Outbound connection to the web app server (SOCK_SERVER in alarm_config).  The connect is
+// non-blocking and driven from recvMsg/sendMsg on the main loop, so a down server never
+// stalls alarm processing.  Failed connects are retried with jittered exponential backoff,
+// and keepalive plus TCP_USER_TIMEOUT detect half-open connections.  Messages in both
+// directions are newline terminated.
+//
+// A message the socket takes only part of has the rest queued (as in SockServer) and sent
+// from the main loop, so the server never sees half a line.  A message the socket takes none
+// of is not queued, sendMsg returns false and the caller sends the then current state later.
+
+static const int SOCK_SERVER_WBUF = 1024;  // bytes of a partly sent message queued for the server
+
+// connection states
+enum {
+    SOCK_DISABLED = 0,  // no server configured
+    SOCK_WAIT_RETRY,    // not connected, waiting for backoff to expire
+    SOCK_CONNECTING,    // non-blocking connect in progress
+    SOCK_CONNECTED
+};
 
 class SockClient
 {
 public:
-    bool init(void);
+    SockClient(void)
+    {
+        clientSock = -1;
+        state = SOCK_DISABLED;
+        failCount = 0;
+        wlen = 0;
+    }
+
+    bool init(const char * serverAddr);
     void fini(void);
 
     bool sendMsg(const char * msg);
     int  recvMsg(char * buf, int bufSize);
 
+    int getState(void)
+    {
+        return state;
+    }
+    const char * getStateName(void);
+    uint32_t getRetryMs(void);     // ms until next connect attempt (SOCK_WAIT_RETRY)
+    uint32_t getFailCount(void)    // connect failures since last successful connect
+    {
+        return failCount;
+    }
+
 private:
-    int clientSock;
-    int failCount;
+    void service(void);
+    void startConnect(void);
+    void connectFailed(const char * reason);
+    void closeSock(void);
+    bool flushSend(void);
+
+    int      clientSock;
+    int      state;
+    uint32_t failCount;
+    uint64_t stateTime;      // ms timestamp of entering current state
+    uint32_t backoffMs;      // current backoff, doubles on each failed connect
+    uint32_t retryDelay;     // ms to wait in SOCK_WAIT_RETRY (backoff with jitter)
+    struct sockaddr_in serverAddr;
+    LineBuf  lineBuf;        // reassembles received messages
+    int      wlen;           // bytes waiting in wbuf
+    char     wbuf[SOCK_SERVER_WBUF];  // rest of a message the socket took part of
 };
 
 // end of SockClient.h
@@ -0,0 +1,353 @@
+// The file SockServer.cpp is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "Config.h"
+#include "SockServer.h"
+#include "logMsg.h"
+
+static const uint32_t LISTEN_ID   = 0xFFFFFFFF;  // epoll data for the listen socket
+static const int      MAX_EVENTS  = 32;          // events handled per recvMsg call
+
+// parse a listen address ("ip:port" or "port", all interfaces).  Returns: false if not valid
+bool parseListenAddr(const char * listenAddr, struct sockaddr_in * addr)
+{
+    char ip[32] = "0.0.0.0";
+    const char * port = listenAddr;
+    const char * colon = strrchr(listenAddr, ':');
+
+    if (colon != NULL)
+    {
+        snprintf(ip, sizeof(ip), "%.*s", (int)(colon - listenAddr), listenAddr);
+        port = colon + 1;
+    }
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(atoi(port));
+    if (addr->sin_port == 0 || inet_pton(AF_INET, ip, &addr->sin_addr) != 1)
+    {
+        fprintf(stderr, "Invalid listen address '%s'\n", listenAddr);
+        return false;
+    }
+    return true;
+}
+
+// listen on listenAddr ("ip:port" or "port").  Returns: true on success
+bool SockServer::init(const char * listenAddr)
+{
+    struct sockaddr_in addr;
+    int one = 1;
+
+    if (!parseListenAddr(listenAddr, &addr))
+        return false;
+
+    listenSock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenSock < 0)
+        return false;
+    setsockopt(listenSock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    if (bind(listenSock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listenSock, SOMAXCONN) < 0)
+    {
+        fprintf(stderr, "Failed to listen on %s (%s)\n", listenAddr, strerror(errno));
+        fini();
+        return false;
+    }
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0)
+    {
+        fini();
+        return false;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u32 = LISTEN_ID;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, listenSock, &ev);
+    return true;
+}
+
+void SockServer::fini(void)
+{
+    for (int i=0; i < SOCK_MAX_CLIENTS; i++)
+    {
+        if (client[i].fd >= 0)
+            closeClient(i, "server shutdown");
+    }
+    if (epollFd >= 0)
+    {
+        close(epollFd);
+        epollFd = -1;
+    }
+    if (listenSock >= 0)
+    {
+        close(listenSock);
+        listenSock = -1;
+    }
+}
+
+// accept all pending connections
+void SockServer::acceptClients(void)
+{
+    struct sockaddr_in addr;
+    socklen_t addrLen = sizeof(addr);
+    int fd;
+
+    while ((fd = accept4(listenSock, (struct sockaddr *)&addr, &addrLen, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+        int idx = 0;
+        while (idx < SOCK_MAX_CLIENTS && client[idx].fd >= 0)
+            idx++;
+        if (idx == SOCK_MAX_CLIENTS)
+        {
+            ERR_MSG(LOG_CAT_SOCK, "Too many socket clients, rejected %s\n", inet_ntoa(addr.sin_addr));
+            close(fd);
+            continue;
+        }
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));  // state updates are small, send now
+
+        t_SockConn * c = &client[idx];
+        c->fd = fd;
+        c->wlen = 0;
+        c->rbuf.init();
+        c->subscribed = false;
+        c->version = 0;
+        c->part = 0;
+        snprintf(c->addr, sizeof(c->addr), "%s:%d", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u32 = idx;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev);
+        clientCount++;
+        INFO_MSG(LOG_CAT_SOCK, "Socket client %s connected (%d clients)\n", c->addr, clientCount);
+        addrLen = sizeof(addr);
+    }
+}
+
+void SockServer::closeClient(int idx, const char * reason)
+{
+    t_SockConn * c = &client[idx];
+
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    c->fd = -1;
+    c->wlen = 0;
+    clientCount--;
+    INFO_MSG(LOG_CAT_SOCK, "Socket client %s closed: %s\n", c->addr, reason);
+}
+
+// enable/disable EPOLLOUT for client idx
+void SockServer::setWriteWait(int idx, bool wait)
+{
+    struct epoll_event ev;
+    ev.events = wait ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    ev.data.u32 = idx;
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, client[idx].fd, &ev);
+}
+
+// send buffered output of client idx.  Returns: false if client was closed
+bool SockServer::flushClient(int idx)
+{
+    t_SockConn * c = &client[idx];
+    int sent = send(c->fd, c->wbuf, c->wlen, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+    if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+    {
+        closeClient(idx, strerror(errno));
+        return false;
+    }
+    if (sent > 0)
+    {
+        c->wlen -= sent;
+        memmove(c->wbuf, c->wbuf + sent, c->wlen);
+    }
+    if (c->wlen == 0)
+        setWriteWait(idx, false);
+    return true;
+}
+
+// get the next complete message from any client, round robin.  Returns: message length, -1 if none
+int SockServer::nextClientMsg(char * buf, int bufSize, int * pClient)
+{
+    for (int i=0; i < SOCK_MAX_CLIENTS; i++)
+    {
+        int idx = (nextClient + i) % SOCK_MAX_CLIENTS;
+        if (client[idx].fd < 0)
+            continue;
+
+        int msgLen = client[idx].rbuf.nextLine(buf, bufSize);
+        if (msgLen >= 0)
+        {
+            nextClient = (idx + 1) % SOCK_MAX_CLIENTS;
+            if (pClient != NULL)
+                *pClient = idx;
+            return msgLen;
+        }
+    }
+    return -1;
+}
+
+// get the next complete message (without newline) from a client, client index in pClient.
+//   Returns: message length, 0 if none
+int SockServer::recvMsg(char * buf, int bufSize, int * pClient)
+{
+    int msgLen;
+
+    if (epollFd < 0)
+        return 0;
+
+    if ((msgLen = nextClientMsg(buf, bufSize, pClient)) < 0)  // nothing buffered, poll the sockets
+    {
+        readClients();
+        msgLen = nextClientMsg(buf, bufSize, pClient);
+    }
+    return msgLen > 0 ? msgLen : 0;
+}
+
+// accept new clients, send buffered output and read from every readable client
+void SockServer::readClients(void)
+{
+    struct epoll_event events[MAX_EVENTS];
+
+    int count = epoll_wait(epollFd, events, MAX_EVENTS, 0);
+    for (int i=0; i < count; i++)
+    {
+        uint32_t idx = events[i].data.u32;
+
+        if (idx == LISTEN_ID)
+        {
+            acceptClients();
+            continue;
+        }
+        if (client[idx].fd < 0)
+            continue;  // closed earlier in this pass
+
+        if ((events[i].events & EPOLLOUT) && !flushClient(idx))
+            continue;
+
+        if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+        {
+            int avail;
+            char * space = client[idx].rbuf.getSpace(&avail);
+            int n = recv(client[idx].fd, space, avail, 0);
+            if (n > 0)
+                client[idx].rbuf.added(n);
+            else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                closeClient(idx, n == 0 ? "disconnected" : strerror(errno));
+        }
+    }
+}
+
+// send msg to client idx, queueing what the socket won't take.  Returns: false if client was closed
+bool SockServer::sendClient(int idx, const char * msg, int len)
+{
+    t_SockConn * c = &client[idx];
+    int sent = 0;
+
+    if (c->wlen == 0)  // nothing queued, try to send directly
+    {
+        sent = send(c->fd, msg, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                closeClient(idx, strerror(errno));
+                return false;
+            }
+            sent = 0;
+        }
+    }
+    if (sent < len)  // queue the rest
+    {
+        if (c->wlen + len - sent > SOCK_CLIENT_WBUF)
+        {
+            closeClient(idx, "slow consumer, write buffer full");
+            return false;
+        }
+        memcpy(c->wbuf + c->wlen, msg + sent, len - sent);
+        if (c->wlen == 0)
+            setWriteWait(idx, true);
+        c->wlen += len - sent;
+    }
+    return true;
+}
+
+// send msg to every client.  Clients that can't keep up are disconnected
+void SockServer::broadcast(const char * msg)
+{
+    int len = strlen(msg);
+
+    for (int i=0; i < SOCK_MAX_CLIENTS && clientCount > 0; i++)
+    {
+        if (client[i].fd >= 0)
+            sendClient(i, msg, len);
+    }
+}
+
+// subscribe client idx to the state messages of partition part, resuming from version (0 for a new snapshot)
+void SockServer::subscribe(int idx, int part, uint32_t version)
+{
+    client[idx].subscribed = true;
+    client[idx].part = part;
+    client[idx].version = version;
+}
+
+// send each subscribed client the delta (or snapshot) that brings it to the current state version
+//   of its partition, one of the partCount in part
+void SockServer::publish(AlarmManager * part, int partCount)
+{
+    int      msgPart = -1;  // partition and version msg was formatted for, clients are usually all at the same one
+    uint32_t msgFrom = 0;
+    char     msg[STATE_MSG_SIZE];
+    int      len = 0;
+
+    for (int i=0; i < SOCK_MAX_CLIENTS && clientCount > 0; i++)
+    {
+        t_SockConn * c = &client[i];
+        if (c->fd < 0 || !c->subscribed || c->part >= partCount)
+            continue;
+        uint32_t version = part[c->part].getStateVersion();
+        if (c->version == version)
+            continue;
+
+        if (len == 0 || c->part != msgPart || c->version != msgFrom)
+        {
+            len = part[c->part].formatStateMsg(msg, sizeof(msg), c->version);
+            msgPart = c->part;
+            msgFrom = c->version;
+        }
+        if (sendClient(i, msg, len))
+            c->version = version;
+    }
+}
+
+// end of SockServer.cpp
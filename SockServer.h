@@ -0,0 +1,96 @@
+// The file SockServer.h is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "stdafx.h"
+#include "LineBuf.h"
+#include "AlarmManager.h"
+#include <netinet/in.h>
+
+// TCP server for virtual keypad and monitoring clients.  Accepts many clients on the
+// SOCK_LISTEN address from alarm_config, polled with epoll from the main loop (never blocks).
+// State updates are broadcast to every client; a client whose write buffer fills up
+// (not reading) is disconnected rather than holding up the others.  Messages in both
+// directions are newline terminated.
+//
+// A client sends "SUB" to receive alarm state: a snapshot ("S e=epoch v=version ...") and then
+// a delta ("D v=version ...", changed fields only) each time the state version changes.
+// "SUB epoch version" resumes from the last version the client saw, getting a single delta
+// if that version is still in AlarmManager's history, otherwise a new snapshot.
+// "SUB epoch version partition" does the same for a partition other than the first.
+
+static const int SOCK_MAX_CLIENTS  = 128;   // max connected clients
+static const int SOCK_CLIENT_WBUF  = 4096;  // bytes of unsent output buffered per client
+static const int STATE_MSG_SIZE    = 160;   // max size of a state snapshot/delta message
+
+struct t_SockConn {
+    int  fd;                          // -1 if slot not in use
+    int  wlen;                        // bytes waiting in wbuf
+    char wbuf[SOCK_CLIENT_WBUF];      // output not yet accepted by the socket
+    char addr[24];                    // peer address, for log messages
+    bool subscribed;                  // client receives state messages
+    uint32_t version;                 // state version client has, 0 if none
+    uint8_t  part;                    // partition whose state the client receives
+    LineBuf rbuf;                     // reassembles received messages
+};
+
+bool parseListenAddr(const char * listenAddr, struct sockaddr_in * addr);
+
+class SockServer
+{
+public:
+    SockServer(void)
+    {
+        listenSock = -1;
+        epollFd = -1;
+        clientCount = 0;
+        nextClient = 0;
+        for (int i=0; i < SOCK_MAX_CLIENTS; i++)
+            client[i].fd = -1;
+    }
+
+    bool init(const char * listenAddr);
+    void fini(void);
+
+    int  recvMsg(char * buf, int bufSize, int * pClient = NULL);
+    void broadcast(const char * msg);
+    void subscribe(int idx, int part, uint32_t version);
+    void publish(AlarmManager * part, int partCount);
+
+    int getClientCount(void)
+    {
+        return clientCount;
+    }
+
+private:
+    void acceptClients(void);
+    void readClients(void);
+    int  nextClientMsg(char * buf, int bufSize, int * pClient);
+    bool sendClient(int idx, const char * msg, int len);
+    void closeClient(int idx, const char * reason);
+    bool flushClient(int idx);
+    void setWriteWait(int idx, bool wait);
+
+    int listenSock;
+    int epollFd;
+    int clientCount;
+    int nextClient;     // client checked first for a buffered message (round robin)
+
+    t_SockConn client[SOCK_MAX_CLIENTS];
+};
+
+// end of SockServer.h
@@ -0,0 +1,37 @@
+// The file Stats.h is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "stdafx.h"
+
+// health counters of the alarm daemon, reported by HttpServer /metrics.  Only updated from the
+// main loop thread.
+struct t_AlarmStats {
+    uint32_t serialErrors;     // bad or unexpected messages from Arduino, short writes
+    uint32_t f7Sent;           // F7 messages written to keypad
+    uint32_t keyMsgs;          // KEYS messages processed (serial, socket or http)
+    uint32_t loopChanges;      // sense loop open/close changes
+    uint32_t loopNoise;        // sense loop changes ignored as noise
+    uint32_t alertsSent;       // alert emails sent
+    uint32_t alertFailures;    // alert emails that failed to send
+    uint32_t sockCmds;         // commands received on sockets
+    uint32_t httpRequests;     // http requests served
+};
+
+extern t_AlarmStats alarmStats;
+
+// end of Stats.h
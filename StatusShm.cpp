@@ -0,0 +1,237 @@
+// The file StatusShm.cpp is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+
+#include "StatusShm.h"
+#include "AlarmManager.h"
+#include "Clock.h"
+
+static const int DATA_WORDS = sizeof(t_StatusData) / 4;
+static const int ZONE_WORDS = sizeof(t_StatusZones) / 4;
+
+// seqlocked copies are made a word at a time with atomic (relaxed) loads and stores, so a copy
+//   racing the writer is well defined, the fences and seq accesses order them
+static void storeWords(void * dst, const void * src, int words)
+{
+    const uint32_t * s = (const uint32_t *)src;
+    uint32_t * d = (uint32_t *)dst;
+
+    for (int i=0; i < words; i++)
+        __atomic_store_n(&d[i], s[i], __ATOMIC_RELAXED);
+}
+
+static void loadWords(void * dst, const void * src, int words)
+{
+    const uint32_t * s = (const uint32_t *)src;
+    uint32_t * d = (uint32_t *)dst;
+
+    for (int i=0; i < words; i++)
+        d[i] = __atomic_load_n(&s[i], __ATOMIC_RELAXED);
+}
+
+// create (or reset) the shared memory segment and fill in the zone names of pConfig (none if
+//   NULL).  Returns: true on success
+bool StatusShm::init(const char * name, Config * pConfig)
+{
+    int fd = shm_open(name, O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Failed to create status shm %s (%s)\n", name, strerror(errno));
+        return false;
+    }
+    fchmod(fd, 0644);  // readable by monitoring tools regardless of umask
+
+    if (ftruncate(fd, sizeof(t_StatusShm)) < 0 ||
+        (pShm = (t_StatusShm *)mmap(NULL, sizeof(t_StatusShm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+    {
+        fprintf(stderr, "Failed to map status shm %s (%s)\n", name, strerror(errno));
+        pShm = NULL;
+        close(fd);
+        return false;
+    }
+    close(fd);  // mapping stays valid
+    snprintf(this->name, sizeof(this->name), "%s", name);
+
+    __atomic_store_n(&pShm->magic, 0, __ATOMIC_RELEASE);  // not ready while being set up
+    memset(&pShm->data, 0, sizeof(pShm->data));
+    memset(&pShm->zones, 0, sizeof(pShm->zones));
+    pShm->layout = STATUS_SHM_LAYOUT;
+    writeSeq = __atomic_load_n(&pShm->seq, __ATOMIC_RELAXED) & ~1;  // continue from a previous run
+    memset(&last, 0, sizeof(last));
+    if (pConfig != NULL)
+        setZones(pConfig);
+    __atomic_store_n(&pShm->magic, STATUS_SHM_MAGIC, __ATOMIC_RELEASE);
+    return true;
+}
+
+void StatusShm::fini(void)
+{
+    if (pShm != NULL)
+    {
+        munmap(pShm, sizeof(t_StatusShm));
+        pShm = NULL;
+        shm_unlink(name);  // readers still mapping it see updateTime stop
+    }
+}
+
+// write the zone names of pConfig, at init and on config reload.  seq is odd meanwhile, so
+//   snapshots read during the change are retried (loopMask bits may be renumbered)
+void StatusShm::setZones(Config * pConfig)
+{
+    t_StatusZones z;
+
+    memset(&z, 0, sizeof(z));
+    z.zoneCount = pConfig->getLoopCount();
+    for (int i=0; i < pConfig->getLoopCount(); i++)
+        snprintf(z.zoneName[i], MAX_LOOP_NAME_LENGTH, "%s", pConfig->getLoop()->name[i]);
+    writeZones(&z);
+}
+
+// seqlock write of the zone names: odd seq, names, even seq
+void StatusShm::writeZones(const t_StatusZones * pZones)
+{
+    if (pShm == NULL)
+        return;
+
+    __atomic_store_n(&pShm->seq, ++writeSeq, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    storeWords(&pShm->zones, pZones, ZONE_WORDS);
+    __atomic_store_n(&pShm->seq, ++writeSeq, __ATOMIC_RELEASE);
+}
+
+// write the current state of the partCount partitions in part to the segment if it changed or
+//   a second has passed
+void StatusShm::publish(AlarmManager * part, int partCount, const t_AlarmStats * pStats)
+{
+    const t_AlarmState * s = part[0].getState();
+    t_StatusData d;
+
+    if (pShm == NULL)
+        return;
+
+    memset(&d, 0, sizeof(d));
+    d.epoch = part[0].getStateEpoch();
+    d.updateTime = Clock::wall();
+    d.armed = s->armed;
+    d.ready = true;
+    d.chime = s->chime;
+    d.power = s->power;
+    d.tone = s->tone;
+    d.partCount = partCount;
+    memcpy(d.line1, s->line1, sizeof(s->line1));
+    memcpy(d.line2, s->line2, sizeof(s->line2));
+    d.stats = *pStats;
+
+    for (int p=0; p < partCount; p++)
+    {
+        const t_AlarmState * ps = part[p].getState();
+        d.version += ps->version;
+        d.loopMask |= ps->loopMask;
+        d.alarm |= ps->alarm;
+        d.ready &= ps->ready;
+        if (p < STATUS_MAX_PARTS)
+        {
+            t_StatusPart * dp = &d.part[p];
+            dp->version = ps->version;
+            dp->loopMask = ps->loopMask;
+            dp->armed = ps->armed;
+            dp->alarm = ps->alarm;
+            dp->ready = ps->ready;
+            dp->chime = ps->chime;
+            dp->tone = ps->tone;
+            memcpy(dp->line1, ps->line1, sizeof(ps->line1));
+            memcpy(dp->line2, ps->line2, sizeof(ps->line2));
+        }
+    }
+
+    if (memcmp(&d, &last, sizeof(d)) == 0)
+        return;
+    last = d;
+    write(&d);
+}
+
+// seqlock write of a snapshot: odd seq, data, even seq
+void StatusShm::write(const t_StatusData * pData)
+{
+    if (pShm == NULL)
+        return;
+
+    __atomic_store_n(&pShm->seq, ++writeSeq, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    storeWords(&pShm->data, pData, DATA_WORDS);
+    __atomic_store_n(&pShm->seq, ++writeSeq, __ATOMIC_RELEASE);
+}
+
+// map an existing segment read-only.  Returns: false if not present or not initialized
+bool StatusShm::openRead(const char * name)
+{
+    int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0)
+        return false;
+
+    pShm = (t_StatusShm *)mmap(NULL, sizeof(t_StatusShm), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (pShm == MAP_FAILED)
+    {
+        pShm = NULL;
+        return false;
+    }
+    if (__atomic_load_n(&pShm->magic, __ATOMIC_ACQUIRE) != STATUS_SHM_MAGIC || pShm->layout != STATUS_SHM_LAYOUT)
+    {
+        closeRead();
+        return false;
+    }
+    return true;
+}
+
+void StatusShm::closeRead(void)
+{
+    if (pShm != NULL)
+    {
+        munmap(pShm, sizeof(t_StatusShm));
+        pShm = NULL;
+    }
+}
+
+// copy a consistent snapshot into pData, and the zone names its loopMask refers to into pZones
+//   if not NULL, no system calls.  Returns: false if the writer was mid-update on every one of
+//   maxTries attempts
+bool StatusShm::read(t_StatusData * pData, t_StatusZones * pZones, int maxTries)
+{
+    for (int t=0; t < maxTries; t++)
+    {
+        uint32_t seq1 = __atomic_load_n(&pShm->seq, __ATOMIC_ACQUIRE);
+        if (seq1 & 1)
+            continue;  // writer is updating
+        loadWords(pData, &pShm->data, DATA_WORDS);
+        if (pZones != NULL)
+            loadWords(pZones, &pShm->zones, ZONE_WORDS);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&pShm->seq, __ATOMIC_RELAXED) == seq1)
+            return true;
+    }
+    return false;
+}
+
+// end of StatusShm.cpp
@@ -0,0 +1,122 @@
+// The file StatusShm.h is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "stdafx.h"
+#include "Config.h"
+#include "Stats.h"
+
+// Alarm status published in POSIX shared memory (/dev/shm/alarmStatus) for local monitoring
+// tools.  The daemon writes the segment each main loop pass that something changed (and at
+// least once a second), readers map it read-only and copy a snapshot with no system calls.
+//
+// The snapshot is protected by a seqlock: the writer makes seq odd, updates the data and makes
+// seq even again.  A reader copies the data between two reads of seq and retries if seq was
+// odd or changed, so it never sees a torn snapshot and never blocks the writer.  Zone names
+// only change on a config reload but are under the same seqlock, a reader asking for them gets
+// the names the loopMask bits of its snapshot refer to.
+//
+// The house fields of a snapshot cover every partition: loopMask has the zones any partition
+// sees open, alarm is set if any partition is sounding and ready only if all are ready.  armed,
+// chime, tone and the keypad lines are the first partition's, part[] has each partition's own.
+
+class AlarmManager;
+
+static const char     STATUS_SHM_NAME[]  = "/alarmStatus";
+static const uint32_t STATUS_SHM_MAGIC   = 0x53544131;  // "STA1", set once the segment is ready
+static const uint32_t STATUS_SHM_LAYOUT  = 4;           // bump when t_StatusShm changes
+static const int      STATUS_MAX_PARTS   = 8;           // partitions with an entry in part[]
+
+struct t_StatusPart {
+    uint32_t version;            // partition state version (restarts each run)
+    uint32_t loopMask;           // open zones of the partition
+    uint8_t  armed;
+    uint8_t  alarm;
+    uint8_t  ready;
+    uint8_t  chime;
+    uint8_t  tone;
+    uint8_t  pad[3];
+    char     line1[20];          // its keypads' display, null terminated
+    char     line2[20];
+};
+
+struct t_StatusData {
+    uint32_t epoch;              // identifies the alarm daemon run
+    uint32_t version;            // sum of the partition state versions, changes with any of them
+    uint32_t updateTime;         // Clock::wall() of last write, stops advancing if the daemon stops
+    uint32_t loopMask;           // open zones, bit per zone
+    uint8_t  armed;              // DISARMED, ARMED_STAY, ARMED_AWAY, ARMED_BYPASS
+    uint8_t  alarm;              // alarm sounding
+    uint8_t  ready;              // all zones closed
+    uint8_t  chime;
+    uint8_t  power;              // AC power present
+    uint8_t  tone;               // keypad tone
+    uint8_t  partCount;          // partitions configured, the first STATUS_MAX_PARTS are in part[]
+    uint8_t  pad;
+    char     line1[20];          // keypad display, null terminated
+    char     line2[20];
+    t_AlarmStats stats;          // health counters
+    t_StatusPart part[STATUS_MAX_PARTS];
+};
+
+struct t_StatusZones {
+    uint32_t zoneCount;
+    char     zoneName[MAX_SENSE_LOOPS][MAX_LOOP_NAME_LENGTH];
+};
+
+struct t_StatusShm {
+    uint32_t magic;              // STATUS_SHM_MAGIC once initialized
+    uint32_t layout;             // STATUS_SHM_LAYOUT
+    uint32_t seq;                // seqlock sequence, odd while the writer is updating data or zones
+    uint32_t pad;
+    t_StatusData  data;
+    t_StatusZones zones;
+};
+
+static_assert(sizeof(t_StatusData) % 4 == 0, "t_StatusData is copied a word at a time");
+static_assert(sizeof(t_StatusZones) % 4 == 0, "t_StatusZones is copied a word at a time");
+
+class StatusShm
+{
+public:
+    StatusShm(void)
+    {
+        pShm = NULL;
+        writeSeq = 0;
+    }
+
+    // writer (daemon)
+    bool init(const char * name, Config * pConfig);
+    void fini(void);
+    void publish(AlarmManager * part, int partCount, const t_AlarmStats * pStats);
+    void setZones(Config * pConfig);
+    void write(const t_StatusData * pData);
+    void writeZones(const t_StatusZones * pZones);
+
+    // reader (monitoring tools)
+    bool openRead(const char * name);
+    void closeRead(void);
+    bool read(t_StatusData * pData, t_StatusZones * pZones = NULL, int maxTries = 1000);
+
+private:
+    t_StatusShm * pShm;          // mapped segment
+    uint32_t      writeSeq;      // writer's copy of seq
+    t_StatusData  last;          // last data written (writer)
+    char          name[MAX_PARM_LENGTH];
+};
+
+// end of StatusShm.h
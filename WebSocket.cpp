@@ -0,0 +1,206 @@
+// The file WebSocket.cpp is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <string.h>
+
+#include "WebSocket.h"
+
+static const char * WS_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";  // from RFC 6455
+
+#define ROTL(x, n)  (((x) << (n)) | ((x) >> (32 - (n))))
+
+// process one 64 byte block of SHA-1 input
+static void sha1Block(uint32_t h[5], const uint8_t * p)
+{
+    uint32_t w[80];
+
+    for (int i=0; i < 16; i++)
+        w[i] = (p[i*4] << 24) | (p[i*4+1] << 16) | (p[i*4+2] << 8) | p[i*4+3];
+    for (int i=16; i < 80; i++)
+        w[i] = ROTL(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i=0; i < 80; i++)
+    {
+        uint32_t f, k;
+        if (i < 20)
+        {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        }
+        else if (i < 40)
+        {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        }
+        else if (i < 60)
+        {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        }
+        else
+        {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+        uint32_t t = ROTL(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = ROTL(b, 30);
+        b = a;
+        a = t;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+}
+
+// SHA-1 digest of data (only used for the handshake, not for security)
+void sha1(const uint8_t * data, int len, uint8_t digest[20])
+{
+    uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+    uint8_t  block[64];
+    int      i;
+
+    for (i=0; i + 64 <= len; i += 64)
+        sha1Block(h, data + i);
+
+    // pad with 0x80, zeros and the 64 bit message length in bits
+    int rest = len - i;
+    memcpy(block, data + i, rest);
+    block[rest++] = 0x80;
+    if (rest > 56)
+    {
+        memset(block + rest, 0, 64 - rest);
+        sha1Block(h, block);
+        rest = 0;
+    }
+    memset(block + rest, 0, 56 - rest);
+    uint64_t bits = (uint64_t)len * 8;
+    for (int j=0; j < 8; j++)
+        block[63-j] = bits >> (j * 8);
+    sha1Block(h, block);
+
+    for (int j=0; j < 20; j++)
+        digest[j] = h[j/4] >> (24 - (j % 4) * 8);
+}
+
+// base64 encode data into out (null terminated).  Returns: length of encoded string, -1 if out too small
+int base64Encode(const uint8_t * data, int len, char * out, int outSize)
+{
+    static const char * table = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    int outLen = (len + 2) / 3 * 4;
+
+    if (outLen + 1 > outSize)
+        return -1;
+
+    char * p = out;
+    for (int i=0; i < len; i += 3)
+    {
+        uint32_t v = data[i] << 16;
+        if (i + 1 < len)
+            v |= data[i+1] << 8;
+        if (i + 2 < len)
+            v |= data[i+2];
+        *p++ = table[(v >> 18) & 0x3F];
+        *p++ = table[(v >> 12) & 0x3F];
+        *p++ = (i + 1 < len) ? table[(v >> 6) & 0x3F] : '=';
+        *p++ = (i + 2 < len) ? table[v & 0x3F] : '=';
+    }
+    *p = '\0';
+    return outLen;
+}
+
+// compute Sec-WebSocket-Accept value for the client's Sec-WebSocket-Key
+void wsAcceptKey(const char * clientKey, int keyLen, char accept[WS_ACCEPT_SIZE])
+{
+    uint8_t buf[128];
+    uint8_t digest[20];
+    int     guidLen = strlen(WS_GUID);
+
+    if (keyLen > (int)sizeof(buf) - guidLen)
+        keyLen = sizeof(buf) - guidLen;
+    memcpy(buf, clientKey, keyLen);
+    memcpy(buf + keyLen, WS_GUID, guidLen);
+    sha1(buf, keyLen + guidLen, digest);
+    base64Encode(digest, 20, accept, WS_ACCEPT_SIZE);
+}
+
+// build an unmasked server frame in buf.  Returns: frame length, -1 if it does not fit
+int wsMakeFrame(uint8_t opcode, const char * payload, int len, char * buf, int bufSize)
+{
+    int hdrLen = (len < 126) ? 2 : 4;
+
+    if (len > 0xFFFF || hdrLen + len > bufSize)
+        return -1;
+
+    buf[0] = 0x80 | opcode;  // FIN, no fragments
+    if (len < 126)
+    {
+        buf[1] = len;
+    }
+    else
+    {
+        buf[1] = 126;
+        buf[2] = len >> 8;
+        buf[3] = len & 0xFF;
+    }
+    memcpy(buf + hdrLen, payload, len);
+    return hdrLen + len;
+}
+
+// parse a client frame at the start of buf, unmasking the payload in place.
+//   Returns: bytes used by the frame, 0 if frame is not complete yet, -1 if not a valid client frame
+int wsParseFrame(char * buf, int len, uint8_t * pOpcode, char ** pPayload, int * pPayloadLen)
+{
+    if (len < 2)
+        return 0;
+
+    uint8_t * p = (uint8_t *)buf;
+    if ((p[0] & 0x80) == 0 || (p[0] & 0x70) != 0 || (p[1] & 0x80) == 0)
+        return -1;  // fragmented, reserved bits set or not masked (clients must mask)
+
+    int payloadLen = p[1] & 0x7F;
+    int hdrLen = 2;
+    if (payloadLen == 126)
+    {
+        if (len < 4)
+            return 0;
+        payloadLen = (p[2] << 8) | p[3];
+        hdrLen = 4;
+    }
+    else if (payloadLen == 127)
+    {
+        return -1;  // 64 bit length, far bigger than anything a keypad sends
+    }
+
+    if (len < hdrLen + 4 + payloadLen)
+        return 0;
+
+    uint8_t * mask = p + hdrLen;
+    char * payload = buf + hdrLen + 4;
+    for (int i=0; i < payloadLen; i++)
+        payload[i] ^= mask[i % 4];
+
+    *pOpcode = p[0] & 0x0F;
+    *pPayload = payload;
+    *pPayloadLen = payloadLen;
+    return hdrLen + 4 + payloadLen;
+}
+
+// end of WebSocket.cpp
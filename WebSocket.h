@@ -0,0 +1,42 @@
+// The file WebSocket.h is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "stdafx.h"
+
+// RFC 6455 WebSocket handshake and framing, used by HttpServer for browser keypads.  Only
+// what a keypad needs: unfragmented text frames, ping/pong and close.  Payloads are small,
+// so frames larger than 64K are rejected.
+
+static const uint8_t WS_OP_CONT   = 0x0;
+static const uint8_t WS_OP_TEXT   = 0x1;
+static const uint8_t WS_OP_BINARY = 0x2;
+static const uint8_t WS_OP_CLOSE  = 0x8;
+static const uint8_t WS_OP_PING   = 0x9;
+static const uint8_t WS_OP_PONG   = 0xA;
+
+static const int WS_ACCEPT_SIZE   = 29;    // base64 SHA-1 accept key + null
+static const int WS_MAX_HDR_SIZE  = 4;     // header size of a server frame (payload < 64K)
+
+void sha1(const uint8_t * data, int len, uint8_t digest[20]);
+int  base64Encode(const uint8_t * data, int len, char * out, int outSize);
+
+void wsAcceptKey(const char * clientKey, int keyLen, char accept[WS_ACCEPT_SIZE]);
+int  wsMakeFrame(uint8_t opcode, const char * payload, int len, char * buf, int bufSize);
+int  wsParseFrame(char * buf, int len, uint8_t * pOpcode, char ** pPayload, int * pPayloadLen);
+
+// end of WebSocket.h
@@ -0,0 +1,142 @@
+// The file ZoneTable.h is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "stdafx.h"
+#include "Config.h"
+
+// Reaction of each zone type (ZONE_* in Config.h) to a loop event in each alarm mode.
+// AlarmManager compiles this into a per-zone table when it loads the config, applying the
+// loop's BYPASS flag, so a loop change costs one lookup per changed zone.  The checks at the
+// end of the file run over every entry at compile time.
+
+enum {  // alarm modes, the first four are the armed values (DISARMED, ARMED_*)
+    ZMODE_DISARMED = 0,
+    ZMODE_STAY,
+    ZMODE_AWAY,
+    ZMODE_BYPASS,
+    ZMODE_EXIT,          // armed away, exit delay running
+    ZMODE_COUNT
+};
+
+enum {  // loop events
+    ZEVENT_OPEN = 0,
+    ZEVENT_CLOSE,
+    ZEVENT_COUNT
+};
+
+enum {  // zone actions
+    ZA_NONE = 0,
+    ZA_ENTRY_DELAY,      // start the entry delay, if not already running
+    ZA_FOLLOW,           // alarm, unless an entry delay is running
+    ZA_ALARM,            // instant alarm
+    ZA_PANIC,            // instant alarm, alert says panic
+    ZA_BYPASSED,         // log only, set in the per-zone table for BYPASS loops in ZMODE_BYPASS
+    ZA_COUNT
+};
+
+#define OPEN_ONLY(a) { a, ZA_NONE }
+
+//                         DISARMED             STAY                  AWAY                       BYPASS                EXIT
+static constexpr uint8_t ZONE_TABLE[ZONE_TYPE_COUNT][ZMODE_COUNT][ZEVENT_COUNT] = {
+    /* ZONE_ENTRY     */ { OPEN_ONLY(ZA_NONE),  OPEN_ONLY(ZA_ALARM),  OPEN_ONLY(ZA_ENTRY_DELAY), OPEN_ONLY(ZA_ALARM),  OPEN_ONLY(ZA_NONE)  },
+    /* ZONE_PERIMETER */ { OPEN_ONLY(ZA_NONE),  OPEN_ONLY(ZA_ALARM),  OPEN_ONLY(ZA_ALARM),       OPEN_ONLY(ZA_ALARM),  OPEN_ONLY(ZA_NONE)  },
+    /* ZONE_INTERIOR  */ { OPEN_ONLY(ZA_NONE),  OPEN_ONLY(ZA_NONE),   OPEN_ONLY(ZA_FOLLOW),      OPEN_ONLY(ZA_NONE),   OPEN_ONLY(ZA_NONE)  },
+    /* ZONE_FOLLOWER  */ { OPEN_ONLY(ZA_NONE),  OPEN_ONLY(ZA_ALARM),  OPEN_ONLY(ZA_FOLLOW),      OPEN_ONLY(ZA_ALARM),  OPEN_ONLY(ZA_NONE)  },
+    /* ZONE_24H       */ { OPEN_ONLY(ZA_ALARM), OPEN_ONLY(ZA_ALARM),  OPEN_ONLY(ZA_ALARM),       OPEN_ONLY(ZA_ALARM),  OPEN_ONLY(ZA_ALARM) },
+    /* ZONE_PANIC     */ { OPEN_ONLY(ZA_PANIC), OPEN_ONLY(ZA_PANIC),  OPEN_ONLY(ZA_PANIC),       OPEN_ONLY(ZA_PANIC),  OPEN_ONLY(ZA_PANIC) },
+};
+
+#undef OPEN_ONLY
+
+// compiled action of zone type t in mode m for event e, bypass is the loop's BYPASS flag
+constexpr uint8_t compileZone(int t, int m, int e, bool bypass)
+{
+    return (bypass && m == ZMODE_BYPASS && t != ZONE_24H && t != ZONE_PANIC && ZONE_TABLE[t][m][e] != ZA_NONE) ?
+        (uint8_t)ZA_BYPASSED : ZONE_TABLE[t][m][e];
+}
+
+// -------------------------------- compile time checks of ZONE_TABLE --------------------------------
+
+// true if pred(t, m, e, bypass) holds for every entry of the compiled table
+template <typename Pred>
+constexpr bool allZones(Pred pred)
+{
+    for (int t=0; t < ZONE_TYPE_COUNT; t++)
+        for (int m=0; m < ZMODE_COUNT; m++)
+            for (int e=0; e < ZEVENT_COUNT; e++)
+                for (int b=0; b < 2; b++)
+                    if (!pred(t, m, e, b != 0))
+                        return false;
+    return true;
+}
+
+struct ZoneValid {       // every action is defined, ZA_BYPASSED only comes from the BYPASS flag
+    constexpr bool operator()(int t, int m, int e, bool b) const
+    {
+        return ZONE_TABLE[t][m][e] < ZA_BYPASSED && compileZone(t, m, e, b) < ZA_COUNT;
+    }
+};
+struct ZoneCloseQuiet {  // closing a loop never triggers anything
+    constexpr bool operator()(int t, int m, int e, bool b) const
+    {
+        return e != ZEVENT_CLOSE || compileZone(t, m, e, b) == ZA_NONE;
+    }
+};
+struct ZoneDisarmedQuiet {  // only 24H and PANIC zones act while disarmed or during the exit delay
+    constexpr bool operator()(int t, int m, int e, bool b) const
+    {
+        return (m != ZMODE_DISARMED && m != ZMODE_EXIT) || t == ZONE_24H || t == ZONE_PANIC ||
+            compileZone(t, m, e, b) == ZA_NONE;
+    }
+};
+struct Zone24hAlways {   // 24H and PANIC zones alarm on open in every mode, BYPASS or not
+    constexpr bool operator()(int t, int m, int e, bool b) const
+    {
+        return e != ZEVENT_OPEN || (t != ZONE_24H && t != ZONE_PANIC) ||
+            compileZone(t, m, e, b) == (t == ZONE_PANIC ? ZA_PANIC : ZA_ALARM);
+    }
+};
+struct ZoneDelayAway {   // entry delays and followers only exist armed away
+    constexpr bool operator()(int t, int m, int e, bool b) const
+    {
+        return m == ZMODE_AWAY || (compileZone(t, m, e, b) != ZA_ENTRY_DELAY && compileZone(t, m, e, b) != ZA_FOLLOW);
+    }
+};
+struct ZoneArmedSecure { // in every armed mode an opened non-bypassed perimeter zone alarms at once
+    constexpr bool operator()(int t, int m, int e, bool b) const
+    {
+        return t != ZONE_PERIMETER || e != ZEVENT_OPEN || m == ZMODE_DISARMED || m == ZMODE_EXIT ||
+            compileZone(t, m, e, b) == ((b && m == ZMODE_BYPASS) ? ZA_BYPASSED : ZA_ALARM);
+    }
+};
+struct ZoneEntryExists { // a zone that starts the entry delay is never bypassed out of it
+    constexpr bool operator()(int t, int m, int e, bool b) const
+    {
+        return t != ZONE_ENTRY || m != ZMODE_AWAY || e != ZEVENT_OPEN || compileZone(t, m, e, b) == ZA_ENTRY_DELAY;
+    }
+};
+
+static_assert(allZones(ZoneValid()),         "ZONE_TABLE has an undefined action");
+static_assert(allZones(ZoneCloseQuiet()),    "ZONE_TABLE reacts to a loop closing");
+static_assert(allZones(ZoneDisarmedQuiet()), "ZONE_TABLE has a burglary zone active while disarmed");
+static_assert(allZones(Zone24hAlways()),     "ZONE_TABLE has a 24H or PANIC zone that does not always alarm");
+static_assert(allZones(ZoneDelayAway()),     "ZONE_TABLE has a delayed zone outside armed away");
+static_assert(allZones(ZoneArmedSecure()),   "ZONE_TABLE has a perimeter zone that does not alarm when armed");
+static_assert(allZones(ZoneEntryExists()),   "ZONE_TABLE has an entry zone without an entry delay armed away");
+
+// end of ZoneTable.h
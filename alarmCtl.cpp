@@ -0,0 +1,202 @@
+// The file alarmCtl.cpp is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+// alarmCtl - control the alarm daemon through its local control socket
+//
+// usage: alarmCtl [-s socket] [-p partition] [state|zones|away|stay|disarm|watch|rtt [count]]
+//   -s socket     control socket (default /run/alarm.sock, CTL_SOCKET in alarm_config)
+//   -p partition  partition (0 based, in alarm_config order) to query, arm or watch (default 0)
+//   state       print the alarm state (default)
+//   zones       print each zone and whether it is open
+//   away, stay  arm the alarm
+//   disarm      disarm the alarm
+//   watch       print the alarm state each time it changes
+//   rtt         time count state queries (default 1000), print round trip min/avg/max
+// exit status is 0 if the command succeeded
+
+#include "stdafx.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "AlarmCtl.h"
+
+static const char * armedName[] = { "disarmed", "armed-stay", "armed-away", "armed-bypass" };
+static const char * statusName[] = { "ok", "unknown command", "permission denied", "bad argument", "can't arm" };
+
+static const struct {   // commands that are a single request
+    const char * name;
+    uint8_t      cmd;
+} simpleCmds[] = {
+    { "state",  CTL_CMD_STATE },
+    { "away",   CTL_CMD_ARM_AWAY },
+    { "stay",   CTL_CMD_ARM_STAY },
+    { "disarm", CTL_CMD_DISARM },
+};
+
+static int      sock = -1;
+static uint16_t seq = 0;
+static uint8_t  part = 0;   // partition of the requests
+
+// returns a timestamp in microseconds
+static uint64_t nowUs(void)
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return (uint64_t)spec.tv_sec * 1000000 + spec.tv_nsec / 1000;
+}
+
+// send request cmd and wait for its response in msg.  Returns: false on socket error
+static bool request(uint8_t cmd, uint32_t arg, t_CtlMsg * msg)
+{
+    memset(msg, 0, sizeof(*msg));
+    msg->cmd = cmd;
+    msg->seq = ++seq;
+    msg->arg = arg;
+    msg->part = part;
+    if (send(sock, msg, sizeof(*msg), 0) != (int)sizeof(*msg))
+        return false;
+
+    do  // skip events that arrive ahead of the response
+    {
+        if (recv(sock, msg, sizeof(*msg), 0) != (int)sizeof(*msg))
+            return false;
+    } while (msg->cmd == CTL_EVENT || msg->seq != seq);
+    return true;
+}
+
+static void printState(const t_CtlMsg * msg)
+{
+    if (msg->partCount > 1)
+        printf("p=%u ", msg->part);
+    printf("v=%u %s%s%s%s  '%.16s' '%.16s'  open=%08x\n", msg->version, msg->armed < 4 ? armedName[msg->armed] : "?",
+        msg->ready ? " ready" : "", msg->alarm ? " ALARM" : "", msg->power ? "" : " no-power",
+        msg->text, msg->text + 17, msg->loopMask);
+}
+
+static void usage(const char * name)
+{
+    fprintf(stderr, "usage: %s [-s socket] [-p partition] [state|zones|away|stay|disarm|watch|rtt [count]]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    const char * path = CTL_SOCKET_FILE;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:p:")) != -1)
+    {
+        switch (opt)
+        {
+            case 's':
+                path = optarg;
+                break;
+            case 'p':
+                part = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+    }
+    const char * cmd = optind < argc ? argv[optind] : "state";
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    sock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror(path);
+        return -1;
+    }
+
+    t_CtlMsg msg;
+    bool ok = false;
+    int  simple = -1;
+
+    for (unsigned i=0; i < sizeof(simpleCmds)/sizeof(simpleCmds[0]); i++)
+    {
+        if (strcmp(cmd, simpleCmds[i].name) == 0)
+            simple = i;
+    }
+
+    if (simple >= 0)
+    {
+        if (!request(simpleCmds[simple].cmd, 0, &msg))
+        {
+            perror(cmd);
+        }
+        else
+        {
+            ok = (msg.status == CTL_OK);
+            if (!ok)
+                fprintf(stderr, "%s: %s\n", cmd, msg.status < 5 ? statusName[msg.status] : "error");
+            printState(&msg);
+        }
+    }
+    else if (strcmp(cmd, "zones") == 0)
+    {
+        ok = request(CTL_CMD_STATE, 0, &msg) && msg.status == CTL_OK;
+        int count = ok ? msg.zoneCount : 0;
+        for (int i=0; ok && i < count; i++)
+        {
+            ok = request(CTL_CMD_ZONE, i, &msg) && msg.status == CTL_OK;
+            printf("%2d %-32s %s\n", i, msg.text, msg.zoneOpen ? "open" : "closed");
+        }
+    }
+    else if (strcmp(cmd, "watch") == 0)
+    {
+        ok = request(CTL_CMD_SUBSCRIBE, 0, &msg) && msg.status == CTL_OK;
+        while (ok)
+        {
+            printState(&msg);
+            fflush(stdout);
+            ok = recv(sock, &msg, sizeof(msg), 0) == (int)sizeof(msg);
+        }
+    }
+    else if (strcmp(cmd, "rtt") == 0)
+    {
+        int count = optind + 1 < argc ? atoi(argv[optind + 1]) : 1000;
+        uint64_t minUs = ~0ULL, maxUs = 0, totalUs = 0;
+        ok = count > 0;
+        for (int i=0; ok && i < count; i++)
+        {
+            uint64_t start = nowUs();
+            ok = request(CTL_CMD_STATE, 0, &msg);
+            uint64_t us = nowUs() - start;
+            totalUs += us;
+            minUs = us < minUs ? us : minUs;
+            maxUs = us > maxUs ? us : maxUs;
+        }
+        if (ok)
+            printf("%d requests, round trip min %llu us, avg %llu us, max %llu us\n", count,
+                (unsigned long long)minUs, (unsigned long long)(totalUs / count), (unsigned long long)maxUs);
+    }
+    else
+    {
+        usage(argv[0]);
+    }
+    close(sock);
+    return ok ? 0 : -1;
+}
+
+// end of alarmCtl.cpp
@@ -0,0 +1,307 @@
+// The file alarmJournal.cpp is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+// alarmJournal - query the alarm daemon's binary event journal
+//
+// usage: alarmJournal [-f journal] [-c config] [-s start] [-e end] [-z zone] [counts|durations|timeline]
+//   -f journal  journal file (default /var/log/alarmJournal, index is journal.idx)
+//   -c config   config file used to name zones and users (default /etc/alarm_config)
+//   -s start    only events at or after start
+//   -e end      only events before end
+//   -z zone     only events for zone (loop name or index)
+//   counts      per zone open/close/noise/alarm counts
+//   durations   per zone open intervals: count, total, longest
+//   timeline    every event, oldest first (default)
+// times are local "YYYY-MM-DD[ HH:MM[:SS]]" or seconds since epoch
+
+#include "stdafx.h"
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "Config.h"
+#include "EventJournal.h"
+
+static const int MAX_ZONES = 256;   // zone is a uint8_t in the journal
+
+static Config config;
+static bool   haveConfig = false;
+
+// returns name of zone (loop) idx
+static const char * zoneName(uint8_t idx)
+{
+    static char buf[16];
+    if (idx == JOURNAL_NONE)
+        return "-";
+    if (haveConfig && idx < config.getLoopCount())
+        return config.getLoop()->name[idx];
+    sprintf(buf, "loop%u", idx);
+    return buf;
+}
+
+// returns name of user (pin) idx
+static const char * userName(uint8_t idx)
+{
+    static char buf[16];
+    if (idx == JOURNAL_NONE)
+        return "-";
+    if (haveConfig && idx < config.getPinCount())
+        return config.getPin()->name[idx];
+    sprintf(buf, "user%u", idx);
+    return buf;
+}
+
+// returns name of partition idx, empty if the config has none
+static const char * partName(uint8_t idx)
+{
+    if (haveConfig && idx < config.getPartitionCount())
+        return config.getPartition()->name[idx];
+    return "";
+}
+
+// parse a command line time.  Returns: ms since epoch, 0 if not valid
+static uint64_t parseTime(const char * s)
+{
+    static const char * formats[] = { "%Y-%m-%d %H:%M:%S", "%Y-%m-%d %H:%M", "%Y-%m-%d" };
+    char * end;
+
+    unsigned long long secs = strtoull(s, &end, 10);
+    if (*end == '\0')
+        return secs * 1000;
+
+    for (unsigned i=0; i < sizeof(formats)/sizeof(formats[0]); i++)
+    {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        end = strptime(s, formats[i], &tm);
+        if (end != NULL && *end == '\0')
+        {
+            tm.tm_isdst = -1;
+            return (uint64_t)mktime(&tm) * 1000;
+        }
+    }
+    return 0;
+}
+
+// format ms since epoch as local time
+static const char * timeStr(uint64_t ms)
+{
+    static char buf[32];
+    time_t secs = ms / 1000;
+    struct tm tm;
+    localtime_r(&secs, &tm);
+    int len = strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+    sprintf(buf+len, ".%03u", (unsigned)(ms % 1000));
+    return buf;
+}
+
+// format a duration in ms as [Nd ]HH:MM:SS
+static const char * durationStr(uint64_t ms, char * buf)
+{
+    uint64_t secs = ms / 1000;
+    if (secs >= 24*60*60)
+        sprintf(buf, "%ud %02u:%02u:%02u", (unsigned)(secs / (24*60*60)), (unsigned)(secs / 3600 % 24),
+            (unsigned)(secs / 60 % 60), (unsigned)(secs % 60));
+    else
+        sprintf(buf, "%02u:%02u:%02u", (unsigned)(secs / 3600), (unsigned)(secs / 60 % 60), (unsigned)(secs % 60));
+    return buf;
+}
+
+static void printCounts(const t_JournalEvent * ev, uint64_t first, uint64_t last, int zone)
+{
+    static uint32_t count[MAX_ZONES][EVENT_TYPE_COUNT];
+
+    for (uint64_t i=first; i < last; i++)
+    {
+        if (ev[i].type < EVENT_TYPE_COUNT && (zone < 0 || ev[i].zone == zone))
+            count[ev[i].zone][ev[i].type]++;
+    }
+
+    printf("%-16s %8s %8s %8s %8s\n", "zone", "open", "close", "noise", "alarm");
+    for (int z=0; z < MAX_ZONES; z++)
+    {
+        uint32_t * c = count[z];
+        if (c[EVENT_LOOP_OPEN] || c[EVENT_LOOP_CLOSE] || c[EVENT_LOOP_NOISE] || c[EVENT_ALARM])
+            printf("%-16s %8u %8u %8u %8u\n", zoneName(z), c[EVENT_LOOP_OPEN], c[EVENT_LOOP_CLOSE],
+                c[EVENT_LOOP_NOISE], c[EVENT_ALARM]);
+    }
+}
+
+static void printDurations(const t_JournalEvent * ev, uint64_t first, uint64_t last, int zone, uint64_t endMs)
+{
+    static uint64_t openedAt[MAX_ZONES];   // 0 if zone is closed
+    static uint64_t total[MAX_ZONES];
+    static uint64_t longest[MAX_ZONES];
+    static uint32_t count[MAX_ZONES];
+
+    for (uint64_t i=first; i < last; i++)
+    {
+        uint8_t z = ev[i].zone;
+        if (zone >= 0 && z != zone)
+            continue;
+
+        if (ev[i].type == EVENT_LOOP_OPEN && openedAt[z] == 0)
+        {
+            openedAt[z] = ev[i].timeMs;
+        }
+        else if (ev[i].type == EVENT_LOOP_CLOSE && openedAt[z] != 0)
+        {
+            uint64_t d = ev[i].timeMs - openedAt[z];
+            total[z] += d;
+            longest[z] = d > longest[z] ? d : longest[z];
+            count[z]++;
+            openedAt[z] = 0;
+        }
+        else if (ev[i].type == EVENT_START)  // daemon restarted, loop state is re-read from scratch
+        {
+            memset(openedAt, 0, sizeof(openedAt));
+        }
+    }
+
+    char tbuf[32], lbuf[32];
+    printf("%-16s %8s %16s %16s\n", "zone", "opened", "total", "longest");
+    for (int z=0; z < MAX_ZONES; z++)
+    {
+        if (openedAt[z] != 0)  // still open at end of range
+        {
+            uint64_t d = endMs > openedAt[z] ? endMs - openedAt[z] : 0;
+            total[z] += d;
+            longest[z] = d > longest[z] ? d : longest[z];
+            count[z]++;
+        }
+        if (count[z] != 0)
+            printf("%-16s %8u %16s %16s%s\n", zoneName(z), count[z], durationStr(total[z], tbuf),
+                durationStr(longest[z], lbuf), openedAt[z] != 0 ? "  (open)" : "");
+    }
+}
+
+static void printTimeline(const t_JournalEvent * ev, uint64_t first, uint64_t last, int zone)
+{
+    static const char * armedName[] = { "disarmed", "stay", "away", "bypass" };
+
+    for (uint64_t i=first; i < last; i++)
+    {
+        if (zone >= 0 && ev[i].zone != zone)
+            continue;
+        printf("%s  %-10s %-16s %-16s %-8s %s\n", timeStr(ev[i].timeMs), EventJournal::typeName(ev[i].type),
+            zoneName(ev[i].zone), userName(ev[i].user), ev[i].armed < 4 ? armedName[ev[i].armed] : "?",
+            partName(ev[i].partition));
+    }
+}
+
+static void usage(const char * name)
+{
+    fprintf(stderr, "usage: %s [-f journal] [-c config] [-s start] [-e end] [-z zone] [counts|durations|timeline]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    const char * path = JOURNAL_FILE;
+    const char * configFile = ALARM_CONFIG_FILE;
+    const char * zoneArg = NULL;
+    uint64_t startMs = 0;
+    uint64_t endMs = ~0ULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:c:s:e:z:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'f':
+                path = optarg;
+                break;
+            case 'c':
+                configFile = optarg;
+                break;
+            case 's':
+            case 'e':
+            {
+                uint64_t t = parseTime(optarg);
+                if (t == 0)
+                {
+                    fprintf(stderr, "Invalid time '%s'\n", optarg);
+                    return -1;
+                }
+                if (opt == 's')
+                    startMs = t;
+                else
+                    endMs = t;
+                break;
+            }
+            case 'z':
+                zoneArg = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+    }
+    const char * cmd = optind < argc ? argv[optind] : "timeline";
+
+    haveConfig = access(configFile, R_OK) == 0 && config.readFile(configFile);
+
+    int zone = -1;
+    if (zoneArg != NULL)
+    {
+        char * end;
+        zone = strtol(zoneArg, &end, 10);
+        if (*end != '\0')  // not a number, look up loop name
+        {
+            zone = -1;
+            for (int i=0; haveConfig && i < config.getLoopCount(); i++)
+            {
+                if (strcasecmp(config.getLoop()->name[i], zoneArg) == 0)
+                    zone = i;
+            }
+            if (zone < 0)
+            {
+                fprintf(stderr, "Unknown zone '%s'\n", zoneArg);
+                return -1;
+            }
+        }
+    }
+
+    char idxPath[256];
+    snprintf(idxPath, sizeof(idxPath), "%s.idx", path);
+
+    EventJournal journal;
+    if (!journal.openRead(path, idxPath))
+    {
+        fprintf(stderr, "Failed to read journal '%s'\n", path);
+        return -1;
+    }
+
+    uint64_t first = journal.findTime(startMs);
+    uint64_t last  = endMs == ~0ULL ? journal.getEventCount() : journal.findTime(endMs);
+    const t_JournalEvent * ev = journal.getEvents();
+
+    if (strcmp(cmd, "counts") == 0)
+        printCounts(ev, first, last, zone);
+    else if (strcmp(cmd, "durations") == 0)
+        printDurations(ev, first, last, zone, endMs != ~0ULL ? endMs : EventJournal::nowMs());
+    else if (strcmp(cmd, "timeline") == 0)
+        printTimeline(ev, first, last, zone);
+    else
+    {
+        usage(argv[0]);
+        journal.closeRead();
+        return -1;
+    }
+    journal.closeRead();
+    return 0;
+}
+
+// end of alarmJournal.cpp
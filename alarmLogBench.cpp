@@ -0,0 +1,118 @@
+// The file alarmLogBench.cpp is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+// alarmLogBench - time a LOG_DEFAULT logMsg call against formatting the message at the call
+//
+// usage: alarmLogBench [-n count]
+//   -n count   calls timed per case (default 1000000)
+// Times the "Sent F7 msg" line the main loop logs on every keypad update, and a message with
+// int args only.  The deferred case is logMsg, which stores the format pointer and args in its
+// ring; the formatted case does what logMsg did before it deferred: clock_gettime, localtime,
+// sprintf of the time stamp, vsnprintf and a copy into a 1024 x 256 ring.  Prints ns per call.
+// Nothing is written to the log files (initLogMsg is not called).
+
+#include "stdafx.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "logMsg.h"
+
+static const int FMT_RING_SIZE = 1024;
+static const int FMT_MSG_LEN   = 256;
+
+static char fmtRing[FMT_RING_SIZE][FMT_MSG_LEN];
+static int  fmtHead = 0;
+
+// the message formatted at the call, as logMsg did before the ring stored args
+static void formatMsg(const char * fmt, ...) __attribute__((format(printf, 1, 2)));
+static void formatMsg(const char * fmt, ...)
+{
+    static char msg[FMT_MSG_LEN];
+    struct timespec ts;
+    struct tm tm;
+    va_list pArg;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    localtime_r(&ts.tv_sec, &tm);
+    int len = sprintf(msg, "%02d/%02d %02d:%02d:%02d.%03ld ", tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min,
+        tm.tm_sec, ts.tv_nsec / 1000000);
+    va_start(pArg, fmt);
+    vsnprintf(msg + len, sizeof(msg) - len, fmt, pArg);
+    va_end(pArg);
+    strcpy(fmtRing[fmtHead++ % FMT_RING_SIZE], msg);
+}
+
+// Returns: ns since the precise clock started
+static double nowNs(void)
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return spec.tv_sec * 1e9 + spec.tv_nsec;
+}
+
+static void usage(const char * name)
+{
+    fprintf(stderr, "usage: %s [-n count]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    const char * f7 = "F7 t=0 c=1 r=1 a=0 b=1 1=Disarmed   10:15 2=Ready to arm    \n";
+    int count = 1000000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                count = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+    }
+    if (count < 1)
+    {
+        usage(argv[0]);
+        return -1;
+    }
+
+    double t0 = nowNs();
+    for (int i=0; i < count; i++)
+        formatMsg("Sent F7 msg to keypad: %s", f7);
+    double t1 = nowNs();
+    for (int i=0; i < count; i++)
+        logMsg(LOG_DEFAULT, "Sent F7 msg to keypad: %s", f7);
+    double t2 = nowNs();
+    for (int i=0; i < count; i++)
+        formatMsg("loop %d changed, mask = 0x%08x\n", i & 31, (uint32_t)i);
+    double t3 = nowNs();
+    for (int i=0; i < count; i++)
+        logMsg(LOG_DEFAULT, "loop %d changed, mask = 0x%08x\n", i & 31, (uint32_t)i);
+    double t4 = nowNs();
+
+    printf("%-28s %10s %10s\n", "ns per call", "formatted", "deferred");
+    printf("%-28s %10.1f %10.1f\n", "Sent F7 msg (%s arg)", (t1 - t0) / count, (t2 - t1) / count);
+    printf("%-28s %10.1f %10.1f\n", "loop changed (int args)", (t3 - t2) / count, (t4 - t3) / count);
+    return 0;
+}
+
+// end of alarmLogBench.cpp
@@ -0,0 +1,169 @@
+// The file alarmRenderBench.cpp is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+// alarmRenderBench - time the keypad display rendering of a main loop pass
+//
+// usage: alarmRenderBench [-c config] [-n count]
+//   -c config   config file (default /etc/alarm_config), needs a loop and no partitions
+//   -n count    passes timed per case (default 1000000)
+// Runs one partition on a virtual clock and times three kinds of main loop pass, each ending
+// with publishState and makeF7msg as the main loop does:
+//   changes   the first loop opens, closes and opens again (three state updates)
+//   countdown a second of the exit delay ticks by
+//   idle      nothing changed, the clock minute moves
+// Prints ns per pass and the last F7 message.  Nothing is sent and no gpio is touched.
+
+#include "stdafx.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <wiringPi.h>
+
+#include "Config.h"
+#include "AlarmManager.h"
+#include "InputTrace.h"
+#include "Clock.h"
+#include "sendEmail.h"
+#include "Stats.h"
+#include "logMsg.h"
+
+t_AlarmStats alarmStats;   // the core counts into these
+InputTrace   inputTrace;   // closed, nothing is recorded
+
+// the core's alerts (arming) and siren end up here
+bool sendEmail(const char * from, const char * to, const char * passwd, const char * subj, const char * mesg)
+{
+    return true;
+}
+
+void digitalWrite(int pin, int value)
+{
+}
+
+// Returns: ns since the precise clock started (not the alarm's virtual clock)
+static double nowNs(void)
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return spec.tv_sec * 1e9 + spec.tv_nsec;
+}
+
+static void usage(const char * name)
+{
+    fprintf(stderr, "usage: %s [-c config] [-n count]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    const char * configFile = ALARM_CONFIG_FILE;
+    Config config;
+    int count = 1000000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:n:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'c':
+                configFile = optarg;
+                break;
+            case 'n':
+                count = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+    }
+    if (count < 1)
+    {
+        usage(argv[0]);
+        return -1;
+    }
+    if (!config.readFile(configFile) || !config.validate())
+    {
+        fprintf(stderr, "Failed to read config file %s\n", configFile);
+        return -1;
+    }
+    if (config.getLoopCount() < 1 || config.getPartitionCount() != 1)
+    {
+        fprintf(stderr, "%s needs at least one loop and a single partition\n", configFile);
+        return -1;
+    }
+    setLogLevel(-1, LOG_LVL_ERROR);
+
+    Clock::setVirtual(MS_TO_NS(1000000), time(NULL));
+    EventJournal journal;  // not opened, nothing is journaled
+    AlarmManager am;
+    am.init(&config, 0, &journal);
+
+    char     buf[F7_FRAME_SIZE];
+    uint32_t sum = 0;  // keeps the frames from being optimized away
+
+    // changes
+    double t0 = nowNs();
+    for (int i=0; i < count; i++)
+    {
+        uint32_t open = (i & 1) ? 0 : 0x1;
+        am.checkLoops(open, 0);
+        am.checkLoops(open ^ 0x1, 0);
+        am.checkLoops(open, 0);
+        am.publishState();
+        am.makeF7msg(buf, 10, i % 60);
+        sum += buf[40];
+    }
+    double changeNs = (nowNs() - t0) / count;
+    am.checkLoops(0, 0);
+
+    // countdown, timed between arming and the end of each exit delay
+    int ticks = DEFAULT_TIMEOUT_MS / 1000 - 2;
+    double tickNs = 0;
+    for (int done=0; done < count; done += ticks)
+    {
+        am.arm(ARMED_AWAY, "bench");
+        t0 = nowNs();
+        for (int i=0; i < ticks; i++)
+        {
+            Clock::advance(MS_TO_NS(1000));
+            am.checkTimeouts();
+            am.publishState();
+            am.makeF7msg(buf, 10, i % 60);
+            sum += buf[40];
+        }
+        tickNs += nowNs() - t0;
+        am.disarm("bench");
+        am.checkTimeouts();
+    }
+    tickNs /= ((count + ticks - 1) / ticks) * ticks;
+
+    // idle
+    t0 = nowNs();
+    for (int i=0; i < count; i++)
+    {
+        am.publishState();
+        am.makeF7msg(buf, 10, i % 60);
+        sum += buf[40];
+    }
+    double idleNs = (nowNs() - t0) / count;
+
+    printf("ns per pass: changes %.0f, countdown %.0f, idle %.0f  (%u)\n", changeNs, tickNs, idleNs, sum);
+    printf("%s", buf);
+    am.fini();
+    return 0;
+}
+
+// end of alarmRenderBench.cpp
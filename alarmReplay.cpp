@@ -0,0 +1,248 @@
+// The file alarmReplay.cpp is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+// alarmReplay - replay an input trace (INPUT_TRACE in the config) through the alarm core
+//
+// usage: alarmReplay [-c config] [-q] trace
+//   -c config   config file the alarm ran with (default /etc/alarm_config)
+//   -q          print only the summary (for timing a long trace)
+// The partitions run on a virtual clock that jumps from record to record, so a trace replays
+// as fast as the core can go.  Printed are the F7 messages, alerts and gpio writes the alarm
+// made, each with the seconds since the trace started, then a summary.  Nothing is sent and
+// no gpio is touched.
+
+#include "stdafx.h"
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <wiringPi.h>
+
+#include "Config.h"
+#include "AlarmManager.h"
+#include "AlarmCtl.h"
+#include "InputTrace.h"
+#include "Clock.h"
+#include "sendEmail.h"
+#include "Stats.h"
+#include "logMsg.h"
+
+t_AlarmStats alarmStats;   // the core counts into these
+InputTrace   inputTrace;   // closed, the core records nothing while replaying
+
+static t_TraceHeader header;
+static uint64_t now;       // ms of the record being replayed
+static bool     quiet = false;
+static uint32_t alerts = 0;
+static uint32_t gpioWrites = 0;
+
+// print the seconds since the trace started
+static void stamp(void)
+{
+    uint64_t ms = now - header.startMs;
+    printf("%7llu.%03u ", (unsigned long long)ms / 1000, (unsigned)(ms % 1000));
+}
+
+// the core's alerts end up here instead of in an email
+bool sendEmail(const char * from, const char * to, const char * passwd, const char * subj, const char * mesg)
+{
+    alerts++;
+    if (!quiet)
+    {
+        stamp();
+        printf("ALERT %s\n", mesg);
+    }
+    return true;
+}
+
+// and its siren writes here instead of the gpio
+void digitalWrite(int pin, int value)
+{
+    gpioWrites++;
+    if (!quiet)
+    {
+        stamp();
+        printf("GPIO %d=%d\n", pin, value);
+    }
+}
+
+static void usage(const char * name)
+{
+    fprintf(stderr, "usage: %s [-c config] [-q] trace\n", name);
+}
+
+// publish the state of every partition, as the main loop does each pass
+static void publishAll(AlarmManager * part, int partCount)
+{
+    for (int p=0; p < partCount; p++)
+        part[p].publishState();
+}
+
+int main(int argc, char *argv[])
+{
+    const char * configFile = ALARM_CONFIG_FILE;
+    Config       config;
+    InputTrace   trace;
+    t_TraceRec   rec;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:q")) != -1)
+    {
+        switch (opt)
+        {
+            case 'c':
+                configFile = optarg;
+                break;
+            case 'q':
+                quiet = true;
+                break;
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+    }
+    if (optind >= argc)
+    {
+        usage(argv[0]);
+        return -1;
+    }
+    if (!config.readFile(configFile) || !config.validate())
+    {
+        fprintf(stderr, "Failed to read config file %s\n", configFile);
+        return -1;
+    }
+    if (!trace.openRead(argv[optind]))
+    {
+        fprintf(stderr, "%s is not an input trace\n", argv[optind]);
+        return -1;
+    }
+    header = *trace.getHeader();
+    if (InputTrace::fileCrc(configFile) != header.configCrc)
+        fprintf(stderr, "Warning: %s is not the config the trace was recorded with\n", configFile);
+    setLogLevel(-1, LOG_LVL_ERROR);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // start up as the daemon does (see main.cpp)
+    now = header.startMs;
+    Clock::setVirtual(MS_TO_NS(now), header.startWall);
+    EventJournal journal;  // not opened, the replay journals nothing
+    int partCount = config.getPartitionCount();
+    AlarmManager * part = new AlarmManager[partCount];
+    for (int p=0; p < partCount; p++)
+        part[p].init(&config, p, &journal);
+    bool started = false;  // daemon sends its start alert once the partitions resumed
+
+    uint32_t mask = 0, noise = 0;
+    uint32_t records = 0, passes = 0, frames = 0;
+    char     buf[F7_FRAME_SIZE];
+
+    while (trace.next(&rec))
+    {
+        records++;
+        if (!started && rec.type != TRACE_RESUME)
+        {
+            part[0].sendAlertMsg("alarm app started");
+            started = true;
+        }
+        Clock::advance(MS_TO_NS(rec.ms - now));
+        now = rec.ms;
+
+        switch (rec.type)
+        {
+            case TRACE_LOOPS:
+                mask = rec.arg[0];
+                noise = rec.arg[1];
+                break;
+
+            case TRACE_KEYS:
+                AlarmManager::dispatchKeyMsg(rec.text, rec.len);
+                break;
+
+            case TRACE_CONTROL:
+                if ((int)rec.arg[1] >= partCount)
+                    break;
+                if (rec.arg[0] == CTL_CMD_DISARM)
+                    part[rec.arg[1]].disarm(rec.text);
+                else
+                    part[rec.arg[1]].arm(rec.arg[0] == CTL_CMD_ARM_AWAY ? ARMED_AWAY : ARMED_STAY, rec.text);
+                part[rec.arg[1]].publishState();
+                break;
+
+            case TRACE_CHECK:
+                for (int p=0; p < partCount; p++)
+                {
+                    part[p].checkLoops(mask, noise);
+                    part[p].checkTimeouts();
+                }
+                break;
+
+            case TRACE_F7:
+                if ((int)rec.arg[0] >= partCount)
+                    break;
+                publishAll(part, partCount);  // main loop publishes before sending
+                part[rec.arg[0]].makeF7msg(buf, rec.arg[1], rec.arg[2]);
+                part[rec.arg[0]].setLastMsgTime();
+                frames++;
+                if (!quiet)
+                {
+                    stamp();
+                    printf("%s", buf);
+                }
+                break;
+
+            case TRACE_RELOAD:
+                if (rec.arg[0] != header.configCrc)
+                    fprintf(stderr, "Warning: config was edited at %llu s, replay goes on with %s\n",
+                        (unsigned long long)(now - header.startMs) / 1000, configFile);
+                break;
+
+            case TRACE_RESUME:  // daemon restarted while armed
+                if ((int)rec.arg[0] < partCount)
+                {
+                    t_ArmPart saved;
+                    memset(&saved, 0, sizeof(saved));
+                    saved.state    = rec.arg[1] & 0xFF;
+                    saved.mode     = (rec.arg[1] >> 8) & 0xFF;
+                    saved.chime    = (rec.arg[1] >> 16) & 0xFF;
+                    saved.loopMask = rec.arg[2];
+                    saved.timerMs  = rec.arg[3];
+                    part[rec.arg[0]].resume(&saved, 0);
+                }
+                break;
+
+            case TRACE_END:
+                publishAll(part, partCount);
+                noise = 0;  // noise is only reported by the sample that saw it
+                passes++;
+                break;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    trace.closeRead();
+
+    double hours = (now - header.startMs) / 3600000.0;
+    double ms = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0;
+    printf("%u records, %u passes, %u F7 msgs, %u alerts, %u gpio writes: %.1f hours of alarm time in %.1f ms\n",
+        records, passes, frames, alerts, gpioWrites, hours, ms);
+
+    for (int p=0; p < partCount; p++)
+        part[p].fini();
+    delete[] part;
+    return 0;
+}
+
+// end of alarmReplay.cpp
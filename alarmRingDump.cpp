@@ -0,0 +1,84 @@
+// The file alarmRingDump.cpp is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+// alarmRingDump - print the log messages held in the alarm daemon's crash-surviving log ring
+//
+// usage: alarmRingDump [-a] [-n count] [ring_file]
+//   -a        print all messages in the ring, not just those not yet flushed to alarmLog
+//   -n count  print at most the newest count messages
+
+#include "stdafx.h"
+#include <string.h>
+#include <unistd.h>
+
+#include "LogRing.h"
+
+static const char * DEFAULT_RING_FILE = "/var/log/alarmLog.ring";
+
+static void printMsg(const char * text, int len, void * ctx)
+{
+    fwrite(text, 1, len, stdout);
+}
+
+int main(int argc, char *argv[])
+{
+    bool all = false;
+    int  count = 1 << 30;
+    int  opt;
+
+    while ((opt = getopt(argc, argv, "an:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'a':
+                all = true;
+                break;
+            case 'n':
+                count = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-a] [-n count] [ring_file]\n", argv[0]);
+                return -1;
+        }
+    }
+    const char * path = optind < argc ? argv[optind] : DEFAULT_RING_FILE;
+
+    LogRing ring;
+    if (!ring.init(path, 0, true))
+    {
+        fprintf(stderr, "No valid log ring in '%s'\n", path);
+        return -1;
+    }
+
+    uint64_t from = all ? 0 : ring.getFlushPos();
+    fprintf(stderr, "generation %u, %llu bytes written, %llu unflushed\n", ring.getGeneration(),
+        (unsigned long long)ring.getWritePos(), (unsigned long long)(ring.getWritePos() - ring.getFlushPos()));
+
+    uint64_t span = ring.getWritePos() - from;
+    if (span > ring.getDataSize())
+        span = ring.getDataSize();  // older records have been overwritten
+    int maxRecs = span / 11 + 1;  // 11 bytes is the smallest possible record
+    int recs = ring.readRecords(from, count < maxRecs ? count : maxRecs, printMsg, NULL);
+    ring.fini();
+    if (recs < 0)
+    {
+        fprintf(stderr, "Not enough memory to read %d records, try -n\n", count < maxRecs ? count : maxRecs);
+        return -1;
+    }
+    return 0;
+}
+
+// end of alarmRingDump.cpp
@@ -0,0 +1,277 @@
+// The file alarmSockBench.cpp is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+// alarmSockBench - time SockServer broadcasts to many local clients
+//
+// usage: alarmSockBench [-c clients] [-s stalled] [-n updates] [-l ip:port]
+//   -c clients   clients that read every update (default 120)
+//   -s stalled   clients that connect and never read (default 2)
+//   -n updates   state updates broadcast (default 5000)
+//   -l ip:port   address the server listens on (default 127.0.0.1:5799)
+// Runs a SockServer and its clients in one process.  Each update is broadcast to all clients
+// in one pass, as the main loop does, then the readers drain their sockets.  Prints the time
+// per broadcast and checks that every reader got every update in order.  Then long lines are
+// broadcast until the kernel and server buffers of the stalled clients fill, to check they
+// are dropped while the readers keep up.
+// exit status is 1 if a reader missed an update or a stalled client was not dropped
+
+#include "stdafx.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <wiringPi.h>
+
+#include "SockServer.h"
+#include "InputTrace.h"
+#include "sendEmail.h"
+#include "Stats.h"
+#include "logMsg.h"
+
+t_AlarmStats alarmStats;   // the core counts into these
+InputTrace   inputTrace;   // closed, nothing is recorded
+
+static const int UPDATE_LEN = 64;   // bytes per update, about a state delta
+
+// SockServer links the alarm core, which alerts and drives the siren through these
+bool sendEmail(const char * from, const char * to, const char * passwd, const char * subj, const char * mesg)
+{
+    return true;
+}
+
+void digitalWrite(int pin, int value)
+{
+}
+
+struct t_BenchClient {
+    int      fd;
+    uint32_t next;      // update number expected next
+    int      len;       // bytes of a partial update in buf
+    char     buf[UPDATE_LEN];
+    bool     failed;    // got an update out of order
+};
+
+// Returns: ns since the precise clock started
+static double nowNs(void)
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return spec.tv_sec * 1e9 + spec.tv_nsec;
+}
+
+// format update n, UPDATE_LEN bytes with the newline
+static void makeUpdate(char * buf, uint32_t n)
+{
+    int len = snprintf(buf, UPDATE_LEN, "D v=%u armed=1 ready=0 l1=Armed Away l2=May Exit Now", n);
+    memset(buf + len, ' ', UPDATE_LEN - 1 - len);
+    buf[UPDATE_LEN - 1] = '\n';
+}
+
+// read and discard what client c has received
+static void discardClient(t_BenchClient * c)
+{
+    char buf[16384];
+
+    while (recv(c->fd, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+        ;
+}
+
+// read what client c has received, checking each update is the next one
+static void drainClient(t_BenchClient * c)
+{
+    char buf[16384];
+    int  n;
+
+    while ((n = recv(c->fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+    {
+        for (int i=0; i < n; i++)
+        {
+            c->buf[c->len++] = buf[i];
+            if (c->len < UPDATE_LEN)
+                continue;
+            char expect[UPDATE_LEN];
+            makeUpdate(expect, c->next);
+            if (memcmp(c->buf, expect, UPDATE_LEN) != 0)
+                c->failed = true;
+            c->next++;
+            c->len = 0;
+        }
+    }
+}
+
+// connect a client to addr.  Returns: socket, -1 on failure
+static int connectClient(const struct sockaddr_in * addr, bool stalled)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    if (stalled)
+    {
+        int size = 1024;  // fills quickly, as a client on a slow link would
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+    if (connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void usage(const char * name)
+{
+    fprintf(stderr, "usage: %s [-c clients] [-s stalled] [-n updates] [-l ip:port]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    const char * listenAddr = "127.0.0.1:5799";
+    int readers = 120;
+    int stalled = 2;
+    int updates = 5000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:s:n:l:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'c':
+                readers = atoi(optarg);
+                break;
+            case 's':
+                stalled = atoi(optarg);
+                break;
+            case 'n':
+                updates = atoi(optarg);
+                break;
+            case 'l':
+                listenAddr = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+    }
+    if (readers < 1 || stalled < 0 || readers + stalled > SOCK_MAX_CLIENTS || updates < 1)
+    {
+        fprintf(stderr, "clients + stalled must be 1 to %d\n", SOCK_MAX_CLIENTS);
+        usage(argv[0]);
+        return -1;
+    }
+    setLogLevel(-1, LOG_LVL_ERROR);
+
+    SockServer server;
+    struct sockaddr_in addr;
+    if (!parseListenAddr(listenAddr, &addr) || !server.init(listenAddr))
+        return -1;
+
+    t_BenchClient * client = new t_BenchClient[readers + stalled];
+    for (int i=0; i < readers + stalled; i++)
+    {
+        memset(&client[i], 0, sizeof(client[i]));
+        client[i].fd = connectClient(&addr, i >= readers);
+        if (client[i].fd < 0)
+        {
+            fprintf(stderr, "client %d failed to connect (%s)\n", i, strerror(errno));
+            return -1;
+        }
+    }
+
+    // the server accepts on its next polls
+    char msg[256];
+    for (int t=0; t < 1000 && server.getClientCount() < readers + stalled; t++)
+    {
+        server.recvMsg(msg, sizeof(msg));
+        usleep(1000);
+    }
+    printf("%d clients connected (%d reading, %d stalled)\n", server.getClientCount(), readers, stalled);
+
+    char   update[UPDATE_LEN + 1];
+    double sendNs = 0, drainNs = 0, maxNs = 0;
+    update[UPDATE_LEN] = '\0';
+    for (int u=0; u < updates; u++)
+    {
+        makeUpdate(update, u);
+        double t0 = nowNs();
+        server.broadcast(update);
+        double t1 = nowNs();
+        server.recvMsg(msg, sizeof(msg));  // main loop pass: flush queued output, drop closed clients
+        for (int i=0; i < readers; i++)
+            drainClient(&client[i]);
+        double t2 = nowNs();
+        sendNs += t1 - t0;
+        drainNs += t2 - t1;
+        maxNs = max(maxNs, t1 - t0);
+    }
+
+    // collect what is still in flight
+    int missing = 0, failed = 0;
+    for (int t=0; t < 1000; t++)
+    {
+        server.recvMsg(msg, sizeof(msg));
+        missing = 0;
+        for (int i=0; i < readers; i++)
+        {
+            drainClient(&client[i]);
+            if (client[i].next < (uint32_t)updates)
+                missing++;
+        }
+        if (missing == 0)
+            break;
+        usleep(1000);
+    }
+    for (int i=0; i < readers; i++)
+    {
+        if (client[i].failed)
+            failed++;
+    }
+    printf("%d updates: %.0f ns per broadcast (max %.0f), %.0f ns for the readers to drain each\n",
+        updates, sendNs / updates, maxNs, drainNs / updates);
+    printf("%d readers missed updates, %d got one out of order\n", missing, failed);
+
+    // flood, the socket send buffer grows to a few MB before the server's write buffer fills
+    char flood[SOCK_CLIENT_WBUF / 2];
+    int  floods = 0;
+    memset(flood, 'x', sizeof(flood) - 2);
+    flood[sizeof(flood) - 2] = '\n';
+    flood[sizeof(flood) - 1] = '\0';
+    while (server.getClientCount() > readers && floods < 10000)
+    {
+        server.broadcast(flood);
+        server.recvMsg(msg, sizeof(msg));
+        for (int i=0; i < readers; i++)
+            discardClient(&client[i]);
+        floods++;
+    }
+    int dropped = readers + stalled - server.getClientCount();
+    printf("%d of %d stalled clients dropped after %d KB\n", dropped, stalled,
+        (updates * UPDATE_LEN + floods * (int)(sizeof(flood) - 1)) / 1024);
+
+    server.fini();
+    for (int i=0; i < readers + stalled; i++)
+        close(client[i].fd);
+    delete[] client;
+
+    bool ok = missing == 0 && failed == 0 && dropped == stalled;
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+// end of alarmSockBench.cpp
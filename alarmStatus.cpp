@@ -0,0 +1,129 @@
+// The file alarmStatus.cpp is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+// alarmStatus - show the alarm status the daemon publishes in shared memory
+//
+// usage: alarmStatus [-w] [-i ms] [-z] [-c]
+//   -w      watch, print the status each time it changes
+//   -i ms   poll interval for -w (default 100)
+//   -z      also list the zones and whether each is open
+//   -c      also print the health counters
+// With partitions the house status is followed by a line per partition.
+// exit status is 1 if the daemon has not updated the status for 5 seconds
+
+#include "stdafx.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "StatusShm.h"
+
+static const char * armedName[] = { "disarmed", "armed-stay", "armed-away", "armed-bypass" };
+
+static StatusShm     status;
+static t_StatusZones zoneNames;  // names of the zones in loopMask, read with each snapshot
+
+static void printStatus(const t_StatusData * d, bool zones, bool counters)
+{
+    long age = (long)time(NULL) - (long)d->updateTime;
+
+    printf("v=%u %s%s%s%s%s  '%s' '%s'  open=%08x%s\n", d->version, d->armed < 4 ? armedName[d->armed] : "?",
+        d->ready ? " ready" : "", d->alarm ? " ALARM" : "", d->chime ? " chime" : "", d->power ? "" : " no-power",
+        d->line1, d->line2, d->loopMask, age > 5 ? "  (stale)" : "");
+
+    for (int p=0; d->partCount > 1 && p < d->partCount && p < STATUS_MAX_PARTS; p++)
+    {
+        const t_StatusPart * dp = &d->part[p];
+        printf("  p=%d v=%u %s%s%s%s  '%s' '%s'  open=%08x\n", p, dp->version, dp->armed < 4 ? armedName[dp->armed] : "?",
+            dp->ready ? " ready" : "", dp->alarm ? " ALARM" : "", dp->chime ? " chime" : "", dp->line1, dp->line2, dp->loopMask);
+    }
+
+    for (int i=0; zones && i < (int)zoneNames.zoneCount && i < MAX_SENSE_LOOPS; i++)
+        printf("  %2d %-32.*s %s\n", i, MAX_LOOP_NAME_LENGTH, zoneNames.zoneName[i], (d->loopMask >> i) & 0x1 ? "open" : "closed");
+
+    if (counters)
+    {
+        printf("  serialErrors %u  f7Sent %u  keyMsgs %u  loopChanges %u  loopNoise %u\n", d->stats.serialErrors,
+            d->stats.f7Sent, d->stats.keyMsgs, d->stats.loopChanges, d->stats.loopNoise);
+        printf("  alertsSent %u  alertFailures %u  sockCmds %u  httpRequests %u\n", d->stats.alertsSent,
+            d->stats.alertFailures, d->stats.sockCmds, d->stats.httpRequests);
+    }
+}
+
+static void usage(const char * name)
+{
+    fprintf(stderr, "usage: %s [-w] [-i ms] [-z] [-c]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    bool watch = false, zones = false, counters = false;
+    int  intervalMs = 100;
+    int  opt;
+
+    while ((opt = getopt(argc, argv, "wi:zc")) != -1)
+    {
+        switch (opt)
+        {
+            case 'w':
+                watch = true;
+                break;
+            case 'i':
+                intervalMs = atoi(optarg);
+                break;
+            case 'z':
+                zones = true;
+                break;
+            case 'c':
+                counters = true;
+                break;
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+    }
+
+    if (!status.openRead(STATUS_SHM_NAME))
+    {
+        fprintf(stderr, "Alarm status not available (is the alarm running?)\n");
+        return -1;
+    }
+
+    t_StatusData d;
+    if (!status.read(&d, zones ? &zoneNames : NULL))
+    {
+        fprintf(stderr, "Failed to read a consistent status\n");
+        return -1;
+    }
+    printStatus(&d, zones, counters);
+
+    while (watch)
+    {
+        uint32_t version = d.version;
+        uint32_t epoch = d.epoch;
+        usleep(intervalMs * 1000);
+        if (status.read(&d, zones ? &zoneNames : NULL) && (d.version != version || d.epoch != epoch))
+        {
+            printStatus(&d, zones, counters);
+            fflush(stdout);
+        }
+    }
+    status.closeRead();
+    return (long)time(NULL) - (long)d.updateTime > 5 ? 1 : 0;
+}
+
+// end of alarmStatus.cpp
@@ -0,0 +1,192 @@
+// The file alarmStatusTorture.cpp is part of RPIalarm.
+// Copyright (C) 2018  Thomas Vickers
+//
+// RPIalarm is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// RPIalarm is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with RPIalarm.  If not, see <http://www.gnu.org/licenses/>.
+
+// alarmStatusTorture - check that status shm readers never see a torn snapshot
+//
+// usage: alarmStatusTorture [-r readers] [-t seconds] [-s name]
+//   -r readers  reader processes (default 4)
+//   -t seconds  how long to run (default 5)
+//   -s name     shm segment to use (default /alarmStatusTorture, not the daemon's)
+// The writer publishes snapshots as fast as it can, every word of snapshot n holds n, and
+// rewrites the zone names the same way every 64 snapshots.  Each reader copies snapshots with
+// StatusShm::read and checks that all words of a copy are equal and n never goes back.
+// exit status is 1 if any reader saw a torn or stale snapshot
+
+#include "stdafx.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "StatusShm.h"
+#include "Clock.h"
+
+static const int MAX_READERS = 64;
+
+// fill every word of buf with n
+static void fillWords(void * buf, int size, uint32_t n)
+{
+    uint32_t * w = (uint32_t *)buf;
+
+    for (int i=0; i < size / 4; i++)
+        w[i] = n;
+}
+
+// Returns: true if every word of buf holds the same value, which is put in *pN
+static bool sameWords(const void * buf, int size, uint32_t * pN)
+{
+    const uint32_t * w = (const uint32_t *)buf;
+
+    for (int i=1; i < size / 4; i++)
+    {
+        if (w[i] != w[0])
+            return false;
+    }
+    *pN = w[0];
+    return true;
+}
+
+// reader process.  Returns: exit status, 1 if a torn or stale snapshot was seen
+static int reader(int idx, const char * name, uint64_t endMs)
+{
+    StatusShm     status;
+    t_StatusData  d;
+    t_StatusZones z;
+    uint32_t lastData = 0, lastZones = 0;
+    uint32_t reads = 0, busy = 0, torn = 0, stale = 0;
+
+    if (!status.openRead(name))
+    {
+        fprintf(stderr, "reader %d failed to open %s\n", idx, name);
+        return 1;
+    }
+    while (Clock::ms() < endMs)
+    {
+        uint32_t nData, nZones;
+
+        if (!status.read(&d, &z))
+        {
+            busy++;
+            continue;
+        }
+        reads++;
+        if (!sameWords(&d, sizeof(d), &nData) || !sameWords(&z, sizeof(z), &nZones))
+        {
+            torn++;
+            continue;
+        }
+        if (nData < lastData || nZones < lastZones)
+            stale++;
+        lastData = nData;
+        lastZones = nZones;
+    }
+    status.closeRead();
+
+    printf("reader %d: %u snapshots, %u gave up on a busy writer, %u torn, %u went back\n", idx, reads, busy, torn, stale);
+    return torn || stale ? 1 : 0;
+}
+
+static void usage(const char * name)
+{
+    fprintf(stderr, "usage: %s [-r readers] [-t seconds] [-s name]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    const char * name = "/alarmStatusTorture";
+    int readers = 4;
+    int seconds = 5;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:t:s:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'r':
+                readers = atoi(optarg);
+                break;
+            case 't':
+                seconds = atoi(optarg);
+                break;
+            case 's':
+                name = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+    }
+    if (readers < 1 || readers > MAX_READERS || seconds < 1)
+    {
+        usage(argv[0]);
+        return -1;
+    }
+
+    StatusShm status;
+    if (!status.init(name, NULL))
+        return -1;
+
+    uint64_t endMs = Clock::ms() + (uint64_t)seconds * 1000;
+    pid_t pid[MAX_READERS];
+    for (int r=0; r < readers; r++)
+    {
+        fflush(stdout);
+        pid[r] = fork();
+        if (pid[r] == 0)
+        {
+            int rc = reader(r, name, endMs);
+            fflush(stdout);
+            _exit(rc);
+        }
+        if (pid[r] < 0)
+        {
+            fprintf(stderr, "fork failed\n");
+            readers = r;
+            break;
+        }
+    }
+
+    // writer, runs a little past the readers so none of them ends on a quiet segment
+    t_StatusData  d;
+    t_StatusZones z;
+    uint32_t n = 0;
+    while (Clock::ms() < endMs + 100)
+    {
+        n++;
+        fillWords(&d, sizeof(d), n);
+        status.write(&d);
+        if ((n & 63) == 0)
+        {
+            fillWords(&z, sizeof(z), n);
+            status.writeZones(&z);
+        }
+    }
+    printf("writer: %u snapshots\n", n);
+
+    int failed = 0;
+    for (int r=0; r < readers; r++)
+    {
+        int wstatus;
+        if (waitpid(pid[r], &wstatus, 0) != pid[r] || !WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0)
+            failed++;
+    }
+    status.fini();
+
+    printf("%s\n", failed ? "FAILED" : "ok");
+    return failed ? 1 : 0;
+}
+
+// end of alarmStatusTorture.cpp
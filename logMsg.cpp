@@ -21,82 +21,758 @@
 #include <dirent.h>
 #include <string.h>
 #include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <zlib.h>
 
 #include "logMsg.h"
+#include "LogRing.h"
+#include "Clock.h"
 
-// log file
-static FILE * logFile[MAX_DEBUG_LOGS];
+// log file.  Only used by the log writer thread once it is running
+static FILE * logFile = NULL;
 static const char * LOG_MSG_BASENAME = "/var/log/alarmLog";
 static const char * DEBUG_LOG_BASENAME = "/var/log/alarmLog.dbg";
 
-// ring buffer for queuing log messages
-static const int LOG_RING_SIZE = 1024;     // max number of messages to queue
+// alarmLog is rotated and compressed by the log writer thread to alarmLog.1.gz ... alarmLog.N.gz
+static const long     LOG_ROTATE_BYTES    = 1024 * 1024;        // rotate alarmLog when it reaches this size
+static const time_t   LOG_ROTATE_SECS     = 7 * 24 * 60 * 60;   // or has been open this long
+static const int      LOG_KEEP_COUNT      = 8;                  // number of compressed logs kept
+static const time_t   LOG_KEEP_SECS       = 90 * 24 * 60 * 60;  // remove compressed logs older than this
+static const uint32_t LOG_ROTATE_CHECK_MS = 60 * 1000;          // how often rotation is checked
+
+static time_t logOpenTime;             // time alarmLog was opened or last rotated
+
 static const int LOG_MSG_LEN = 256;       // max log message size
-static char ringBuf[LOG_RING_SIZE][LOG_MSG_LEN];
-static int ringIdx = 0;
+
+// all categories start at LOG_LVL_DEBUG (levels ERROR, INFO and DEBUG enabled, 0x7 per category)
+uint32_t logLevelMask = 0x7777;
+static const char * LOG_LVL_NAMES[LOG_LVL_COUNT] = { "error", "info", "debug", "trace" };
+static const char * LOG_CAT_NAMES[LOG_CAT_COUNT] = { "serial", "gpio", "alarm", "sock" };
+
+// LOG_DEBUG_N messages are appended to a user-space buffer per channel.  The log writer thread
+// writes the buffers to the (held open) debug log files, so the caller never does file I/O.
+
+static const int      DEBUG_BUF_SIZE     = 16384;  // size of each of the two buffers per channel
+static const int      DEBUG_FLUSH_SIZE   = 8192;   // write channel when this many bytes are buffered
+static const uint32_t DEBUG_FLUSH_MS     = 2000;   // or when the oldest buffered line is this old
+static const uint32_t DEBUG_LINES_PER_S  = 20;     // sustained lines/sec allowed per channel
+static const uint32_t DEBUG_LINE_BURST   = 100;    // lines allowed in a burst above the rate
+static const uint32_t LOG_WRITER_WAKE_MS = 100;    // log writer thread wake up interval
+
+struct t_DebugLog {
+    pthread_mutex_t lock;
+    int      fd;                        // debug log file, opened by the writer on first flush
+    char     buf[2][DEBUG_BUF_SIZE];    // callers fill buf[cur], writer writes the other one
+    int      cur;
+    int      len;                       // bytes in buf[cur]
+    uint64_t firstMs;                   // timestamp of oldest line in buf[cur]
+    uint32_t tokens;                    // rate limit tokens, 1000 per line
+    uint64_t refillMs;                  // timestamp of last token refill
+    uint32_t dropped;                   // lines dropped by rate limit or full buffer
+    uint32_t droppedReported;           // dropped count already noted in the log
+};
+
+static t_DebugLog debugLog[MAX_DEBUG_LOGS];  // entry 0 (LOG_DEFAULT) not used
+
+static pthread_t       writerThread;
+static pthread_mutex_t writerLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  writerCond = PTHREAD_COND_INITIALIZER;
+static bool            writerRunning = false;
+static bool            writerStop = false;
+static bool            flushRequested = false;  // flushMsgRing called, writer writes msgRing to alarmLog
+
+// LOG_DEFAULT messages are not formatted when logged.  The timestamp, format string pointer and
+// raw argument values are stored in a per-thread ring and only formatted when the ring is drained.
+// The log writer drains the thread rings every LOG_WRITER_WAKE_MS into msgRing, a ring of
+// formatted messages kept in a memory mapped file so it survives a crash or restart.
+
+static const char *   LOG_RING_FILE    = "/var/log/alarmLog.ring";
+static const uint32_t LOG_RING_BYTES   = 256 * 1024;  // size of msgRing data area
+static const uint32_t LOG_RING_SYNC_MS = 5000;        // write msgRing back to disk this often
+static const int      LOG_RING_MAX_MSGS = LOG_RING_BYTES / 24;  // 24 bytes is the smallest message record
+
+static LogRing         msgRing;
+static pthread_mutex_t drainLock = PTHREAD_MUTEX_INITIALIZER;  // held while draining into msgRing
+
+static const int LOG_RING_SIZE   = 1024;  // max number of messages to queue (per thread)
+static const int LOG_MAX_ARGS    = 8;     // max printf args stored per message
+static const int LOG_STR_DATA    = 160;   // bytes available for copies of %s args
+static const int LOG_MAX_THREADS = 8;     // max number of threads with a log ring
+
+// types of printf args stored in a log record
+enum {
+    LOG_ARG_INT = 0,
+    LOG_ARG_LONG,
+    LOG_ARG_LLONG,
+    LOG_ARG_DOUBLE,
+    LOG_ARG_STR,
+    LOG_ARG_PTR
+};
+
+union t_LogArg {
+    long long i;
+    double    d;
+    void    * p;
+    int       strOff;  // offset of copied string in t_LogRec.strData
+};
+
+struct t_LogRec {
+    uint32_t        seq;                      // ring index + 1 when record complete, 0 while written
+    struct timespec ts;                       // CLOCK_REALTIME when logged
+    const char    * fmt;                      // format string (must be a literal)
+    uint8_t         argCount;                 // number of args stored
+    uint8_t         argType[LOG_MAX_ARGS];    // LOG_ARG_* type of each arg
+    t_LogArg        arg[LOG_MAX_ARGS];        // raw arg values
+    char            strData[LOG_STR_DATA];    // copies of %s args
+};
+
+struct t_LogRing {
+    uint32_t  head;                           // number of records ever written (producer only)
+    uint32_t  tail;                           // number of records drained (consumer only)
+    t_LogRec  rec[LOG_RING_SIZE];
+};
+
+static t_LogRing * ringList[LOG_MAX_THREADS];        // rings of all logging threads
+static int ringCount = 0;
+static __thread t_LogRing * threadRing = NULL;       // ring owned by the calling thread
+
+// parsed printf conversion spec
+struct t_FmtSpec {
+    int  len;        // chars in spec, starting at '%'
+    int  stars;      // number of '*' width/precision args
+    int  argType;    // LOG_ARG_* type, -1 if spec takes no arg (%%)
+};
 
 bool openLogFile(void);
 void initRingBuf(void);
+static void initDebugLogs(void);
+static void flushDebugLog(t_DebugLog * dbg, bool force);
+static void * logWriter(void * notUsed);
+static void drainMsgRings(void);
+static void recoverMsgRing(void);
+static void writeMsgRing(void);
+static void checkLogRotation(void);
 
 bool initLogMsg(void)
 {
     initRingBuf();
-    for (int i=0; i < MAX_DEBUG_LOGS; i++)
-        logFile[i] = NULL;
-    return openLogFile();
+    initDebugLogs();
+
+    if (!msgRing.init(LOG_RING_FILE, LOG_RING_BYTES, false))
+    {
+        fprintf(stderr, "Failed to create log message ring\n");
+    }
+    if (!openLogFile())
+    {
+        return false;
+    }
+    recoverMsgRing();
+
+    writerStop = false;
+    flushRequested = false;
+    writerRunning = (pthread_create(&writerThread, NULL, logWriter, NULL) == 0);
+    if (!writerRunning)
+    {
+        fprintf(stderr, "Failed to start log writer thread\n");
+    }
+    return true;
 }
 
 void finiLogMsg(void)
 {
-    if (logFile[0] != NULL)
+    if (writerRunning)
+    {
+        pthread_mutex_lock(&writerLock);
+        writerStop = true;
+        pthread_cond_signal(&writerCond);
+        pthread_mutex_unlock(&writerLock);
+        pthread_join(writerThread, NULL);
+        writerRunning = false;
+    }
+    for (int i=1; i < MAX_DEBUG_LOGS; i++)
     {
-        fclose(logFile[0]);
-        logFile[0] = NULL;
+        flushDebugLog(&debugLog[i], true);
+        if (debugLog[i].fd >= 0)
+        {
+            close(debugLog[i].fd);
+            debugLog[i].fd = -1;
+        }
     }
+    if (logFile != NULL)
+    {
+        fclose(logFile);
+        logFile = NULL;
+    }
+    pthread_mutex_lock(&drainLock);
+    drainMsgRings();  // keep messages logged since the last drain for the next run
+    msgRing.sync();
+    msgRing.fini();
+    pthread_mutex_unlock(&drainLock);
+}
+
+static void initDebugLogs(void)
+{
+    uint64_t ms = Clock::ms();
+
+    for (int i=1; i < MAX_DEBUG_LOGS; i++)
+    {
+        t_DebugLog * dbg = &debugLog[i];
+        pthread_mutex_init(&dbg->lock, NULL);
+        dbg->fd = -1;
+        dbg->cur = 0;
+        dbg->len = 0;
+        dbg->firstMs = ms;
+        dbg->tokens = DEBUG_LINE_BURST * 1000;
+        dbg->refillMs = ms;
+        dbg->dropped = 0;
+        dbg->droppedReported = 0;
+    }
+}
+
+// take a rate limit token for one line.  Returns: false if channel is over its rate (caller holds lock)
+static bool takeDebugToken(t_DebugLog * dbg, uint64_t ms)
+{
+    uint64_t elapsed = ms - dbg->refillMs;
+
+    dbg->refillMs = ms;
+    if (elapsed >= DEBUG_LINE_BURST * 1000 / DEBUG_LINES_PER_S)  // long enough to refill the burst
+        dbg->tokens = DEBUG_LINE_BURST * 1000;
+    else if ((dbg->tokens += (uint32_t)elapsed * DEBUG_LINES_PER_S) > DEBUG_LINE_BURST * 1000)
+        dbg->tokens = DEBUG_LINE_BURST * 1000;
+
+    if (dbg->tokens < 1000)
+        return false;
+    dbg->tokens -= 1000;
+    return true;
+}
+
+// append a line to a debug channel buffer (caller holds lock).  Returns: false if buffer is full
+static bool appendDebugLog(t_DebugLog * dbg, const char * line, int len, uint64_t ms)
+{
+    if (len > DEBUG_BUF_SIZE - dbg->len)
+        return false;
+    if (dbg->len == 0)
+        dbg->firstMs = ms;
+    memcpy(dbg->buf[dbg->cur] + dbg->len, line, len);
+    dbg->len += len;
+    return true;
+}
+
+// format a debug message and queue it for the log writer
+static void queueDebugMsg(uint8_t logType, const char * fmt, va_list pArg)
+{
+    t_DebugLog * dbg = &debugLog[logType];
+    uint64_t ms = Clock::ms();
+
+    pthread_mutex_lock(&dbg->lock);
+    bool accept = takeDebugToken(dbg, ms);
+    if (!accept)
+        dbg->dropped++;
+    pthread_mutex_unlock(&dbg->lock);
+
+    if (!accept)
+        return;  // over the rate limit, don't bother formatting
+
+    char msg[LOG_MSG_LEN];
+    struct timespec spec;
+    struct tm tmTime;
+    clock_gettime(CLOCK_REALTIME, &spec);
+    localtime_r(&spec.tv_sec, &tmTime);
+
+    int i = sprintf(msg, "%02d:%02d:%02d.%03d ", tmTime.tm_hour, tmTime.tm_min, tmTime.tm_sec,
+        (int)(spec.tv_nsec / 1000000));
+    int len = i + vsnprintf(msg+i, LOG_MSG_LEN-i, fmt, pArg);
+    if (len > LOG_MSG_LEN-1)
+        len = LOG_MSG_LEN-1;
+
+    pthread_mutex_lock(&dbg->lock);
+    if (dbg->dropped != dbg->droppedReported)  // note lines lost since the last one written
+    {
+        char note[64];
+        int noteLen = snprintf(note, sizeof(note), "%.13s%u lines dropped\n", msg, 
+            dbg->dropped - dbg->droppedReported);
+        if (appendDebugLog(dbg, note, noteLen, ms))
+            dbg->droppedReported = dbg->dropped;
+    }
+    if (!appendDebugLog(dbg, msg, len, ms))
+        dbg->dropped++;
+    pthread_mutex_unlock(&dbg->lock);
+}
+
+// open the debug log file for a channel (append).  Returns: file descriptor, -1 on failure
+static int openDebugLog(t_DebugLog * dbg)
+{
+    char filename[64];
+    sprintf(filename, "%s%d", DEBUG_LOG_BASENAME, (int)(dbg - debugLog));
+    return open(filename, O_WRONLY | O_APPEND | O_CREAT, 0644);
+}
+
+// write all of buf to fd, retrying partial writes.  Returns: false on error
+static bool writeAll(int fd, const char * buf, int len)
+{
+    while (len > 0)
+    {
+        int n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+// write a debug channel buffer to its file if over the size or age threshold (or force is set)
+static void flushDebugLog(t_DebugLog * dbg, bool force)
+{
+    pthread_mutex_lock(&dbg->lock);
+    int len = dbg->len;
+    int idx = dbg->cur;
+    if (len == 0 || (!force && len < DEBUG_FLUSH_SIZE && Clock::ms() - dbg->firstMs < DEBUG_FLUSH_MS))
+    {
+        pthread_mutex_unlock(&dbg->lock);
+        return;
+    }
+    dbg->cur ^= 1;  // swap buffers, callers continue in the other one
+    dbg->len = 0;
+    pthread_mutex_unlock(&dbg->lock);
+
+    if (dbg->fd < 0)
+        dbg->fd = openDebugLog(dbg);
+    if (dbg->fd < 0 || !writeAll(dbg->fd, dbg->buf[idx], len))
+    {
+        fprintf(stderr, "Failed to write debug log %d\n", (int)(dbg - debugLog));
+    }
+}
+
+// write any buffered log data, for use in a fatal signal handler.  Messages still queued in the
+//   thread rings are formatted into msgRing and the ring file written back, best effort: formatting
+//   is not async-signal-safe, and if the log writer was draining when the signal hit the queued
+//   messages are left as they are.  The debug logs are written with async-signal-safe calls only
+void flushLogsOnSignal(void)
+{
+    if (pthread_mutex_trylock(&drainLock) == 0)
+    {
+        drainMsgRings();
+        msgRing.sync(true);
+        pthread_mutex_unlock(&drainLock);
+    }
+    else
+    {
+        msgRing.sync(true);  // messages drained so far
+    }
+
+    for (int i=1; i < MAX_DEBUG_LOGS; i++)
+    {
+        t_DebugLog * dbg = &debugLog[i];
+        if (dbg->len > 0 && dbg->len <= DEBUG_BUF_SIZE)
+        {
+            int fd = dbg->fd >= 0 ? dbg->fd : openDebugLog(dbg);
+            if (fd >= 0)
+                writeAll(fd, dbg->buf[dbg->cur], dbg->len);
+        }
+    }
+}
+
+// log writer thread.  Moves buffered log data to disk off the main thread
+static void * logWriter(void * notUsed)
+{
+    uint64_t syncMs = Clock::ms();
+    uint64_t rotateMs = syncMs;
+
+    checkLogRotation();  // finish any rotation interrupted by the last shutdown
+
+    pthread_mutex_lock(&writerLock);
+    while (!writerStop)
+    {
+        struct timespec wake;
+        clock_gettime(CLOCK_REALTIME, &wake);
+        wake.tv_nsec += LOG_WRITER_WAKE_MS * 1000000;
+        if (wake.tv_nsec >= 1000000000)
+        {
+            wake.tv_sec += 1;
+            wake.tv_nsec -= 1000000000;
+        }
+        if (!flushRequested)
+            pthread_cond_timedwait(&writerCond, &writerLock, &wake);
+        bool flush = flushRequested;
+        flushRequested = false;
+        pthread_mutex_unlock(&writerLock);
+
+        for (int i=1; i < MAX_DEBUG_LOGS; i++)
+            flushDebugLog(&debugLog[i], false);
+
+        pthread_mutex_lock(&drainLock);
+        drainMsgRings();
+        if (Clock::ms() - syncMs >= LOG_RING_SYNC_MS)
+        {
+            msgRing.sync();
+            syncMs = Clock::ms();
+        }
+        pthread_mutex_unlock(&drainLock);
+
+        if (flush)
+        {
+            writeMsgRing();
+        }
+        if (Clock::ms() - rotateMs >= LOG_ROTATE_CHECK_MS)
+        {
+            checkLogRotation();
+            rotateMs = Clock::ms();
+        }
+
+        pthread_mutex_lock(&writerLock);
+    }
+    pthread_mutex_unlock(&writerLock);
+    return NULL;
 }
 
 /// openLogFile. Returns: true on success
 bool openLogFile(void)
 {
-    // keep the last 3 alarm logs
+    logFile = fopen(LOG_MSG_BASENAME, "a");
+    if (logFile == NULL)
+    {
+        fprintf(stderr, "Failed to open logMsg file\n");
+        return false;
+    }
+    logOpenTime = time(NULL);
+    return true;
+}
+
+// gzip src to src.gz and remove src.  Returns: true on success
+static bool compressLog(const char * src)
+{
+    char dst[128], tmp[136];
+    char buf[16384];
+    bool success = true;
+
+    snprintf(dst, sizeof(dst), "%s.gz", src);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", dst);
+
+    FILE * in = fopen(src, "r");
+    if (in == NULL)
+        return false;
+    gzFile out = gzopen(tmp, "wb");
+    if (out == NULL)
+    {
+        fclose(in);
+        return false;
+    }
+
+    size_t len;
+    while (success && (len = fread(buf, 1, sizeof(buf), in)) > 0)
+    {
+        success = (gzwrite(out, buf, len) == (int)len);
+    }
+    fclose(in);
+    success = (gzclose(out) == Z_OK) && success;
+
+    if (success && rename(tmp, dst) == 0)  // only replace src once the .gz is complete
+    {
+        remove(src);
+        return true;
+    }
+    fprintf(stderr, "Failed to compress %s\n", src);
+    remove(tmp);
+    return false;
+}
+
+// shift compressed logs up one (.N.gz to .N+1.gz), removing those beyond LOG_KEEP_COUNT or LOG_KEEP_SECS
+static void shiftOldLogs(void)
+{
     char name1[128], name2[128];
+    time_t now = time(NULL);
 
-    sprintf(name1, "%s.3", LOG_MSG_BASENAME);
-    if (access(name1, F_OK) == 0)  // log.3 exists, remove it
+    for (int i=LOG_KEEP_COUNT; i > 0; i--)
     {
-        remove(name1);
+        struct stat st;
+        sprintf(name1, "%s.%d.gz", LOG_MSG_BASENAME, i);
+        if (stat(name1, &st) != 0)
+            continue;
+
+        if (i == LOG_KEEP_COUNT || now - st.st_mtime > LOG_KEEP_SECS)
+        {
+            remove(name1);
+        }
+        else
+        {
+            sprintf(name2, "%s.%d.gz", LOG_MSG_BASENAME, i+1);
+            if (rename(name1, name2) != 0)
+            {
+                fprintf(stderr, "Failed to rename %s to %s\n", name1, name2);
+            }
+        }
+    }
+}
+
+// rotate alarmLog if it is over size or age, then compress it.  Runs on the log writer thread
+static void checkLogRotation(void)
+{
+    char name[128];
+    struct stat st;
+
+    sprintf(name, "%s.1", LOG_MSG_BASENAME);
+    if (access(name, F_OK) == 0)  // uncompressed log.1 left by an interrupted rotation
+    {
+        shiftOldLogs();
+        compressLog(name);
     }
-    sprintf(name2, "%s.2", LOG_MSG_BASENAME);
-    if (access(name2, F_OK) == 0)  // log.2 exists, rename it to log.3
+
+    if (logFile == NULL || fstat(fileno(logFile), &st) != 0)
+        return;
+    if (st.st_size < LOG_ROTATE_BYTES && time(NULL) - logOpenTime < LOG_ROTATE_SECS)
+        return;
+    if (st.st_size == 0)
+        return;  // nothing to rotate
+
+    fclose(logFile);
+    logFile = NULL;
+    if (rename(LOG_MSG_BASENAME, name) != 0)
     {
-        if (rename(name2, name1) != 0)
+        fprintf(stderr, "Failed to rename %s to %s\n", LOG_MSG_BASENAME, name);
+    }
+    openLogFile();
+
+    shiftOldLogs();
+    compressLog(name);
+}
+
+// parse the printf conversion spec at fmt (which points at a '%').  Returns: false if not supported
+static bool parseFmtSpec(const char * fmt, t_FmtSpec * spec)
+{
+    const char * p = fmt + 1;
+    int longs = 0;
+
+    spec->stars = 0;
+    spec->argType = -1;
+
+    while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0')  // flags
+        p++;
+    if (*p == '*')
+    {
+        spec->stars++;
+        p++;
+    }
+    while (*p >= '0' && *p <= '9')  // width
+        p++;
+    if (*p == '.')                  // precision
+    {
+        p++;
+        if (*p == '*')
         {
-            fprintf(stderr, "Failed to rename %s to %s\n", name2, name1);
+            spec->stars++;
+            p++;
         }
+        while (*p >= '0' && *p <= '9')
+            p++;
+    }
+    while (*p == 'h' || *p == 'l' || *p == 'z' || *p == 'j' || *p == 't' || *p == 'L')  // length
+    {
+        if (*p == 'l' || *p == 'z' || *p == 'j' || *p == 't')
+            longs += (*p == 'l') ? 1 : 2;
+        p++;
+    }
+
+    switch (*p)
+    {
+        case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+            spec->argType = longs >= 2 ? LOG_ARG_LLONG : longs == 1 ? LOG_ARG_LONG : LOG_ARG_INT;
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            spec->argType = LOG_ARG_DOUBLE;
+            break;
+        case 's':
+            spec->argType = LOG_ARG_STR;
+            break;
+        case 'p':
+            spec->argType = LOG_ARG_PTR;
+            break;
+        case '%':
+            break;
+        default:   // %n, or a malformed spec
+            return false;
+    }
+    spec->len = p + 1 - fmt;
+    return true;
+}
+
+// get the ring for the calling thread, creating it on first use.  Returns: NULL if none available
+static t_LogRing * getThreadRing(void)
+{
+    if (threadRing == NULL)
+    {
+        int idx = __atomic_fetch_add(&ringCount, 1, __ATOMIC_RELAXED);
+        if (idx >= LOG_MAX_THREADS)
+            return NULL;
+
+        t_LogRing * ring = (t_LogRing *)calloc(1, sizeof(t_LogRing));
+        if (ring == NULL)
+            return NULL;
+        __atomic_store_n(&ringList[idx], ring, __ATOMIC_RELEASE);
+        threadRing = ring;
     }
-    sprintf(name1, "%s.1", LOG_MSG_BASENAME);
-    if (access(name1, F_OK) == 0)  // log.1 exists, rename it to log.2
+    return threadRing;
+}
+
+// number of entries used in ringList
+static int activeRings(void)
+{
+    int count = __atomic_load_n(&ringCount, __ATOMIC_ACQUIRE);
+    return count < LOG_MAX_THREADS ? count : LOG_MAX_THREADS;
+}
+
+// store raw log message args in the calling thread's ring.  Formatting happens in flushMsgRing
+static void queueMsg(const char * fmt, va_list pArg)
+{
+    t_LogRing * ring = getThreadRing();
+    if (ring == NULL)
+        return;
+
+    uint32_t idx = ring->head;
+    t_LogRec * rec = &ring->rec[idx % LOG_RING_SIZE];
+
+    __atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);  // mark record as being written
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    clock_gettime(CLOCK_REALTIME, &rec->ts);
+    rec->fmt = fmt;
+
+    int n = 0;
+    int strLen = 0;
+    t_FmtSpec spec;
+
+    for (const char * p = fmt; *p != '\0'; p++)
     {
-        if (rename(name1, name2) != 0)
+        if (*p != '%')
+            continue;
+        if (!parseFmtSpec(p, &spec))
+            break;
+        for (int s=0; s < spec.stars && n < LOG_MAX_ARGS; s++)
         {
-            fprintf(stderr, "Failed to rename %s to %s\n", name1, name2);
+            rec->argType[n] = LOG_ARG_INT;
+            rec->arg[n++].i = va_arg(pArg, int);
         }
+        if (spec.argType >= 0 && n < LOG_MAX_ARGS)
+        {
+            rec->argType[n] = spec.argType;
+            switch (spec.argType)
+            {
+                case LOG_ARG_INT:    rec->arg[n].i = va_arg(pArg, int);       break;
+                case LOG_ARG_LONG:   rec->arg[n].i = va_arg(pArg, long);      break;
+                case LOG_ARG_LLONG:  rec->arg[n].i = va_arg(pArg, long long); break;
+                case LOG_ARG_DOUBLE: rec->arg[n].d = va_arg(pArg, double);    break;
+                case LOG_ARG_PTR:    rec->arg[n].p = va_arg(pArg, void *);    break;
+                case LOG_ARG_STR:
+                {
+                    // copy string, the caller's buffer may be gone by the time the ring is drained
+                    const char * str = va_arg(pArg, const char *);
+                    int len = strnlen(str ? str : "(null)", LOG_STR_DATA - 1 - strLen);
+                    memcpy(rec->strData + strLen, str ? str : "(null)", len);
+                    rec->strData[strLen + len] = '\0';
+                    rec->arg[n].strOff = strLen;
+                    strLen += (strLen + len + 1 < LOG_STR_DATA) ? len + 1 : len;
+                    break;
+                }
+            }
+            n++;
+        }
+        p += spec.len - 1;
     }
-    if (access(LOG_MSG_BASENAME, F_OK) == 0)  // log exists, rename it to log.1
+    rec->argCount = n;
+
+    __atomic_store_n(&rec->seq, idx + 1, __ATOMIC_RELEASE);  // record complete
+    __atomic_store_n(&ring->head, idx + 1, __ATOMIC_RELEASE);
+}
+
+// format a queued log record into buf (max LOG_MSG_LEN).  Returns: length of formatted text
+static int formatRec(const t_LogRec * rec, char * buf)
+{
+    struct tm tmTime;
+    localtime_r(&rec->ts.tv_sec, &tmTime);
+
+    int i = snprintf(buf, LOG_MSG_LEN, "%02d:%02d:%02d.%03d ", tmTime.tm_hour, tmTime.tm_min, tmTime.tm_sec,
+        (int)(rec->ts.tv_nsec / 1000000));
+
+    const char * p = rec->fmt;
+    int n = 0;
+    t_FmtSpec spec;
+
+    while (*p != '\0' && i < LOG_MSG_LEN-1)
     {
-        if (rename(LOG_MSG_BASENAME, name1) != 0)
+        if (*p != '%')
         {
-            fprintf(stderr, "Failed to rename %s to %s\n", LOG_MSG_BASENAME, name1);
+            buf[i++] = *p++;
+            continue;
         }
+        if (!parseFmtSpec(p, &spec) || n + spec.stars + (spec.argType >= 0) > rec->argCount)
+        {
+            i += snprintf(buf + i, LOG_MSG_LEN - i, "%s", p);  // out of args, print rest of fmt as is
+            break;
+        }
+
+        // copy the spec, replacing '*' with the stored width/precision values
+        char specBuf[48];
+        int  s = 0;
+        for (int j=0; j < spec.len && s < (int)sizeof(specBuf) - 12; j++)
+        {
+            if (p[j] == '*')
+                s += sprintf(specBuf + s, "%d", (int)rec->arg[n++].i);
+            else
+                specBuf[s++] = p[j];
+        }
+        specBuf[s] = '\0';
+
+        int len;
+        if (spec.argType < 0)
+            len = snprintf(buf + i, LOG_MSG_LEN - i, "%%");
+        else
+        {
+            const t_LogArg & arg = rec->arg[n++];
+            switch (spec.argType)
+            {
+                case LOG_ARG_INT:    len = snprintf(buf + i, LOG_MSG_LEN - i, specBuf, (int)arg.i);  break;
+                case LOG_ARG_LONG:   len = snprintf(buf + i, LOG_MSG_LEN - i, specBuf, (long)arg.i); break;
+                case LOG_ARG_LLONG:  len = snprintf(buf + i, LOG_MSG_LEN - i, specBuf, arg.i);       break;
+                case LOG_ARG_DOUBLE: len = snprintf(buf + i, LOG_MSG_LEN - i, specBuf, arg.d);       break;
+                case LOG_ARG_PTR:    len = snprintf(buf + i, LOG_MSG_LEN - i, specBuf, arg.p);       break;
+                default:             len = snprintf(buf + i, LOG_MSG_LEN - i, specBuf, rec->strData + arg.strOff);
+            }
+        }
+        if (len > 0)
+            i += len;
+        p += spec.len;
     }
+    if (i > LOG_MSG_LEN-1)
+        i = LOG_MSG_LEN-1;
+    buf[i] = '\0';
+    return i;
+}
+
+// copy the next complete record from ring into rec.  Returns: false if ring has no more records
+static bool nextRec(t_LogRing * ring, t_LogRec * rec)
+{
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    if (head - ring->tail > (uint32_t)LOG_RING_SIZE)  // oldest records were overwritten before drain
+        ring->tail = head - LOG_RING_SIZE;
 
-    logFile[0] = fopen(LOG_MSG_BASENAME, "w");
-    if (logFile[0] == NULL)
+    while (ring->tail != head)
     {
-        fprintf(stderr, "Failed to open logMsg file\n");
-        return false;
+        uint32_t idx = ring->tail++;
+        const t_LogRec * src = &ring->rec[idx % LOG_RING_SIZE];
+
+        if (__atomic_load_n(&src->seq, __ATOMIC_ACQUIRE) != idx + 1)
+            continue;  // record is being re-written by the producer, skip it
+        memcpy(rec, src, sizeof(t_LogRec));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&src->seq, __ATOMIC_RELAXED) == idx + 1)
+            return true;
     }
-    return true;
+    return false;
 }
 
 // log messages to ring buffer and possibly file
@@ -107,86 +783,199 @@ void logMsg(uint8_t logType, const char *fmt, ...) // vararg format
         return;
     }
 
-    static char msg[LOG_MSG_LEN];
-    msg[0] = '\0';
-
-    struct timespec spec;
-    clock_gettime(CLOCK_REALTIME, &spec);
-    struct tm * pTime = localtime(&spec.tv_sec);
-
-    int i = sprintf(msg, "%02d:%02d:%02d.%03d ", pTime->tm_hour, pTime->tm_min, pTime->tm_sec,
-        (int)(spec.tv_nsec / 1000000));
-
     va_list pArg;
     va_start(pArg, fmt);
 
-    int size = i + vsnprintf(msg+i, LOG_MSG_LEN-i-1, fmt, pArg);
-    if (size > LOG_MSG_LEN-1)
+    if (logType == LOG_DEFAULT)  // add msg to ring buffer, formatted later
+    {
+        queueMsg(fmt, pArg);
+    }
+    else if (logType < MAX_DEBUG_LOGS)  // buffer msg for debug log N
     {
-        size = LOG_MSG_LEN-1;
+        queueDebugMsg(logType, fmt, pArg);
     }
     va_end(pArg);
+}
+
+// set runtime level of category cat (-1 for all categories)
+void setLogLevel(int cat, int level)
+{
+    uint32_t bits = (1 << (level + 1)) - 1;  // level and all more severe levels
+    uint32_t mask = __atomic_load_n(&logLevelMask, __ATOMIC_RELAXED);
 
-    if (size <= 0)
+    for (int c=0; c < LOG_CAT_COUNT; c++)
     {
-        return;  // vsnprintf failed, there is no output
+        if (cat < 0 || c == cat)
+        {
+            mask &= ~(((1 << LOG_LVL_COUNT) - 1) << (c * LOG_LVL_COUNT));
+            mask |= bits << (c * LOG_LVL_COUNT);
+        }
     }
-    msg[size] = '\0';  // make sure string is terminated properly
+    __atomic_store_n(&logLevelMask, mask, __ATOMIC_RELAXED);
+}
+
+// returns level index of name, -1 if not a level name
+static int logLevelIndex(const char * name, int len)
+{
+    for (int i=0; i < LOG_LVL_COUNT; i++)
+    {
+        if ((int)strlen(LOG_LVL_NAMES[i]) == len && strncasecmp(name, LOG_LVL_NAMES[i], len) == 0)
+            return i;
+    }
+    return -1;
+}
+
+// set runtime levels from a spec like "info" or "info,serial=trace,gpio=debug".  Returns: true if spec valid
+bool setLogLevels(const char * spec)
+{
+    const char * p = spec;
+    bool valid = true;
 
-    if (logType > 0)
+    while (*p != '\0')
     {
-        if (logType < MAX_DEBUG_LOGS)
+        int len = strcspn(p, ",");
+        const char * eq = (const char *)memchr(p, '=', len);
+        int cat = -1;
+        int level;
+
+        if (eq != NULL)  // category=level
         {
-            char filename[64];
-            sprintf(filename, "%s%d", DEBUG_LOG_BASENAME, logType);
-            if ((logFile[logType] = fopen(filename, "a")) != NULL)
+            cat = LOG_CAT_COUNT;
+            for (int i=0; i < LOG_CAT_COUNT; i++)
             {
-                // append message to debug log N
-                fprintf(logFile[logType], "%s", msg);
-                fclose(logFile[logType]);
-                logFile[logType] = NULL;
+                if ((int)strlen(LOG_CAT_NAMES[i]) == eq - p && strncasecmp(p, LOG_CAT_NAMES[i], eq - p) == 0)
+                    cat = i;
             }
+            level = logLevelIndex(eq + 1, len - (eq + 1 - p));
         }
+        else
+        {
+            level = logLevelIndex(p, len);
+        }
+
+        if (level < 0 || cat == LOG_CAT_COUNT)
+        {
+            fprintf(stderr, "Invalid log level '%.*s'\n", len, p);
+            valid = false;
+        }
+        else
+        {
+            setLogLevel(cat, level);
+        }
+        p += (p[len] == ',') ? len + 1 : len;
     }
-    else // otherwise, add msg to ring buffer
-    {
-        strcpy(ringBuf[ringIdx], msg);
-        ringIdx = (ringIdx + 1) % LOG_RING_SIZE;
-    }
+    return valid;
 }
 
 void initRingBuf(void)
 {
-    ringIdx = 0;
-    for (int i=0; i < LOG_RING_SIZE; i++)
+    int count = activeRings();
+    for (int i=0; i < count; i++)
     {
-        memset(ringBuf[i], 0, LOG_MSG_LEN);
+        t_LogRing * ring = __atomic_load_n(&ringList[i], __ATOMIC_ACQUIRE);
+        if (ring != NULL)
+            ring->tail = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);  // discard queued msgs
     }
 }
 
-// flush messages in ring buffer to log file
-void flushMsgRing(void)
+// format the queued messages of all threads into msgRing, oldest first (caller holds drainLock)
+static void drainMsgRings(void)
 {
-    if (logFile[0] == NULL)
+    static t_LogRec next[LOG_MAX_THREADS];  // next undrained record of each ring
+    bool  valid[LOG_MAX_THREADS];
+    char  msg[LOG_MSG_LEN];
+    int   rings = activeRings();
+
+    for (int i=0; i < rings; i++)
     {
-        fprintf(stderr, "flushMsgRing called with NULL logFile\n");
-        return;
+        t_LogRing * ring = __atomic_load_n(&ringList[i], __ATOMIC_ACQUIRE);
+        valid[i] = ring != NULL && nextRec(ring, &next[i]);
+    }
+
+    // merge the thread rings, oldest message first
+    while (true)
+    {
+        int oldest = -1;
+        for (int i=0; i < rings; i++)
+        {
+            if (valid[i] && (oldest < 0 || next[i].ts.tv_sec < next[oldest].ts.tv_sec ||
+                (next[i].ts.tv_sec == next[oldest].ts.tv_sec && next[i].ts.tv_nsec < next[oldest].ts.tv_nsec)))
+            {
+                oldest = i;
+            }
+        }
+        if (oldest < 0)
+            break;
+
+        msgRing.append(msg, formatRec(&next[oldest], msg));
+        valid[oldest] = nextRec(ringList[oldest], &next[oldest]);
     }
+}
 
-    int count = 0;
+// write one msgRing record to the log file
+static void writeRingMsg(const char * text, int len, void * ctx)
+{
+    fwrite(text, 1, len, (FILE *)ctx);
+}
 
-    // oldest message in ring is at ringIdx, so start there
-    for (int i=0; i < LOG_RING_SIZE; i++)
+// write messages left in msgRing by the previous run (crash or restart) to the log file
+static void recoverMsgRing(void)
+{
+    pthread_mutex_lock(&drainLock);
+    if (msgRing.getWritePos() != msgRing.getFlushPos())
     {
-        if (ringBuf[ringIdx] != '\0')
+        fprintf(logFile, "---- messages recovered from previous run (generation %u) ----\n", 
+            msgRing.getGeneration());
+        int count = msgRing.readRecords(msgRing.getFlushPos(), LOG_RING_MAX_MSGS, writeRingMsg, logFile);
+        if (count < 0)
         {
-            fprintf(logFile[0], "%s", ringBuf[ringIdx]);  // print each msg in ring
-            memset(ringBuf[ringIdx], 0, LOG_MSG_LEN);  // clear ring buf
-            count++;
+            fprintf(logFile, "---- no memory to recover messages, see alarmRingDump ----\n");
+            fprintf(stderr, "Failed to recover messages from previous run\n");
         }
-        ringIdx = (ringIdx + 1) % LOG_RING_SIZE;
+        else
+        {
+            fprintf(logFile, "---- end of %d recovered messages ----\n", count);
+            fprintf(stderr, "Recovered %d messages from previous run\n", count);
+        }
+        fflush(logFile);
     }
-    fprintf(stderr, "Sent %d messages to alarmLog\n", count);
-    fflush(logFile[0]);
+    msgRing.newGeneration();
+    pthread_mutex_unlock(&drainLock);
 }
 
+// write messages in msgRing not yet flushed to the log file.  Runs on the log writer thread
+static void writeMsgRing(void)
+{
+    if (logFile == NULL)
+    {
+        fprintf(stderr, "flushMsgRing called with NULL logFile\n");
+        return;
+    }
+
+    pthread_mutex_lock(&drainLock);
+    drainMsgRings();
+    int count = msgRing.readRecords(msgRing.getFlushPos(), LOG_RING_MAX_MSGS, writeRingMsg, logFile);
+    if (count >= 0)
+        msgRing.setFlushed();  // otherwise keep them for the next flush
+    pthread_mutex_unlock(&drainLock);
+
+    if (count < 0)
+        fprintf(stderr, "Failed to send messages to alarmLog, no memory\n");
+    else
+        fprintf(stderr, "Sent %d messages to alarmLog\n", count);
+    fflush(logFile);
+}
+
+// flush messages in ring buffer to log file.  The log writer thread does the file I/O
+void flushMsgRing(void)
+{
+    if (!writerRunning)
+    {
+        writeMsgRing();
+        return;
+    }
+    pthread_mutex_lock(&writerLock);
+    flushRequested = true;
+    pthread_cond_signal(&writerCond);
+    pthread_mutex_unlock(&writerLock);
+}
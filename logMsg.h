@@ -23,15 +23,59 @@
 
 enum t_eLogMsgType
 {
-    LOG_DEFAULT,  // log to default (ring buffer)
-    LOG_DEBUG_1,  // immediately write to dbg1 file
-    LOG_DEBUG_2,  // immediately write to dbg2 file
-    LOG_DEBUG_3   // immediately write to dbg3 file
+    LOG_DEFAULT,  // log to default (ring buffer, formatted when flushed)
+    LOG_DEBUG_1,  // buffered write to dbg1 file (rate limited)
+    LOG_DEBUG_2,  // buffered write to dbg2 file (rate limited)
+    LOG_DEBUG_3   // buffered write to dbg3 file (rate limited)
 };
 
+// message levels, a category logs levels up to and including its runtime level
+enum t_eLogLevel
+{
+    LOG_LVL_ERROR,
+    LOG_LVL_INFO,
+    LOG_LVL_DEBUG,
+    LOG_LVL_TRACE,
+    LOG_LVL_COUNT
+};
+
+// message categories (subsystems), each has its own runtime level
+enum t_eLogCategory
+{
+    LOG_CAT_SERIAL,  // keypad serial link
+    LOG_CAT_GPIO,    // sense loops and outputs
+    LOG_CAT_ALARM,   // alarm state, arming, alerts
+    LOG_CAT_SOCK,    // web app socket
+    LOG_CAT_COUNT
+};
+
+// messages above this level are compiled out, arguments are not evaluated (set with -D in Makefile)
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LVL_DEBUG
+#endif
+
+// runtime level mask, bit (category * LOG_LVL_COUNT + level) is set if the level is enabled
+extern uint32_t logLevelMask;
+
+#define LOG_ENABLED(cat, lvl) ((lvl) <= LOG_COMPILE_LEVEL && \
+    ((__atomic_load_n(&logLevelMask, __ATOMIC_RELAXED) >> ((cat) * LOG_LVL_COUNT + (lvl))) & 0x1))
+
+// log to logType if level lvl of category cat is enabled
+#define LOG_MSG(cat, lvl, logType, ...) \
+    do { if (LOG_ENABLED(cat, lvl)) logMsg(logType, __VA_ARGS__); } while (0)
+
+#define ERR_MSG(cat, ...)    LOG_MSG(cat, LOG_LVL_ERROR, LOG_DEFAULT, __VA_ARGS__)
+#define INFO_MSG(cat, ...)   LOG_MSG(cat, LOG_LVL_INFO,  LOG_DEFAULT, __VA_ARGS__)
+#define DEBUG_MSG(cat, ...)  LOG_MSG(cat, LOG_LVL_DEBUG, LOG_DEFAULT, __VA_ARGS__)
+#define TRACE_MSG(cat, ...)  LOG_MSG(cat, LOG_LVL_TRACE, LOG_DEFAULT, __VA_ARGS__)
+
 bool initLogMsg(void);
 void finiLogMsg(void);
-void logMsg(uint8_t logType, const char *fmt, ...);
+// LOG_DEFAULT messages are stored unformatted, fmt must be a string literal
+void logMsg(uint8_t logType, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
 void flushMsgRing(void);
+void flushLogsOnSignal(void);
+void setLogLevel(int cat, int level);
+bool setLogLevels(const char * spec);
 
 // end of logMsg.h
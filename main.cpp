@@ -24,13 +24,32 @@
 #include "AlarmManager.h"  // alarm manager class definition
 #include "Serial.h"        // serial manager class definition
 #include "SockClient.h"    // socket manager class definition
+#include "SockServer.h"    // socket server class definition
+#include "HttpServer.h"    // http status server class definition
+#include "CtlServer.h"     // local control socket class definition
+#include "StatusShm.h"     // shared memory status class definition
+#include "ConfigWatch.h"   // config file change watcher
+#include "SenseLoops.h"    // sense loop sampling
+#include "EventJournal.h"  // binary event journal
+#include "InputTrace.h"    // input trace for alarmReplay
+#include "ArmStore.h"      // armed state saved for a restart
+#include "Clock.h"         // monotonic clock of all timeouts
+#include "Stats.h"
 #include "logMsg.h"
 
-static volatile uint8_t done = 0;  // flag used to shut down main while loop
+t_AlarmStats alarmStats;           // health counters, reported by http /metrics
+InputTrace   inputTrace;           // inputs of the alarm core, replayed by alarmReplay
+
+static volatile uint8_t done = 0;    // flag used to shut down main while loop
+static volatile uint8_t reload = 0;  // flag used to reload the config file
 
 #define MIL_TO_12HR(x)  ((x) % 12 == 0 ? 12 : (x) % 12)
 
 void handleVoltMsg(AlarmManager * pAlarmManager, const char * msg, int msgLen);
+void setupGpio(Config * pConfig);
+void setAll(uint8_t * flags, int count);
+bool reloadConfig(Config ** ppConfig, Config ** ppSpare, AlarmManager * part, int partCount, SenseLoops * pLoops,
+    HttpServer * pHttp, CtlServer * pCtl, StatusShm * pStatus);
 
 // interrupt handler to capture kill/interrupt signal
 void intHandler(int notUsed)
@@ -38,20 +57,49 @@ void intHandler(int notUsed)
     done = 1;  // shut down main loop
 }
 
+// hangup handler, reload the config file
+void hupHandler(int notUsed)
+{
+    reload = 1;
+}
+
+// fatal signal handler, save queued log messages and buffered debug logs then let the signal kill the process
+void fatalHandler(int sig)
+{
+    flushLogsOnSignal();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
 // main 
 int main(int argc, char *argv[])
 {
     Config config;             // reads pin/loop definitions from config file
-    AlarmManager alarmManager; // handles alarm functions
+    Config spare;              // config being loaded on a reload, swapped with the current config
+    Config * pConfig = &config;
+    Config * pSpare  = &spare;
+    SenseLoops loops;          // samples the sense loops for all partitions
+    EventJournal journal;      // binary journal of zone/arming events, shared by partitions
+    ArmStore     armStore;     // armed state of the partitions, resumed after a restart
     Serial serial;             // handles serial communication
     SockClient sock;           // handles socket communication with web app
+    SockServer server;         // accepts virtual keypad / monitor clients
+    HttpServer http;           // serves status, metrics and key commands over http
+    CtlServer  ctl;            // local binary control socket for automation
+    StatusShm  status;         // publishes status in shared memory for local monitors
+    ConfigWatch watch;         // reloads the config file when it is edited
     initLogMsg();              // init logging utility
 
-    if (!config.readFile(ALARM_CONFIG_FILE))
+    if (!config.readFile(ALARM_CONFIG_FILE) || !config.validate())
     {
         fprintf(stderr, "Failed to read config file\n");
         return -1;
     }
+    setLogLevels(config.getLogLevel());
+
+    int partCount = config.getPartitionCount();
+    AlarmManager * part = new AlarmManager[partCount];  // handles alarm functions, one per partition
+    AlarmManager & alarmManager = part[0];              // alerts and voltages use the first partition
 
     if (!serial.init(config.getSerial(), config.getBaudRate()))
     {
@@ -76,43 +124,73 @@ int main(int argc, char *argv[])
         }
     }
 
-    if (!sock.init())
+    if (config.getSockServer()[0] != '\0' && !sock.init(config.getSockServer()))
     {
-        logMsg(LOG_DEFAULT, "Failed to open socket\n");
+        ERR_MSG(LOG_CAT_SOCK, "Failed to open socket\n");
+    }
+    if (config.getSockListen()[0] != '\0' && !server.init(config.getSockListen()))
+    {
+        fprintf(stderr, "Failed to start socket server on %s\n", config.getSockListen());
+    }
+    if (config.getHttpListen()[0] != '\0' && !http.init(config.getHttpListen(), config.getHttpToken(), &config))
+    {
+        fprintf(stderr, "Failed to start http server on %s\n", config.getHttpListen());
+    }
+    if (config.getCtlSocket()[0] != '\0' && !ctl.init(config.getCtlSocket(), config.getCtlUids(), &config))
+    {
+        fprintf(stderr, "Failed to open control socket %s\n", config.getCtlSocket());
     }
 
-    Loop * pLoop = config.getLoop();   // get pointer to array of sense loops
-
-    wiringPiSetupGpio(); // Initialize wiringPi - Broadcom pin numbering (MUST BE RUN AS ROOT)
-
-    for (int i=0; i < config.getLoopCount(); i++)  // configure pin io for sense loops
+    if (!status.init(STATUS_SHM_NAME, &config))
     {
-        pinMode((pLoop+i)->gpio, INPUT);           // enable as input
-        pullUpDnControl((pLoop+i)->gpio, PUD_UP);  // enable pull-up resistor on input
+        fprintf(stderr, "Failed to create status shared memory\n");
     }
-    for (int i=0; i < config.getOutputCount(); i++) // config pin out for outputs
+
+    if (!watch.init(ALARM_CONFIG_FILE))
     {
-        int pin = (config.getOutputs()+i)->gpio;
-        pinMode(pin, OUTPUT);  // set as output
+        fprintf(stderr, "Config file changes will need a SIGHUP to take effect\n");
     }
 
-    alarmManager.init(&config); // init AlarmManager class (pass in pointer to config class)
+    wiringPiSetupGpio(); // Initialize wiringPi - Broadcom pin numbering (MUST BE RUN AS ROOT)
+    setupGpio(&config);
+
+    journal.init(JOURNAL_FILE, JOURNAL_INDEX_FILE);
+    journal.logEvent(EVENT_START, JOURNAL_NONE, JOURNAL_NONE, DISARMED);
+    if (config.getTracePath()[0] != '\0')
+        inputTrace.init(config.getTracePath(), ALARM_CONFIG_FILE);  // before the partitions start, replay starts them the same
+    loops.init(&config);
+    if (!armStore.init(ARM_STORE_FILE))
+    {
+        fprintf(stderr, "Armed state will not survive a restart\n");
+    }
+    for (int p=0; p < partCount; p++)
+        part[p].init(&config, p, &journal, &armStore);  // init AlarmManager class, resumes the state saved by the last run
 
     // check for data from serial port each time around.  Build up messages
     //   in buffer until a complete message is received, then process mesg
 
-    uint32_t prevLoopMask = 0xFF;   // force an update on first pass
     char     readBuf[READ_BUF_SIZE];
     int      readBufIdx = 0;
-    uint8_t  sendF7msgNow = true;   // send F7 mesg at the next available time slot
+    uint8_t * sendF7msgNow = new uint8_t[partCount];  // per partition, send F7 mesg at the next available time slot
+    uint64_t lastF7 = alarmManager.getLastMsgTime();  // F7 mesgs of all partitions share the serial link
     char     sockBuf[SOCK_BUF_SIZE];
     int      sockRecvBytes = 0;
+    int      sockPart = 0;          // partition of the web app's keypad, the one its status line shows
+    uint32_t sockVersion = 0;       // state version last sent to web app
+    int      sockMin = -1;          // minute last sent to web app
 
     signal(SIGINT,  intHandler);  // catch and handle interrupt signals
     signal(SIGTERM, intHandler);
     signal(SIGKILL, intHandler);
     signal(SIGQUIT, intHandler);
-    signal(SIGHUP,  intHandler);
+    signal(SIGHUP,  hupHandler);
+    signal(SIGSEGV, fatalHandler);
+    signal(SIGBUS,  fatalHandler);
+    signal(SIGFPE,  fatalHandler);
+    signal(SIGILL,  fatalHandler);
+    signal(SIGABRT, fatalHandler);
+
+    setAll(sendF7msgNow, partCount);
 
     fprintf(stdout, "alarm app started\n");
     fflush(stdout);
@@ -122,7 +200,8 @@ int main(int argc, char *argv[])
     {
         if (READ_BUF_SIZE-readBufIdx-1 < 1)
         {
-            logMsg(LOG_DEFAULT, "read buffer overflow, discarding read buffer\n");
+            ERR_MSG(LOG_CAT_SERIAL, "read buffer overflow, discarding read buffer\n");
+            alarmStats.serialErrors++;
             readBufIdx = 0;
         }
         bool newLine = false;
@@ -133,9 +212,12 @@ int main(int argc, char *argv[])
             switch (serial.parseMsg(readBuf, readBufIdx)) // what type of message was received?
             {
                 case SERIAL_CMD_KEYS:
-                    alarmManager.processKeyMsg(readBuf, readBufIdx);
-                    sendF7msgNow = true;
+                {
+                    AlarmManager * pPart = AlarmManager::dispatchKeyMsg(readBuf, readBufIdx);
+                    if (pPart != NULL)
+                        sendF7msgNow[pPart - part] = true;
                     break;
+                }
 
                 case SERIAL_CMD_VOLTS:
                     handleVoltMsg(&alarmManager, readBuf, readBufIdx);
@@ -143,61 +225,159 @@ int main(int argc, char *argv[])
 
                 case SERIAL_CMD_ERROR:
                 default:
-                    logMsg(LOG_DEFAULT, "parseMsg error, resend F7 msg\n");
-                    sendF7msgNow = true;  // resend msg that failed
+                    ERR_MSG(LOG_CAT_SERIAL, "parseMsg error, resend F7 msg\n");
+                    setAll(sendF7msgNow, partCount);  // resend msg that failed
                     break;
             }
             readBufIdx = 0;  // reset buffer index for new command
         }
 
-        memset(sockBuf, 0, SOCK_BUF_SIZE);
-        if ((sockRecvBytes = sock.recvMsg(sockBuf, SOCK_BUF_SIZE)) > 0)  // check socket from web app
+        // process the complete commands received from the web app and socket server clients
+        for (int i=0; i < MAX_SOCK_CMDS; i++)
         {
+            int client = -1;  // socket server client index, -1 for the web app
+            if ((sockRecvBytes = sock.recvMsg(sockBuf, SOCK_BUF_SIZE)) <= 0 &&
+                (sockRecvBytes = server.recvMsg(sockBuf, SOCK_BUF_SIZE, &client)) <= 0)
+            {
+                break;  // no more commands this pass
+            }
+            alarmStats.sockCmds++;
+
             if (strncmp(sockBuf, "KEYS_", 5) == 0)
             {
-                alarmManager.processKeyMsg(sockBuf, sockRecvBytes);
-                sendF7msgNow = true;
+                AlarmManager * pPart = AlarmManager::dispatchKeyMsg(sockBuf, sockRecvBytes);
+                if (pPart != NULL)
+                {
+                    sendF7msgNow[pPart - part] = true;
+                    if (client < 0 && pPart - part != sockPart)
+                    {
+                        sockPart = pPart - part;  // web app moved to another partition, send its status
+                        sockVersion = 0;
+                    }
+                }
+            }
+            else if (strncmp(sockBuf, "SUB", 3) == 0 && client >= 0)  // subscribe to state, optionally resuming
+            {
+                unsigned int epoch = 0, version = 0, partition = 0;
+                sscanf(sockBuf+3, "%u %u %u", &epoch, &version, &partition);
+                if (partition < (unsigned int)partCount)
+                    server.subscribe(client, partition, epoch == part[partition].getStateEpoch() ? version : 0);
+                else
+                    ERR_MSG(LOG_CAT_SOCK, "SUB to unknown partition %u\n", partition);
             }
             else
             {
-                logMsg(LOG_DEFAULT, "Recv unexpected msg on socket '%s'\n", sockBuf);
+                ERR_MSG(LOG_CAT_SOCK, "Recv unexpected msg on socket '%s'\n", sockBuf);
             }
         }
         
-        if (alarmManager.checkLoops(&prevLoopMask))  // check sense loops for change
+        if (watch.changed())
         {
-            sendF7msgNow = true;
+            reload = 1;
+        }
+        if (reload)  // SIGHUP or config file edited
+        {
+            reload = 0;
+            if (reloadConfig(&pConfig, &pSpare, part, partCount, &loops, &http, &ctl, &status))
+            {
+                inputTrace.reload(ALARM_CONFIG_FILE);
+                setAll(sendF7msgNow, partCount);
+            }
         }
 
-        if (alarmManager.checkTimeouts())  // check timeout conditions
+        if (loops.sample())  // one sample of the sense loops for all partitions
         {
-            sendF7msgNow = true;
+            inputTrace.loops(loops.getMask(), loops.getNoise());
         }
 
-        // check to see if it is time to send a new F7 msg (don't send faster than every MIN_MS_BETWEEN_F7_MSGS)
-        if (sendF7msgNow)
+        bool changed = false;  // a check changed the alarm state, the pass is traced
+        inputTrace.check();
+        for (int p=0; p < partCount; p++)
         {
-            uint32_t ts = AlarmManager::getTimestamp();
-            uint32_t lts = alarmManager.getLastMsgTime();
+            if (part[p].checkLoops(loops.getMask(), loops.getNoise()))  // check partition's sense loops for change
+            {
+                sendF7msgNow[p] = true;
+                changed = true;
+            }
+
+            if (part[p].checkTimeouts())  // check timeout conditions
+            {
+                sendF7msgNow[p] = true;
+                changed = true;
+            }
+        }
+
+        if (http.poll(part, partCount))  // serve http requests, key commands update the keypad
+        {
+            setAll(sendF7msgNow, partCount);
+        }
+
+        if (ctl.poll(part, partCount))  // local automation requests
+        {
+            setAll(sendF7msgNow, partCount);
+        }
+
+        for (int p=0; p < partCount; p++)
+            part[p].publishState();     // bump state version if anything changed
+        server.publish(part, partCount);  // and push deltas to subscribed clients
+        ctl.publish(part, partCount);
+        status.publish(part, partCount, &alarmStats);
+
+        // check to see if it is time to send a new F7 msg (don't send faster than every MIN_MS_BETWEEN_F7_MSGS).
+        //   One partition is sent per pass, in turn, since they share the serial link
+        int p = 0;
+        while (p < partCount && !sendF7msgNow[p])
+            p++;
+        if (p < partCount)
+        {
+            uint64_t ts = Clock::ms();
+            uint64_t lts = lastF7;
             if (ts - lts > MIN_MS_BETWEEN_F7_MSGS)
             {
-                //logMsg(LOG_DEFAULT, "send F7, curr %u, last %u, diff ms = %u\n", ts, lts, ts - lts);
+                TRACE_MSG(LOG_CAT_SERIAL, "send F7 partition %d, curr %llu, last %llu, diff ms = %u\n", p,
+                    (unsigned long long)ts, (unsigned long long)lts, (uint32_t)(ts - lts));
                 time_t currTime = time(NULL);
                 struct tm * pTime = localtime(&currTime);
-                serial.sendF7msg(&alarmManager, MIL_TO_12HR(pTime->tm_hour), pTime->tm_min);
-                sock.sendMsg(alarmManager.getSockMsg(MIL_TO_12HR(pTime->tm_hour), pTime->tm_min));
-                sendF7msgNow = false;
+                inputTrace.frame(p, MIL_TO_12HR(pTime->tm_hour), pTime->tm_min);
+                serial.sendF7msg(&part[p], MIL_TO_12HR(pTime->tm_hour), pTime->tm_min);
+                lastF7 = part[p].getLastMsgTime();
+                http.pushFrame(&part[p], MIL_TO_12HR(pTime->tm_hour), pTime->tm_min);  // browser keypads showing p
+                if (p == sockPart)
+                {
+                    // web app gets the full status line, but only when the state or displayed time changed
+                    if (sockVersion != part[p].getStateVersion() || sockMin != pTime->tm_min)
+                    {
+                        bool sent = sock.sendMsg(part[p].getSockMsg(MIL_TO_12HR(pTime->tm_hour), pTime->tm_min));
+                        sockVersion = sent ? part[p].getStateVersion() : 0;  // not connected or socket full, resend
+                        sockMin = pTime->tm_min;
+                    }
+                }
+                sendF7msgNow[p] = false;
             }
             else
             {
-                logMsg(LOG_DEFAULT, "wait to send F7, curr %u, last %u, diff ms = %u\n", ts, lts, ts - lts);
+                DEBUG_MSG(LOG_CAT_SERIAL, "wait to send F7, curr %llu, last %llu, diff ms = %u\n",
+                    (unsigned long long)ts, (unsigned long long)lts, (uint32_t)(ts - lts));
             }
         }
-        usleep(MAIN_LOOP_SLEEP_MS * 1000);  // main loop sleep 
+        inputTrace.endPass(changed);
+        ctl.wait(MAIN_LOOP_SLEEP_MS);  // main loop sleep, cut short by a control request
     }
+    watch.fini();
+    status.fini();
+    ctl.fini();
+    http.fini();
+    server.fini();
     sock.fini();
     serial.fini();
     alarmManager.sendAlertMsg("alarm app shutdown");
+    for (int p=0; p < partCount; p++)
+        part[p].fini();
+    journal.fini();
+    armStore.fini();
+    inputTrace.fini();
+    delete[] part;
+    delete[] sendF7msgNow;
     fprintf(stdout, "alarm app shutdown\n");
     fflush(stdout);
     finiLogMsg();
@@ -206,6 +386,66 @@ int main(int argc, char *argv[])
 
 // --------------------------------------------- support funcs ------------------------------------------
 
+// configure pin io for the sense loops and outputs of pConfig
+void setupGpio(Config * pConfig)
+{
+    Loop * pLoop = pConfig->getLoop();   // get pointer to sense loop table
+
+    for (int i=0; i < pConfig->getLoopCount(); i++)  // configure pin io for sense loops
+    {
+        pinMode(pLoop->gpio[i], INPUT);           // enable as input
+        pullUpDnControl(pLoop->gpio[i], PUD_UP);  // enable pull-up resistor on input
+    }
+    for (int i=0; i < pConfig->getOutputCount(); i++) // config pin out for outputs
+    {
+        int pin = pConfig->getOutputs()->gpio[i];
+        pinMode(pin, OUTPUT);  // set as output
+    }
+}
+
+// set all count flags
+void setAll(uint8_t * flags, int count)
+{
+    for (int i=0; i < count; i++)
+        flags[i] = true;
+}
+
+// read the config file into the spare config and, if it is valid, swap it with the current
+//   config.  The current config is untouched until the new one has been read and checked, so a
+//   bad edit leaves the alarm running as it was.  Returns: true if the new config is in use
+bool reloadConfig(Config ** ppConfig, Config ** ppSpare, AlarmManager * part, int partCount, SenseLoops * pLoops,
+    HttpServer * pHttp, CtlServer * pCtl, StatusShm * pStatus)
+{
+    Config * pNew = *ppSpare;
+
+    if (!pNew->readFile(ALARM_CONFIG_FILE) || !pNew->validate())  // replaces what the previous reload left behind
+    {
+        ERR_MSG(LOG_CAT_ALARM, "Config reload failed, keeping current config\n");
+        return false;
+    }
+    if (pNew->getPartitionCount() != partCount)
+    {
+        ERR_MSG(LOG_CAT_ALARM, "PARTITION lines added or removed, restart the alarm to apply\n");
+        return false;
+    }
+    pNew->reportRestartParms(*ppConfig);
+
+    setLogLevel(-1, LOG_LVL_DEBUG);  // default, in case LOG_LEVEL was removed
+    setLogLevels(pNew->getLogLevel());
+
+    setupGpio(pNew);
+    pLoops->setConfig(pNew);
+    for (int p=0; p < partCount; p++)
+        part[p].setConfig(pNew, pLoops->getMask());
+    pHttp->setConfig(pNew);
+    pCtl->setConfig(pNew);
+    pStatus->setZones(pNew);
+
+    *ppSpare = *ppConfig;  // old config is reused by the next reload
+    *ppConfig = pNew;
+    return true;
+}
+
 void handleVoltMsg(AlarmManager * pAlarmManager, const char * msg, int msgLen)
 {
     // FIXME - Handle voltage message from arduino
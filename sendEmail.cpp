@@ -17,64 +17,146 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <curl/curl.h>
 #include "sendEmail.h"
 #include "logMsg.h"
 
-// free alloced components of t_EmailData struct
-static void freeEmailData(t_EmailData * data)
+// fixed text of the MIME message.  Lengths are computed at compile time
+struct t_MailText {
+    const char * str;
+    size_t       len;
+};
+#define MAIL_TEXT(s) { s, sizeof(s) - 1 }
+
+static const t_MailText MAIL_VERSION = MAIL_TEXT("MIME-Version: 1.0\r\n");
+static const t_MailText MAIL_TO      = MAIL_TEXT("To: ");
+static const t_MailText MAIL_FROM    = MAIL_TEXT("From: ");
+static const t_MailText MAIL_SUBJECT = MAIL_TEXT("Subject: ");
+static const t_MailText MAIL_EOL     = MAIL_TEXT("\r\n");
+static const t_MailText MAIL_TEXT_PART = MAIL_TEXT(
+    "Content-Type: multipart/alternative; boundary=border\r\n"
+    "\r\n"
+    "--border\r\n"
+    "Content-Type: text/plain; charset=UTF-8\r\n"
+    "\r\n");
+static const t_MailText MAIL_HTML_PART = MAIL_TEXT(
+    "\r\n"
+    "--border\r\n"
+    "Content-Type: text/html; charset=UTF-8\r\n"
+    "\r\n"
+    "<div dir=\"ltr\">");
+static const t_MailText MAIL_END     = MAIL_TEXT(
+    "</div>\r\n"
+    "\r\n"
+    "--border--\r\n");
+
+static const size_t MAIL_DATE_MAX = 48;  // max size of formatted Date: line
+
+// return the replacement text for chars that must be escaped in html, NULL if none needed
+static const t_MailText * htmlEscape(char c)
 {
-    if (data->email)
+    static const t_MailText amp  = MAIL_TEXT("&amp;");
+    static const t_MailText lt   = MAIL_TEXT("&lt;");
+    static const t_MailText gt   = MAIL_TEXT("&gt;");
+    static const t_MailText quot = MAIL_TEXT("&quot;");
+    static const t_MailText apos = MAIL_TEXT("&#39;");
+
+    switch (c)
     {
-        free((void *)data->email);
-        data->email = NULL;
+        case '&':  return &amp;
+        case '<':  return &lt;
+        case '>':  return &gt;
+        case '"':  return &quot;
+        case '\'': return &apos;
+        default:   return NULL;
     }
 }
 
-static t_EmailData * initEmailData(t_EmailData * data, const char * to, const char * from, 
-    const char * subject, const char * msg)
+// return the length of str once html escaped
+static size_t htmlEscapedLen(const char * str, size_t len)
 {
-    static const int maxMsgSize = 1024;
+    size_t escLen = len;
+    for (size_t i=0; i < len; i++)
+    {
+        const t_MailText * esc = htmlEscape(str[i]);
+        if (esc != NULL)
+            escLen += esc->len - 1;
+    }
+    return escLen;
+}
 
-    time_t tloc = time(NULL);
-    struct tm * timeinfo = localtime(&tloc);
+// append len bytes of str to the message.  Returns: false if message is full
+static bool putBytes(t_EmailData * data, const char * str, size_t len)
+{
+    if (len > EMAIL_MAX_SIZE - data->len)
+        return false;
+    memcpy(data->email + data->len, str, len);
+    data->len += len;
+    return true;
+}
 
-    data->len = 0;
-    data->pos = 0;
-    data->email = (char *)malloc(maxMsgSize);  // max size of resulting message
+static bool putText(t_EmailData * data, const t_MailText & text)
+{
+    return putBytes(data, text.str, text.len);
+}
 
-    if (data->email != NULL)
+// append str to the message, html escaping special chars.  Returns: false if message is full
+static bool putHtml(t_EmailData * data, const char * str, size_t len)
+{
+    bool ok = true;
+    size_t run = 0;  // start of run of chars that need no escaping
+
+    for (size_t i=0; ok && i < len; i++)
     {
-        memset((void *)(data->email), 0, maxMsgSize);
-
-        char * p = data->email;
-        int i = 0;
-        i += sprintf(p + i, "MIME-Version: 1.0\r\n");
-        i += strftime(p + i, 48, "Date: %a, %d %b %Y %T %z\r\n", timeinfo);
-        i += sprintf(p + i, "To: %s\r\n", to);
-        i += sprintf(p + i, "From: %s\r\n", from);
-        i += sprintf(p + i, "Subject: %s\r\n", subject);
-        i += sprintf(p + i, "Content-Type: multipart/alternative; boundary=border\r\n");
-        i += sprintf(p + i, "\r\n");
-        i += sprintf(p + i, "--border\r\n");
-        i += sprintf(p + i, "Content-Type: text/plain; charset=UTF-8\r\n");
-        i += sprintf(p + i, "\r\n");
-        i += sprintf(p + i, "%s", msg);
-        i += sprintf(p + i, "\r\n");
-        i += sprintf(p + i, "--border\r\n");
-        i += sprintf(p + i, "Content-Type: text/html; charset=UTF-8\r\n");
-        i += sprintf(p + i, "\r\n");
-        i += sprintf(p + i, "<div dir=\"ltr\">%s</div>\r\n", msg);
-        i += sprintf(p + i, "\r\n");
-        i += sprintf(p + i, "--border--\r\n");
-
-        if (i >= maxMsgSize)
+        const t_MailText * esc = htmlEscape(str[i]);
+        if (esc != NULL)
         {
-            logMsg(LOG_DEFAULT, "initEmailData exceeded max message size! len=%d, max=%d\n", i, maxMsgSize);
+            ok = putBytes(data, str + run, i - run) && putText(data, *esc);
+            run = i + 1;
         }
-        data->len = i;
     }
-    return data;
+    return ok && putBytes(data, str + run, len - run);
+}
+
+// build the complete MIME message in data.  Returns: false if message does not fit
+static bool initEmailData(t_EmailData * data, const char * to, const char * from,
+    const char * subject, const char * msg)
+{
+    size_t toLen   = strlen(to);
+    size_t fromLen = strlen(from);
+    size_t subjLen = strlen(subject);
+    size_t msgLen  = strlen(msg);
+
+    data->len = 0;
+    data->pos = 0;
+
+    // size the message once up front, so it is never partially built
+    size_t size = MAIL_VERSION.len + MAIL_DATE_MAX +
+        MAIL_TO.len + toLen + MAIL_EOL.len +
+        MAIL_FROM.len + fromLen + MAIL_EOL.len +
+        MAIL_SUBJECT.len + subjLen + MAIL_EOL.len +
+        MAIL_TEXT_PART.len + msgLen + MAIL_HTML_PART.len + htmlEscapedLen(msg, msgLen) + MAIL_END.len;
+
+    if (size > EMAIL_MAX_SIZE)
+    {
+        ERR_MSG(LOG_CAT_ALARM, "initEmailData exceeded max message size! len=%u, max=%u\n", 
+            (unsigned)size, (unsigned)EMAIL_MAX_SIZE);
+        return false;
+    }
+
+    time_t tloc = time(NULL);
+    struct tm timeinfo;
+    localtime_r(&tloc, &timeinfo);
+
+    putText(data, MAIL_VERSION);
+    data->len += strftime(data->email + data->len, MAIL_DATE_MAX, "Date: %a, %d %b %Y %T %z\r\n", &timeinfo);
+
+    return putText(data, MAIL_TO) && putBytes(data, to, toLen) && putText(data, MAIL_EOL) &&
+        putText(data, MAIL_FROM) && putBytes(data, from, fromLen) && putText(data, MAIL_EOL) &&
+        putText(data, MAIL_SUBJECT) && putBytes(data, subject, subjLen) && putText(data, MAIL_EOL) &&
+        putText(data, MAIL_TEXT_PART) && putBytes(data, msg, msgLen) &&
+        putText(data, MAIL_HTML_PART) && putHtml(data, msg, msgLen) && putText(data, MAIL_END);
 }
 
 // function used to read source data for sending via curl-post
@@ -84,18 +166,13 @@ static size_t readCallback(char * ptr, size_t size, size_t nmemb, void * userp)
         return 0;
 
     t_EmailData * upload = (t_EmailData *)userp;
-    const char * pEmail = upload->email + upload->pos;  // advance pointer past what has been sent
+    size_t len = upload->len - upload->pos;  // bytes not yet sent
 
-    if (upload->pos < upload->len && pEmail)
-    {
-        size_t len = strlen(pEmail);
-        if (len > size * nmemb) 
-            return CURL_READFUNC_ABORT;
-        memcpy(ptr, pEmail, len);       // copy remaining msg to ptr
-        upload->pos += len;
-        return len;
-    }
-    return 0;
+    if (len > size * nmemb)
+        len = size * nmemb;  // send as much as curl will take, rest goes in next call
+    memcpy(ptr, upload->email + upload->pos, len);
+    upload->pos += len;
+    return len;
 }
 
 // send email via gmail using curl
@@ -113,10 +190,9 @@ bool sendEmail(const char * from, const char * to, const char * passwd, const ch
     struct curl_slist * recipients = NULL;
     recipients = curl_slist_append(recipients, to);
 
-    t_EmailData data = {0};                      // init struct with zeros
-    initEmailData(&data, to, from, subj, mesg);  // fill in real data
+    t_EmailData data;  // message is built in place, no heap allocation
 
-    if (data.email != NULL)
+    if (initEmailData(&data, to, from, subj, mesg))
     {
         // set username/passwd/mail_server
         curl_easy_setopt(curl, CURLOPT_USERNAME, from);
@@ -139,7 +215,6 @@ bool sendEmail(const char * from, const char * to, const char * passwd, const ch
             fprintf(stderr, "sendTextAlert curl failed: %s\n", curl_easy_strerror(res));
             success = false;
         }
-        freeEmailData(&data);
     }
     else
     {
@@ -18,10 +18,12 @@
 
 #include <stdio.h>
 
+static const size_t EMAIL_MAX_SIZE = 2048;  // max size of a complete MIME message
+
 typedef struct {
-    char * email;
-    size_t len;
-    size_t pos;
+    char   email[EMAIL_MAX_SIZE];  // message text (not NULL terminated)
+    size_t len;                    // bytes of message text in email
+    size_t pos;                    // bytes already handed to curl
 } t_EmailData;
 
 bool sendEmail(const char * from, const char * to, const char * passwd, const char * subj, const char * mesg);